@@ -0,0 +1,201 @@
+/*
+ * Counts the heap allocations made while serving keep-alive GET requests,
+ * once the server has warmed up. Allocations made by libevent (the chains
+ * of the socket and reply buffers) are counted apart from the rest, which
+ * are expected to be none at all. Also checks that everything allocated
+ * while the server ran, including what evhtp keeps cached for reuse, has
+ * been released once it is freed.
+ *
+ * usage: bench_allocs [num_requests [max_libevent_allocs_per_request]]
+ *
+ * exits with 1 if anything besides libevent allocated in the steady state,
+ * if libevent allocated more than the given maximum per request, or if
+ * anything was left allocated after teardown.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#ifndef EVHTP_DISABLE_REGEX
+#include <onigposix.h>
+#endif
+
+#include <evhtp.h>
+
+#define WARMUP 200
+
+static const char request[] =
+    "GET /index.html?a=1&b=2 HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "User-Agent: bench_allocs\r\n"
+    "Accept: */*\r\n\r\n";
+
+static int  counting      = 0;
+static long num_allocs    = 0;
+static long num_ev_allocs = 0;
+static long num_live      = 0; /* blocks allocated and not free()'d yet */
+
+#ifdef __GLIBC__
+extern void * __libc_malloc(size_t);
+extern void * __libc_calloc(size_t, size_t);
+extern void * __libc_realloc(void *, size_t);
+extern void   __libc_free(void *);
+
+void *
+malloc(size_t len) {
+    void * res = __libc_malloc(len);
+
+    num_allocs += counting;
+    num_live   += res != NULL;
+
+    return res;
+}
+
+void *
+calloc(size_t nmemb, size_t len) {
+    void * res = __libc_calloc(nmemb, len);
+
+    num_allocs += counting;
+    num_live   += res != NULL;
+
+    return res;
+}
+
+void *
+realloc(void * ptr, size_t len) {
+    void * res = __libc_realloc(ptr, len);
+
+    num_allocs += counting;
+
+    if (ptr == NULL) {
+        num_live += res != NULL;
+    } else if (len == 0) {
+        num_live--;
+    }
+
+    return res;
+}
+
+void
+free(void * ptr) {
+    num_live -= ptr != NULL;
+
+    __libc_free(ptr);
+}
+
+#endif
+
+static void *
+_ev_malloc(size_t len) {
+    num_ev_allocs += counting;
+
+    return malloc(len);
+}
+
+static void *
+_ev_realloc(void * ptr, size_t len) {
+    num_ev_allocs += counting;
+
+    return realloc(ptr, len);
+}
+
+static void
+_ev_free(void * ptr) {
+    free(ptr);
+}
+
+static void
+_index_cb(evhtp_request_t * req, void * arg) {
+    evbuffer_add(req->buffer_out, "hello", 5);
+    evhtp_send_reply(req, EVHTP_RES_OK);
+}
+
+int
+main(int argc, char ** argv) {
+    int                num_requests = argc > 1 ? atoi(argv[1]) : 10000;
+    double             max_ev       = argc > 2 ? atof(argv[2]) : -1;
+    double             ev_per_req;
+    long               live;
+    struct timeval     wait = { 0, 100000 };
+    evbase_t         * evbase;
+    evhtp_t          * htp;
+    struct sockaddr_in sin;
+    socklen_t          sin_len = sizeof(sin);
+    char               buf[4096];
+    int                sock;
+    int                i;
+
+#ifndef __GLIBC__
+    fprintf(stderr, "counting allocations needs glibc\n");
+    return 0;
+#endif
+
+    event_set_mem_functions(_ev_malloc, _ev_realloc, _ev_free);
+
+    live   = num_live;
+    evbase = event_base_new();
+    htp    = evhtp_new(evbase, NULL);
+
+    evhtp_set_cb(htp, "/", _index_cb, NULL);
+
+    if (evhtp_bind_socket(htp, "127.0.0.1", 0, 128) < 0) {
+        fprintf(stderr, "could not bind\n");
+        return 1;
+    }
+
+    getsockname(evconnlistener_get_fd(htp->server), (struct sockaddr *)&sin, &sin_len);
+
+    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+        connect(sock, (struct sockaddr *)&sin, sin_len) < 0) {
+        fprintf(stderr, "could not connect\n");
+        return 1;
+    }
+
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+
+    for (i = 0; i < WARMUP + num_requests; i++) {
+        counting = i >= WARMUP;
+
+        if (write(sock, request, sizeof(request) - 1) != sizeof(request) - 1) {
+            fprintf(stderr, "write failed\n");
+            return 1;
+        }
+
+        /* run the server until the reply comes back */
+        do {
+            event_base_loop(evbase, EVLOOP_NONBLOCK);
+        } while (read(sock, buf, sizeof(buf)) <= 0);
+    }
+
+    counting   = 0;
+    ev_per_req = (double)num_ev_allocs / num_requests;
+
+    close(sock);
+
+    /* let the server see the connection go away */
+    event_base_loopexit(evbase, &wait);
+    event_base_dispatch(evbase);
+
+    evhtp_unbind_socket(htp);
+    evhtp_free(htp);
+    event_base_free(evbase);
+
+    /* taken before printing, which allocates the buffer of stdout */
+    live = num_live - live;
+
+    printf("%d requests\n", num_requests);
+    printf("libevent allocations per request: %.2f\n", ev_per_req);
+    printf("other allocations per request:    %.2f\n",
+           (double)(num_allocs - num_ev_allocs) / num_requests);
+    printf("left allocated after teardown:    %ld\n", live);
+
+    if (max_ev >= 0 && ev_per_req > max_ev) {
+        fprintf(stderr, "more than %.2f libevent allocations per request\n", max_ev);
+        return 1;
+    }
+
+    return num_allocs > num_ev_allocs || live != 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * Measures the heap memory held by the parser of an idle keep-alive
+ * connection: every parser is fed one request (with a uri long enough to
+ * need more than the inline scratch buffer) and then left waiting for the
+ * next one.
+ *
+ * usage: bench_idle [num_parsers]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <malloc.h>
+
+#include "htparse.h"
+
+static const char request[] =
+    "GET /static/images/2016/08/some-rather-long-file-name-for-an-image.jpg"
+    "?width=1024&height=768&quality=85&format=progressive&cache=1&session="
+    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+    "0123456789abcdef0123456789abcdef0123456789abcdef HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:48.0) Gecko/20100101 Firefox/48.0\r\n"
+    "Accept: image/png,image/*;q=0.8,*/*;q=0.5\r\n"
+    "Connection: keep-alive\r\n\r\n";
+
+static size_t
+heap_in_use(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return (size_t)mallinfo().uordblks;
+#endif
+}
+
+int
+main(int argc, char ** argv) {
+    htparse_hooks hooks;
+    htparser   ** parsers;
+    size_t        before;
+    size_t        after;
+    int           num;
+    int           i;
+
+    num = argc > 1 ? atoi(argv[1]) : 100000;
+
+    if (num <= 0 || !(parsers = calloc(num, sizeof(htparser *)))) {
+        return 1;
+    }
+
+    memset(&hooks, 0, sizeof(hooks));
+
+    before = heap_in_use();
+
+    for (i = 0; i < num; i++) {
+        parsers[i] = htparser_new();
+        htparser_init(parsers[i], htp_type_request);
+
+        if (htparser_run(parsers[i], &hooks, request, sizeof(request) - 1) != sizeof(request) - 1) {
+            fprintf(stderr, "parse error: %s\n", htparser_get_strerror(parsers[i]));
+            return 1;
+        }
+    }
+
+    after = heap_in_use();
+
+    printf("idle parsers:     %d\n", num);
+    printf("bytes per parser: %.1f\n", (double)(after - before) / num);
+
+    return 0;
+}
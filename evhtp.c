@@ -6,6 +6,9 @@
 #include <signal.h>
 #include <strings.h>
 #include <inttypes.h>
+#include <time.h>
+#include <limits.h>
+#include <ctype.h>
 #ifndef WIN32
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -23,10 +26,10 @@
 #include <onigposix.h>
 #endif
 
-#include <sys/tree.h>
-
 #include "evhtp.h"
 
+#include <event2/buffer_compat.h>
+
 static int                  _evhtp_request_parser_start(htparser * p);
 static int                  _evhtp_request_parser_path(htparser * p, const char * data, size_t len);
 static int                  _evhtp_request_parser_args(htparser * p, const char * data, size_t len);
@@ -45,11 +48,15 @@ static void                 _evhtp_connection_readcb(evbev_t * bev, void * arg);
 
 static evhtp_connection_t * _evhtp_connection_new(evhtp_t * htp, evutil_socket_t sock, evhtp_type type);
 
-static evhtp_uri_t        * _evhtp_uri_new(void);
+static evhtp_uri_t        * _evhtp_uri_new(evhtp_arena_t * arena);
 static void                 _evhtp_uri_free(evhtp_uri_t * uri);
 
-static evhtp_path_t       * _evhtp_path_new(const char * data, size_t len);
-static void                 _evhtp_path_free(evhtp_path_t * path);
+static evhtp_path_t       * _evhtp_path_new(evhtp_arena_t * arena, const char * data, size_t len);
+
+static evhtp_kvs_t        * _evhtp_kvs_new(evhtp_arena_t * arena, int indexed);
+static evhtp_kv_t         * _evhtp_kv_new(evhtp_arena_t * arena, const char * key, const char * val, char kalloc, char valloc);
+static evhtp_kv_t         * _evhtp_kvs_find(evhtp_kvs_t * kvs, const char * key, size_t len);
+static evhtp_query_t      * _evhtp_parse_query(evhtp_arena_t * arena, const char * query, size_t len);
 
 #define HOOK_AVAIL(var, hook_name)                 (var->hooks && var->hooks->hook_name)
 #define HOOK_FUNC(var, hook_name)                  (var->hooks->hook_name)
@@ -96,6 +103,10 @@ static void                 _evhtp_path_free(evhtp_path_t * path);
 #define _evhtp_unlock(h)                           do {} while (0)
 #endif
 
+/* for the parts of the callback index which lookups read without a lock */
+#define _evhtp_load(p)                             __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define _evhtp_store(p, v)                         __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
 #ifndef TAILQ_FOREACH_SAFE
 #define TAILQ_FOREACH_SAFE(var, head, field, tvar)        \
     for ((var) = TAILQ_FIRST((head));                     \
@@ -103,118 +114,101 @@ static void                 _evhtp_path_free(evhtp_path_t * path);
          (var) = (tvar))
 #endif
 
-static int scode_tree_initialized = 0;
-
 /**
- * @brief An RBTREE entry for the status code -> str matcher
+ * @brief the reason phrase of a status code, along with the status lines
+ *        using it, formatted at compile time
  */
 struct status_code {
-    evhtp_res    code;
     const char * str;
-
-    RB_ENTRY(status_code) entry;
+    const char * line[2];    /**< "HTTP/1.x <code> <str>\r\n", indexed by x */
+    size_t       line_len;
 };
 
+#define _scode_str(scode)  #scode
+#define _scode_xstr(scode) _scode_str(scode)
+#define _scode_line(scode, minor, cstr) \
+    "HTTP/1." minor " " _scode_xstr(scode) " " cstr "\r\n"
 
-static int
-status_code_cmp(void * _a, void * _b) {
-    struct status_code * a = _a;
-    struct status_code * b = _b;
-
-    return b->code - a->code;
-}
-
-RB_HEAD(status_code_tree, status_code) status_code_head = RB_INITIALIZER(&status_code_head);
-RB_GENERATE(status_code_tree, status_code, entry, status_code_cmp)
-
-#define scode_add(scode, cstr) do {                                  \
-        struct status_code * c = malloc(sizeof(struct status_code)); \
-                                                                     \
-        c->code = scode;                                             \
-        c->str  = cstr;                                              \
-                                                                     \
-        RB_INSERT(status_code_tree, &status_code_head, c);           \
-} while (0)
-
-static void
-status_code_init(void) {
-    if (scode_tree_initialized) {
-        /* Already initialized. */
-        return;
+#define scode_add(scode, cstr)                       \
+    [scode] = {                                      \
+        cstr,                                        \
+        { _scode_line(scode, "0", cstr),             \
+          _scode_line(scode, "1", cstr) },           \
+        sizeof(_scode_line(scode, "0", cstr)) - 1    \
     }
 
+#define SCODE_MAX 600
+
+/**
+ * @brief status codes indexed by their value, codes which are not listed
+ *        are left zeroed
+ */
+static const struct status_code status_codes[SCODE_MAX] = {
     /* 100 codes */
-    scode_add(EVHTP_RES_CONTINUE, "Continue");
-    scode_add(EVHTP_RES_SWITCH_PROTO, "Switching Protocols");
-    scode_add(EVHTP_RES_PROCESSING, "Processing");
-    scode_add(EVHTP_RES_URI_TOOLONG, "URI Too Long");
+    scode_add(EVHTP_RES_CONTINUE, "Continue"),
+    scode_add(EVHTP_RES_SWITCH_PROTO, "Switching Protocols"),
+    scode_add(EVHTP_RES_PROCESSING, "Processing"),
+    scode_add(EVHTP_RES_URI_TOOLONG, "URI Too Long"),
 
     /* 200 codes */
-    scode_add(EVHTP_RES_200, "OK");
-    scode_add(EVHTP_RES_CREATED, "Created");
-    scode_add(EVHTP_RES_ACCEPTED, "Accepted");
-    scode_add(EVHTP_RES_NAUTHINFO, "No Auth Info");
-    scode_add(EVHTP_RES_NOCONTENT, "No Content");
-    scode_add(EVHTP_RES_RSTCONTENT, "Reset Content");
-    scode_add(EVHTP_RES_PARTIAL, "Partial Content");
-    scode_add(EVHTP_RES_MSTATUS, "Multi-Status");
-    scode_add(EVHTP_RES_IMUSED, "IM Used");
+    scode_add(EVHTP_RES_200, "OK"),
+    scode_add(EVHTP_RES_CREATED, "Created"),
+    scode_add(EVHTP_RES_ACCEPTED, "Accepted"),
+    scode_add(EVHTP_RES_NAUTHINFO, "No Auth Info"),
+    scode_add(EVHTP_RES_NOCONTENT, "No Content"),
+    scode_add(EVHTP_RES_RSTCONTENT, "Reset Content"),
+    scode_add(EVHTP_RES_PARTIAL, "Partial Content"),
+    scode_add(EVHTP_RES_MSTATUS, "Multi-Status"),
+    scode_add(EVHTP_RES_IMUSED, "IM Used"),
 
     /* 300 codes */
-    scode_add(EVHTP_RES_300, "Redirect");
-    scode_add(EVHTP_RES_MOVEDPERM, "Moved Permanently");
-    scode_add(EVHTP_RES_FOUND, "Found");
-    scode_add(EVHTP_RES_SEEOTHER, "See Other");
-    scode_add(EVHTP_RES_NOTMOD, "Not Modified");
-    scode_add(EVHTP_RES_USEPROXY, "Use Proxy");
-    scode_add(EVHTP_RES_SWITCHPROXY, "Switch Proxy");
-    scode_add(EVHTP_RES_TMPREDIR, "Temporary Redirect");
+    scode_add(EVHTP_RES_300, "Redirect"),
+    scode_add(EVHTP_RES_MOVEDPERM, "Moved Permanently"),
+    scode_add(EVHTP_RES_FOUND, "Found"),
+    scode_add(EVHTP_RES_SEEOTHER, "See Other"),
+    scode_add(EVHTP_RES_NOTMOD, "Not Modified"),
+    scode_add(EVHTP_RES_USEPROXY, "Use Proxy"),
+    scode_add(EVHTP_RES_SWITCHPROXY, "Switch Proxy"),
+    scode_add(EVHTP_RES_TMPREDIR, "Temporary Redirect"),
 
     /* 400 codes */
-    scode_add(EVHTP_RES_400, "Bad Request");
-    scode_add(EVHTP_RES_UNAUTH, "Unauthorized");
-    scode_add(EVHTP_RES_PAYREQ, "Payment Required");
-    scode_add(EVHTP_RES_FORBIDDEN, "Forbidden");
-    scode_add(EVHTP_RES_NOTFOUND, "Not Found");
-    scode_add(EVHTP_RES_METHNALLOWED, "Not Allowed");
-    scode_add(EVHTP_RES_NACCEPTABLE, "Not Acceptable");
-    scode_add(EVHTP_RES_PROXYAUTHREQ, "Proxy Authentication Required");
-    scode_add(EVHTP_RES_TIMEOUT, "Request Timeout");
-    scode_add(EVHTP_RES_CONFLICT, "Conflict");
-    scode_add(EVHTP_RES_GONE, "Gone");
-    scode_add(EVHTP_RES_LENREQ, "Length Required");
-    scode_add(EVHTP_RES_PRECONDFAIL, "Precondition Failed");
-    scode_add(EVHTP_RES_ENTOOLARGE, "Entity Too Large");
-    scode_add(EVHTP_RES_URITOOLARGE, "Request-URI Too Long");
-    scode_add(EVHTP_RES_UNSUPPORTED, "Unsupported Media Type");
-    scode_add(EVHTP_RES_RANGENOTSC, "Requested Range Not Satisfiable");
-    scode_add(EVHTP_RES_EXPECTFAIL, "Expectation Failed");
-    scode_add(EVHTP_RES_IAMATEAPOT, "I'm a teapot");
+    scode_add(EVHTP_RES_400, "Bad Request"),
+    scode_add(EVHTP_RES_UNAUTH, "Unauthorized"),
+    scode_add(EVHTP_RES_PAYREQ, "Payment Required"),
+    scode_add(EVHTP_RES_FORBIDDEN, "Forbidden"),
+    scode_add(EVHTP_RES_NOTFOUND, "Not Found"),
+    scode_add(EVHTP_RES_METHNALLOWED, "Not Allowed"),
+    scode_add(EVHTP_RES_NACCEPTABLE, "Not Acceptable"),
+    scode_add(EVHTP_RES_PROXYAUTHREQ, "Proxy Authentication Required"),
+    scode_add(EVHTP_RES_TIMEOUT, "Request Timeout"),
+    scode_add(EVHTP_RES_CONFLICT, "Conflict"),
+    scode_add(EVHTP_RES_GONE, "Gone"),
+    scode_add(EVHTP_RES_LENREQ, "Length Required"),
+    scode_add(EVHTP_RES_PRECONDFAIL, "Precondition Failed"),
+    scode_add(EVHTP_RES_ENTOOLARGE, "Entity Too Large"),
+    scode_add(EVHTP_RES_URITOOLARGE, "Request-URI Too Long"),
+    scode_add(EVHTP_RES_UNSUPPORTED, "Unsupported Media Type"),
+    scode_add(EVHTP_RES_RANGENOTSC, "Requested Range Not Satisfiable"),
+    scode_add(EVHTP_RES_EXPECTFAIL, "Expectation Failed"),
+    scode_add(EVHTP_RES_IAMATEAPOT, "I'm a teapot"),
 
     /* 500 codes */
-    scode_add(EVHTP_RES_SERVERR, "Internal Server Error");
-    scode_add(EVHTP_RES_NOTIMPL, "Not Implemented");
-    scode_add(EVHTP_RES_BADGATEWAY, "Bad Gateway");
-    scode_add(EVHTP_RES_SERVUNAVAIL, "Service Unavailable");
-    scode_add(EVHTP_RES_GWTIMEOUT, "Gateway Timeout");
-    scode_add(EVHTP_RES_VERNSUPPORT, "HTTP Version Not Supported");
-    scode_add(EVHTP_RES_BWEXEED, "Bandwidth Limit Exceeded");
-
-    scode_tree_initialized = 1;
-}     /* status_code_init */
+    scode_add(EVHTP_RES_SERVERR, "Internal Server Error"),
+    scode_add(EVHTP_RES_NOTIMPL, "Not Implemented"),
+    scode_add(EVHTP_RES_BADGATEWAY, "Bad Gateway"),
+    scode_add(EVHTP_RES_SERVUNAVAIL, "Service Unavailable"),
+    scode_add(EVHTP_RES_GWTIMEOUT, "Gateway Timeout"),
+    scode_add(EVHTP_RES_VERNSUPPORT, "HTTP Version Not Supported"),
+    scode_add(EVHTP_RES_BWEXEED, "Bandwidth Limit Exceeded")
+};
 
 const char *
 status_code_to_str(evhtp_res code) {
-    struct status_code   c;
-    struct status_code * found;
-
-    c.code = code;
-
-    if (!(found = RB_FIND(status_code_tree, &status_code_head, &c))) {
+    if (code >= SCODE_MAX || status_codes[code].str == NULL) {
         return "DERP";
     }
 
-    return found->str;
+    return status_codes[code].str;
 }
 
 /**
@@ -396,6 +390,24 @@ _evhtp_header_hook(evhtp_request_t * request, evhtp_header_t * header) {
     return EVHTP_RES_OK;
 }
 
+/**
+ * @brief runs the user-defined on_trailer hook for a request
+ *
+ * once a full key: value trailer following a chunked body has been parsed,
+ * this will call the hook
+ *
+ * @param request the request structure
+ * @param header the trailer header structure
+ *
+ * @return EVHTP_RES_OK on success, otherwise something else.
+ */
+static inline evhtp_res
+_evhtp_trailer_hook(evhtp_request_t * request, evhtp_header_t * header) {
+    HOOK_REQUEST_RUN(request, on_trailer, header);
+
+    return EVHTP_RES_OK;
+}
+
 /**
  * @brief runs the user-defined on_Headers hook for a request after all headers
  *        have been parsed.
@@ -578,288 +590,2137 @@ _evhtp_glob_match(const char * pattern, const char * string) {
     return 0;
 } /* _evhtp_glob_match */
 
-static evhtp_callback_t *
-_evhtp_callback_find(evhtp_callbacks_t * cbs,
-                     const char        * path,
-                     unsigned int      * start_offset,
-                     unsigned int      * end_offset) {
-#ifndef EVHTP_DISABLE_REGEX
-    regmatch_t         pmatch[28];
-#endif
-    evhtp_callback_t * callback;
+/*
+ * Compiled globs.
+ *
+ * A glob is split on its '*'s into literal segments when it is set: the
+ * prefix, the literals in between and the suffix. A string then matches if
+ * it starts with the prefix and ends with the suffix (memcmp()), and the
+ * others can be found in order in what is left (memmem()). As '*' is the
+ * only wildcard the leftmost place of each will do, so this is linear and
+ * never backtracks.
+ */
+struct evhtp_glob_seg_s {
+    const char * s;
+    size_t       len;
+};
+
+struct evhtp_glob_s {
+    unsigned int            nsegs;    /**< with a '*' there are at least two, the prefix and suffix */
+    unsigned int            star;     /**< 0 if the glob is a plain literal */
+    size_t                  minlen;   /**< the length of all of the literals */
+    struct evhtp_glob_seg_s segs[];   /**< followed by a copy of the pattern */
+};
+
+static evhtp_glob_t *
+_evhtp_glob_new(const char * pattern) {
+    evhtp_glob_t * glob;
+    char         * p;
+    size_t         len;
+    size_t         seglen;
+    unsigned int   n;
+
+    len = strlen(pattern);
+
+    for (n = 1, p = (char *)pattern; (p = strchr(p, '*')); p++) {
+        n++;
+    }
 
-    if (cbs == NULL) {
+    if (!(glob = malloc(sizeof(evhtp_glob_t) + sizeof(struct evhtp_glob_seg_s) * n + len + 1))) {
         return NULL;
     }
 
-    TAILQ_FOREACH(callback, cbs, next) {
-        switch (callback->type) {
-            case evhtp_callback_type_hash:
-                if (strcmp(callback->val.path, path) == 0) {
-                    *start_offset = 0;
-                    *end_offset   = (unsigned int)strlen(path);
-                    return callback;
-                }
-                break;
-#ifndef EVHTP_DISABLE_REGEX
-            case evhtp_callback_type_regex:
-                if (regexec(callback->val.regex, path, callback->val.regex->re_nsub + 1, pmatch, 0) == 0) {
-                    *start_offset = pmatch[callback->val.regex->re_nsub].rm_so;
-                    *end_offset   = pmatch[callback->val.regex->re_nsub].rm_eo;
+    p = (char *)&glob->segs[n];
+    memcpy(p, pattern, len + 1);
 
-                    return callback;
-                }
+    glob->nsegs  = 0;
+    glob->star   = 0;
+    glob->minlen = 0;
 
-                break;
-#endif
-            case evhtp_callback_type_glob:
-                if (_evhtp_glob_match(callback->val.glob, path) == 1) {
-                    *start_offset = 0;
-                    *end_offset   = (unsigned int)strlen(path);
-                    return callback;
-                }
-            default:
-                break;
-        } /* switch */
+    for (;;) {
+        seglen = strcspn(p, "*");
+
+        /* runs of '*' leave empty literals in the middle, which are dropped */
+        if (glob->nsegs == 0 || seglen || p[seglen] == '\0') {
+            glob->segs[glob->nsegs].s   = p;
+            glob->segs[glob->nsegs].len = seglen;
+            glob->nsegs++;
+        }
+
+        glob->minlen += seglen;
+
+        if (p[seglen] == '\0') {
+            break;
+        }
+
+        glob->star = 1;
+        p         += seglen + 1;
     }
 
-    return NULL;
-}         /* _evhtp_callback_find */
+    return glob;
+} /* _evhtp_glob_new */
 
 /**
- * @brief Creates a new evhtp_request_t
- *
- * @param c
+ * @brief matches what follows the prefix of a glob, that is the middle
+ *        literals and the suffix
  *
- * @return evhtp_request_t structure on success, otherwise NULL
+ * @return 1 on match, 0 if not
  */
-static evhtp_request_t *
-_evhtp_request_new(evhtp_connection_t * c) {
-    evhtp_request_t * req;
+static int
+_evhtp_glob_match_tail(evhtp_glob_t * glob, const char * s, size_t len) {
+    struct evhtp_glob_seg_s * seg = &glob->segs[glob->nsegs - 1];
+    const char              * m;
+    unsigned int              i;
 
-    if (!(req = calloc(sizeof(evhtp_request_t), 1))) {
-        return NULL;
+    if (len < glob->minlen - glob->segs[0].len) {
+        return 0;
     }
 
-    req->conn        = c;
-    req->htp         = c ? c->htp : NULL;
-    req->status      = EVHTP_RES_OK;
-    req->buffer_in   = evbuffer_new();
-    req->buffer_out  = evbuffer_new();
-    req->headers_in  = malloc(sizeof(evhtp_headers_t));
-    req->headers_out = malloc(sizeof(evhtp_headers_t));
+    if (memcmp(s + len - seg->len, seg->s, seg->len)) {
+        return 0;
+    }
 
-    TAILQ_INIT(req->headers_in);
-    TAILQ_INIT(req->headers_out);
+    len -= seg->len;
 
-    return req;
+    for (i = 1; i < glob->nsegs - 1; i++) {
+        seg = &glob->segs[i];
+
+        if (!(m = memmem(s, len, seg->s, seg->len))) {
+            return 0;
+        }
+
+        len -= (size_t)(m - s) + seg->len;
+        s    = m + seg->len;
+    }
+
+    return 1;
 }
 
 /**
- * @brief frees all data in an evhtp_request_t along with calling finished hooks
+ * @brief matches a string against a compiled glob
  *
- * @param request the request structure
+ * @return 1 on match, 0 if not
+ */
+static int
+_evhtp_glob_matchn(evhtp_glob_t * glob, const char * s, size_t len) {
+    struct evhtp_glob_seg_s * prefix = &glob->segs[0];
+
+    if (!glob->star) {
+        return len == prefix->len && memcmp(s, prefix->s, len) == 0;
+    }
+
+    if (len < prefix->len || memcmp(s, prefix->s, prefix->len)) {
+        return 0;
+    }
+
+    return _evhtp_glob_match_tail(glob, s + prefix->len, len - prefix->len);
+}
+
+/**
+ * @brief a part of the callback index which was replaced while lookups may
+ *        have been reading it, see "Callback index" below.
+ */
+struct evhtp_retired_s {
+    void                   * ptr;
+    void                     (* release)(void *);
+    struct evhtp_retired_s * next;
+};
+
+/**
+ * @brief a list of pointers which grows while lookups read it, in place
+ *        while there is room (the item is stored before the count is).
+ */
+struct evhtp_vec_s {
+    unsigned int n;
+    unsigned int cap;
+    void       * items[];
+};
+
+/**
+ * @brief puts a part of the index which was replaced on the list of those
+ *        to be freed along with the callbacks. If that fails it is leaked,
+ *        a lookup may still be reading it.
  */
 static void
-_evhtp_request_free(evhtp_request_t * request) {
-    if (request == NULL) {
+_evhtp_retire(evhtp_callbacks_t * cbs, void * ptr, void (* release)(void *)) {
+    struct evhtp_retired_s * retired;
+
+    if (ptr == NULL || !(retired = malloc(sizeof(*retired)))) {
         return;
     }
 
-    _evhtp_request_fini_hook(request);
-    _evhtp_uri_free(request->uri);
+    retired->ptr     = ptr;
+    retired->release = release;
+    retired->next    = cbs->retired;
+    cbs->retired     = retired;
+}
 
-    evhtp_headers_free(request->headers_in);
-    evhtp_headers_free(request->headers_out);
+/**
+ * @brief appends an item to a vector, publishing a bigger copy of it in
+ *        place of vecp (and retiring the old one) if it is full.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int
+_evhtp_vec_push(evhtp_callbacks_t * cbs, struct evhtp_vec_s ** vecp, void * item) {
+    struct evhtp_vec_s * vec = *vecp;
+    struct evhtp_vec_s * grown;
+    unsigned int         cap;
+
+    if (vec != NULL && vec->n < vec->cap) {
+        vec->items[vec->n] = item;
+        _evhtp_store(&vec->n, vec->n + 1);
+        return 0;
+    }
 
+    cap = vec ? vec->cap * 2 : 4;
 
-    if (request->buffer_in) {
-        evbuffer_free(request->buffer_in);
+    if (!(grown = malloc(sizeof(*grown) + sizeof(void *) * cap))) {
+        return -1;
     }
 
-    if (request->buffer_out) {
-        evbuffer_free(request->buffer_out);
+    grown->n   = vec ? vec->n : 0;
+    grown->cap = cap;
+
+    if (grown->n) {
+        memcpy(grown->items, vec->items, sizeof(void *) * grown->n);
     }
 
-    free(request->hooks);
-    free(request);
+    grown->items[grown->n++] = item;
+
+    _evhtp_store(vecp, grown);
+    _evhtp_retire(cbs, vec, free);
+
+    return 0;
 }
 
+#ifndef EVHTP_DISABLE_REGEX
+/*
+ * Regex prefilters.
+ *
+ * Most paths fail most of the regular expressions set, and each regexec()
+ * is a full search. So when a regex callback is set, the literals which
+ * any match of it has to contain are pulled out of the pattern, in order,
+ * along with whether the first of them is anchored at the start of the
+ * path. That makes a glob ("prefix*lit*lit*" or "*lit*lit*") which every
+ * path the regex matches also matches, and a path which fails the glob is
+ * not handed to the regex engine at all.
+ *
+ * The patterns are in oniguruma's default (ruby) syntax. Only the top level
+ * of a pattern is looked at: groups, classes and '.' just end a literal, a
+ * quantified character is dropped unless the quantifier is '+', and
+ * anything which can not be told apart cheaply ('|', a '^' past the start,
+ * "(?" groups, which may set options, and escapes other than of a
+ * punctuation character) means the regex gets no prefilter. A request path
+ * can not hold a newline, so a leading '^' anchors it at the start.
+ */
+
 /**
- * @brief create an overlay URI structure
+ * @brief skips a bracketed character class, which may nest
  *
- * @return evhtp_uri_t
+ * @return what follows the class, NULL if it is not terminated
  */
-static evhtp_uri_t *
-_evhtp_uri_new(void) {
-    evhtp_uri_t * uri;
+static const char *
+_evhtp_regex_skip_class(const char * p) {
+    int depth = 0;
 
-    if (!(uri = calloc(sizeof(evhtp_uri_t), 1))) {
-        return NULL;
-    }
+    do {
+        if (*p == '\\') {
+            if (p[1] == '\0') {
+                return NULL;
+            }
 
-    return uri;
+            p += 2;
+            continue;
+        }
+
+        if (*p == '[') {
+            depth++;
+
+            if (*++p == '^') {
+                p++;
+            }
+
+            if (*p == ']') {
+                /* a ']' first in a class is taken literally */
+                p++;
+            }
+
+            continue;
+        }
+
+        if (*p == ']') {
+            depth--;
+        }
+
+        p++;
+    } while (depth && *p != '\0');
+
+    return depth ? NULL : p;
 }
 
 /**
- * @brief frees an overlay URI structure
+ * @brief skips a group, which must not start with "(?"
  *
- * @param uri evhtp_uri_t
+ * @return what follows the group, NULL if it is not terminated
  */
-static void
-_evhtp_uri_free(evhtp_uri_t * uri) {
-    if (uri == NULL) {
-        return;
-    }
+static const char *
+_evhtp_regex_skip_group(const char * p) {
+    int depth = 0;
+
+    do {
+        switch (*p) {
+            case '\\':
+                if (p[1] == '\0') {
+                    return NULL;
+                }
 
-    evhtp_query_free(uri->query);
-    _evhtp_path_free(uri->path);
+                p += 2;
+                continue;
+            case '[':
+                if (!(p = _evhtp_regex_skip_class(p))) {
+                    return NULL;
+                }
+                continue;
+            case '(':
+                if (p[1] == '?') {
+                    return NULL;
+                }
 
-    free(uri->fragment);
-    free(uri->query_raw);
-    free(uri);
+                depth++;
+                break;
+            case ')':
+                depth--;
+                break;
+        }
+
+        p++;
+    } while (depth && *p != '\0');
+
+    return depth ? NULL : p;
 }
 
 /**
- * @brief parses the path and file from an input buffer
- *
- * @details in order to properly create a structure that can match
- *          both a path and a file, this will parse a string into
- *          what it considers a path, and a file.
+ * @brief skips the quantifiers following an atom
  *
- * @details if for example the input was "/a/b/c", the parser will
- *          consider "/a/b/" as the path, and "c" as the file.
+ * @return what follows them, NULL on an unterminated interval
+ */
+static const char *
+_evhtp_regex_skip_quant(const char * p) {
+    for (;;) {
+        if (*p == '*' || *p == '+' || *p == '?') {
+            p++;
+        } else if (*p == '{') {
+            if (!(p = strchr(p, '}'))) {
+                return NULL;
+            }
+
+            p++;
+        } else {
+            return p;
+        }
+    }
+}
+
+/**
+ * @brief builds the prefilter glob of a regular expression
  *
- * @param data raw input data (assumes a /path/[file] structure)
- * @param len length of the input data
+ * @param pattern
  *
- * @return evhtp_request_t * on success, NULL on error.
+ * @return a glob, NULL if the pattern has no literals to go by (or on
+ *         error), in which case it is always tried
  */
-static evhtp_path_t *
-_evhtp_path_new(const char * data, size_t len) {
-    evhtp_path_t * req_path;
-    const char   * data_end = (const char *)(data + len);
-    char         * path     = NULL;
-    char         * file     = NULL;
-
-    if (!(req_path = calloc(sizeof(evhtp_path_t), 1))) {
+static evhtp_glob_t *
+_evhtp_regex_glob_new(const char * pattern) {
+    evhtp_glob_t * glob;
+    const char   * p = pattern;
+    const char   * q;
+    char         * out;
+    char         * o;
+    char           c;
+    int            literals = 0;
+
+    if (!(out = malloc(strlen(pattern) + 3))) {
         return NULL;
     }
 
-    if (len == 0) {
-        /*
-         * odd situation here, no preceding "/", so just assume the path is "/"
-         */
-        path = strdup("/");
-    } else if (*data != '/') {
-        /* request like GET stupid HTTP/1.0, treat stupid as the file, and
-         * assume the path is "/"
-         */
-        path = strdup("/");
-        file = strndup(data, len);
+    o = out;
+
+    if (*p == '^') {
+        p++;
     } else {
-        if (data[len - 1] != '/') {
-            /*
-             * the last character in data is assumed to be a file, not the end of path
-             * loop through the input data backwards until we find a "/"
-             */
-            size_t i;
-
-            for (i = (len - 1); i != 0; i--) {
-                if (data[i] == '/') {
-                    /*
-                     * we have found a "/" representing the start of the file,
-                     * and the end of the path
-                     */
-                    size_t path_len;
-                    size_t file_len;
-
-                    path_len = (size_t)(&data[i] - data) + 1;
-                    file_len = (size_t)(data_end - &data[i + 1]);
-
-                    /* check for overflow */
-                    if ((const char *)(data + path_len) > data_end) {
-                        fprintf(stderr, "PATH Corrupted.. (path_len > len)\n");
-                        free(req_path);
-                        return NULL;
-                    }
+        *o++ = '*';
+    }
+
+#define _evhtp_regex_break()                 \
+    do {                                     \
+        if (o == out || o[-1] != '*') {      \
+            *o++ = '*';                      \
+        }                                    \
+    } while (0)
+
+    while (p != NULL && *p != '\0') {
+        switch (*p) {
+            case '|':
+            case '^':
+            case ')':
+                p = NULL;
+                continue;
+            case '[':
+                _evhtp_regex_break();
+                p = _evhtp_regex_skip_class(p);
+                p = p ? _evhtp_regex_skip_quant(p) : NULL;
+                continue;
+            case '(':
+                _evhtp_regex_break();
+                p = _evhtp_regex_skip_group(p);
+                p = p ? _evhtp_regex_skip_quant(p) : NULL;
+                continue;
+            case '.':
+            case '$':
+            case '*':
+            case '+':
+            case '?':
+            case '{':
+                _evhtp_regex_break();
+                p = _evhtp_regex_skip_quant(p + 1);
+                continue;
+            case '\\':
+                if (p[1] == '\0' || isalnum((unsigned char)p[1]) || (p[1] & 0x80)) {
+                    p = NULL;
+                    continue;
+                }
 
-                    /* check for overflow */
-                    if ((const char *)(&data[i + 1] + file_len) > data_end) {
-                        fprintf(stderr, "FILE Corrupted.. (file_len > len)\n");
-                        free(req_path);
-                        return NULL;
-                    }
+                c  = p[1];
+                p += 2;
+                break;
+            default:
+                if (*p & 0x80) {
+                    /* a quantifier would apply to the whole of a multibyte
+                     * character, not just its last byte */
+                    _evhtp_regex_break();
+                    p = _evhtp_regex_skip_quant(p + 1);
+                    continue;
+                }
 
-                    path = strndup(data, path_len);
-                    file = strndup(&data[i + 1], file_len);
+                c  = *p++;
+                break;
+        } /* switch */
 
-                    break;
-                }
-            }
+        if ((q = _evhtp_regex_skip_quant(p)) == NULL) {
+            p = NULL;
+            continue;
+        }
 
-            if (i == 0 && data[i] == '/' && !file && !path) {
-                /* drops here if the request is something like GET /foo */
-                path = strdup("/");
+        if (q != p && !(*p == '+' && (q - p == 1 || (q - p == 2 && (p[1] == '?' || p[1] == '+'))))) {
+            /* the character may not be there at all, note that "a+*" is
+             * (a+)* */
+            _evhtp_regex_break();
+            p = q;
+            continue;
+        }
 
-                if (len > 1) {
-                    file = strndup((const char *)(data + 1), len);
-                }
-            }
+        if (c == '*') {
+            /* can't be told apart from a wildcard in a glob */
+            _evhtp_regex_break();
         } else {
-            /* the last character is a "/", thus the request is just a path */
-            path = strndup(data, len);
+            *o++ = c;
+            literals++;
         }
-    }
 
-    if (len != 0) {
-        req_path->full = strndup(data, len);
+        if (q != p) {
+            /* the character is there at least once, but what follows it
+             * is not right after it */
+            _evhtp_regex_break();
+            p = q;
+        }
     }
 
-    req_path->path = path;
-    req_path->file = file;
+    _evhtp_regex_break();
 
-    return req_path;
-}     /* _evhtp_path_new */
+#undef _evhtp_regex_break
 
-static void
-_evhtp_path_free(evhtp_path_t * path) {
-    if (path == NULL) {
-        return;
+    *o   = '\0';
+    glob = NULL;
+
+    if (p != NULL && literals) {
+        glob = _evhtp_glob_new(out);
     }
 
-    free(path->full);
+    free(out);
 
-    free(path->path);
-    free(path->file);
-    free(path->match_start);
-    free(path->match_end);
+    return glob;
+} /* _evhtp_regex_glob_new */
 
-    free(path);
-}
+/*
+ * Regex sets.
+ *
+ * Runs of regex callbacks which follow each other in the fallback list are
+ * compiled into one more regex, "(p1)|(p2)|...", so that a path is searched
+ * once for the whole run rather than once for each of them. This is only
+ * done for patterns anchored at the start of the path, which can only
+ * match there: the alternatives are then tried in order at the one place,
+ * and the first one to match is the first of the run which matches on its
+ * own, at the same place and with the same groups. The group of each
+ * alternative tells which one it was.
+ *
+ * Members with a prefilter are still tried on their own, as the prefilter
+ * rules most of them out without going to the regex engine at all. From
+ * the first member without one on, the rest of the run is searched for at
+ * once.
+ *
+ * A set is extended as callbacks are added by compiling a copy of it which
+ * then takes its place, so that lookups can go on from any number of
+ * threads without holding a lock.
+ */
+#define EVHTP_REGEX_SET_MAX  32        /* members of a set */
+#define EVHTP_REGEX_SET_SUBS 64        /* groups of a set */
+
+struct evhtp_regex_set_s {
+    char       * pattern;              /**< "(p1)|(p2)|..." */
+    regex_t    * regex;                /**< pattern compiled, once there are two members */
+    unsigned int first;                /**< the fallback index of the first member */
+    unsigned int n;                    /**< the number of members */
+    unsigned int nsub;                 /**< the number of groups of pattern */
+    unsigned int base[EVHTP_REGEX_SET_MAX]; /**< the group around each member */
+};
 
+/**
+ * @brief checks whether a pattern can go into a set: it has to start with
+ *        '^' and have no '|' outside of a group (so all of it is anchored),
+ *        and no "(?" groups or back references, which could change how the
+ *        groups of the other members are numbered or referred to.
+ *
+ * @return 1 if so, 0 if not
+ */
 static int
-_evhtp_request_parser_start(htparser * p) {
-    evhtp_connection_t * c = htparser_get_userdata(p);
+_evhtp_regex_combinable(const char * pattern) {
+    const char * p     = pattern;
+    int          depth = 0;
 
-    if (c->type == evhtp_type_client) {
+    if (*p++ != '^') {
         return 0;
     }
 
-    if (c->paused == 1) {
-        return -1;
-    }
+    while (*p != '\0') {
+        switch (*p) {
+            case '\\':
+                if (p[1] == '\0' || isdigit((unsigned char)p[1]) || p[1] == 'k' || p[1] == 'g') {
+                    return 0;
+                }
+
+                p += 2;
+                continue;
+            case '[':
+                if (!(p = _evhtp_regex_skip_class(p))) {
+                    return 0;
+                }
+                continue;
+            case '(':
+                if (p[1] == '?') {
+                    return 0;
+                }
+
+                depth++;
+                break;
+            case ')':
+                if (--depth < 0) {
+                    return 0;
+                }
+                break;
+            case '|':
+                if (depth == 0) {
+                    return 0;
+                }
+                break;
+        } /* switch */
+
+        p++;
+    }
+
+    return depth == 0;
+} /* _evhtp_regex_combinable */
+
+static void
+_evhtp_regex_set_free(void * arg) {
+    struct evhtp_regex_set_s * set = arg;
+
+    if (set->regex != NULL) {
+        regfree(set->regex);
+        free(set->regex);
+    }
+
+    free(set->pattern);
+    free(set);
+}
+
+/**
+ * @brief adds a regex callback which was just put at index of the fallback
+ *        list to the set before it, or starts a new set with it. Nothing is
+ *        done if it can not be combined, it is then simply tried on its own.
+ *
+ *        As lookups may be searching the set before it, that one is not
+ *        changed: a copy of it with the callback added is published in its
+ *        place, and it is retired.
+ */
+static void
+_evhtp_regex_sets_add(evhtp_callbacks_t * cbs, evhtp_callback_t * callback, unsigned int index) {
+    struct evhtp_vec_s       * sets = cbs->regex_sets;
+    struct evhtp_regex_set_s * last = NULL;
+    struct evhtp_regex_set_s * set;
+    unsigned int               nsub;
+    size_t                     len;
+
+    if (callback->pattern == NULL) {
+        return;
+    }
+
+    nsub = (unsigned int)callback->val.regex->re_nsub;
+    len  = strlen(callback->pattern);
+
+    if (sets != NULL && sets->n) {
+        last = sets->items[sets->n - 1];
+
+        if (last->first + last->n != index || last->n == EVHTP_REGEX_SET_MAX ||
+            last->nsub + 1 + nsub > EVHTP_REGEX_SET_SUBS) {
+            last = NULL;
+        }
+    }
+
+    if (last == NULL) {
+        if (1 + nsub > EVHTP_REGEX_SET_SUBS || !(set = malloc(sizeof(*set)))) {
+            return;
+        }
+
+        if (!(set->pattern = malloc(len + 3))) {
+            free(set);
+            return;
+        }
+
+        sprintf(set->pattern, "(%s)", callback->pattern);
+
+        set->regex   = NULL;
+        set->first   = index;
+        set->n       = 1;
+        set->nsub    = 1 + nsub;
+        set->base[0] = 1;
+
+        if (_evhtp_vec_push(cbs, &cbs->regex_sets, set) == -1) {
+            _evhtp_regex_set_free(set);
+        }
+
+        return;
+    }
+
+    if (!(set = malloc(sizeof(*set)))) {
+        return;
+    }
+
+    *set = *last;
+
+    if (!(set->pattern = malloc(strlen(last->pattern) + len + 4))) {
+        free(set);
+        return;
+    }
+
+    sprintf(set->pattern, "%s|(%s)", last->pattern, callback->pattern);
+
+    if (!(set->regex = malloc(sizeof(regex_t))) ||
+        regcomp(set->regex, set->pattern, REG_EXTENDED) != 0) {
+        free(set->regex);
+        free(set->pattern);
+        free(set);
+        return;
+    }
+
+    if (set->regex->re_nsub != last->nsub + 1 + nsub) {
+        /* the groups are not numbered the way they were expected to be */
+        _evhtp_regex_set_free(set);
+        return;
+    }
+
+    set->base[set->n++] = set->nsub + 1;
+    set->nsub          += 1 + nsub;
+
+    _evhtp_store(&sets->items[sets->n - 1], set);
+    _evhtp_retire(cbs, last, _evhtp_regex_set_free);
+} /* _evhtp_regex_sets_add */
+
+/**
+ * @brief searches a path for all of the members of a set at once
+ *
+ * @return the first member which matches, NULL if none do
+ */
+static evhtp_callback_t *
+_evhtp_regex_set_match(struct evhtp_vec_s * fallback, struct evhtp_regex_set_s * set,
+                       const char * path, size_t len,
+                       unsigned int * start_offset, unsigned int * end_offset) {
+    regmatch_t         pmatch[EVHTP_REGEX_SET_SUBS + 1];
+    evhtp_callback_t * callback;
+    unsigned int       i;
+    unsigned int       sub;
+
+    for (i = 0; i < set->n; i++) {
+        callback = fallback->items[set->first + i];
+
+        if (callback->glob != NULL && !_evhtp_glob_matchn(callback->glob, path, len)) {
+            continue;
+        }
+
+        if (callback->glob == NULL && i + 1 < set->n) {
+            break;
+        }
+
+        sub = (unsigned int)callback->val.regex->re_nsub;
+
+        if (regexec(callback->val.regex, path, sub + 1, pmatch, 0) == 0) {
+            *start_offset = pmatch[sub].rm_so;
+            *end_offset   = pmatch[sub].rm_eo;
+
+            return callback;
+        }
+    }
+
+    if (i == set->n) {
+        return NULL;
+    }
+
+    /* the members before i are known not to match, so the first match of
+     * the set is the first of the members from i on */
+    if (regexec(set->regex, path, set->nsub + 1, pmatch, 0) != 0) {
+        return NULL;
+    }
+
+    for (; i < set->n; i++) {
+        if (pmatch[set->base[i]].rm_so == -1) {
+            continue;
+        }
+
+        callback = fallback->items[set->first + i];
+        sub      = set->base[i] + (unsigned int)callback->val.regex->re_nsub;
+
+        *start_offset = pmatch[sub].rm_so;
+        *end_offset   = pmatch[sub].rm_eo;
+
+        return callback;
+    }
+
+    return NULL;
+}
+#endif
+
+/*
+ * Callback index.
+ *
+ * Exact paths are kept in an open addressing hash table. Globs and routes
+ * are kept in a radix tree whose edges are runs of literal bytes, with a
+ * node for a ":param" (one non-empty path segment) and one for a trailing
+ * "*" (the rest of the path) hanging off any node. Other globs hang off the
+ * node their literal prefix ends at, so that globs sharing a prefix only
+ * have it compared once, and only the rest of each is matched there.
+ * Regular expressions are kept in a fallback list.
+ *
+ * The first callback set which matches a path wins, whatever its type, so
+ * every callback is numbered (seq) in the order it was added. Each node
+ * keeps the lowest seq found below it, which lets a search of the tree skip
+ * any branch which can not do better than what was already found. The
+ * fallback list is then only tried up to the seq of the tree's match.
+ *
+ * An exact path can only be beaten by a callback added before it, so that
+ * is settled when it is added: it only goes into the hash table if nothing
+ * before it matches the path, and is then the answer for that path.
+ *
+ * Callbacks may be added while lookups are being done from other threads
+ * without a lock (there is none unless evhtp_use_callback_locks() was
+ * called), so nothing a lookup can reach is changed in a way it could see
+ * half done: a part is filled in before the pointer (or count) which makes
+ * it reachable is stored, and a part which has to change otherwise is
+ * copied, the copy published in its place, and the old one retired.
+ * Retired parts are only freed along with the callbacks, as there is no
+ * telling when the last lookup which could have been reading them is done.
+ */
+struct evhtp_callback_ent_s {
+    unsigned int       hash;
+    unsigned int       len;
+    evhtp_callback_t * callback;
+};
+
+/**
+ * @brief the hash table of exact paths, see _evhtp_exact_add()
+ */
+struct evhtp_exact_s {
+    unsigned int                mask;   /**< the size of the table less one */
+    unsigned int                n;
+    struct evhtp_callback_ent_s ents[];
+};
+
+/**
+ * @brief the children of a node, which are never changed once published:
+ *        adding or replacing one publishes a new copy.
+ */
+struct evhtp_route_edges_s {
+    unsigned int                n;
+    unsigned char             * firsts;     /**< the first byte of the label of each child */
+    struct evhtp_route_node_s * children[]; /**< followed by the firsts */
+};
+
+struct evhtp_route_node_s {
+    char                       * label;     /**< the literal bytes of the edge leading here, never changed */
+    size_t                       label_len;
+    evhtp_callback_t           * callback;  /**< the first callback which ends here */
+    unsigned int                 min_seq;   /**< the lowest seq of any callback from here on */
+    struct evhtp_route_edges_s * edges;
+    struct evhtp_route_node_s  * param;
+    struct evhtp_route_node_s  * catchall;
+    struct evhtp_vec_s         * globs;     /**< globs whose literal prefix ends here, in seq order */
+};
+
+struct evhtp_route_s {
+    unsigned int nparams;
+    struct {
+        const char * name;
+        size_t       len;
+    } names[EVHTP_PATH_MAX_PARAMS];
+};
+
+struct evhtp_route_span {
+    const char * val;
+    size_t       len;
+};
+
+struct evhtp_route_match {
+    evhtp_callback_t      * callback;
+    unsigned int            seq;
+    unsigned int            nspans;
+    struct evhtp_route_span spans[EVHTP_PATH_MAX_PARAMS];
+};
+
+/**
+ * @brief parses the parameter names out of a route, see evhtp_set_route_cb()
+ *
+ * @param pattern
+ *
+ * @return the parameters of the route, NULL on error or if the route is
+ *         not valid.
+ */
+static evhtp_route_t *
+_evhtp_route_new(const char * pattern) {
+    evhtp_route_t * route;
+    const char    * p;
+    size_t          len;
+
+    if (!(route = calloc(sizeof(evhtp_route_t), 1))) {
+        return NULL;
+    }
+
+    for (p = pattern; *p != '\0'; p++) {
+        if (*p != ':' && *p != '*') {
+            continue;
+        }
+
+        if (route->nparams == EVHTP_PATH_MAX_PARAMS) {
+            free(route);
+            return NULL;
+        }
+
+        /* a ':' name runs up to the next '/', a '*' one to the end */
+        len = *p == ':' ? strcspn(p + 1, "/") : strlen(p + 1);
+
+        if ((*p == ':' && len == 0) || (*p == '*' && memchr(p + 1, '/', len))) {
+            /* an empty name, or a '*' which is not the last segment */
+            free(route);
+            return NULL;
+        }
+
+        route->names[route->nparams].name = p + 1;
+        route->names[route->nparams].len  = len;
+        route->nparams++;
+
+        p += len;
+    }
+
+    return route;
+}
+
+static struct evhtp_route_node_s *
+_evhtp_route_node_new(const char * label, size_t len, unsigned int seq) {
+    struct evhtp_route_node_s * node;
+
+    if (!(node = calloc(sizeof(struct evhtp_route_node_s), 1))) {
+        return NULL;
+    }
+
+    if (len && !(node->label = malloc(len))) {
+        free(node);
+        return NULL;
+    }
+
+    if (len) {
+        memcpy(node->label, label, len);
+    }
+
+    node->label_len = len;
+    node->min_seq   = seq;
+
+    return node;
+}
+
+static void
+_evhtp_route_node_free(struct evhtp_route_node_s * node) {
+    unsigned int i;
+
+    if (node == NULL) {
+        return;
+    }
+
+    for (i = 0; node->edges && i < node->edges->n; i++) {
+        _evhtp_route_node_free(node->edges->children[i]);
+    }
+
+    _evhtp_route_node_free(node->param);
+    _evhtp_route_node_free(node->catchall);
+
+    free(node->globs);
+    free(node->edges);
+    free(node->label);
+    free(node);
+}
+
+/**
+ * @brief frees a node which was replaced by a copy of it, leaving what
+ *        hangs off of it to the copy.
+ */
+static void
+_evhtp_route_node_retired_free(void * arg) {
+    struct evhtp_route_node_s * node = arg;
+
+    free(node->label);
+    free(node);
+}
+
+/**
+ * @brief makes a copy of the edges of a node with room for n of them, the
+ *        ones copied keep their place.
+ */
+static struct evhtp_route_edges_s *
+_evhtp_route_edges_new(struct evhtp_route_edges_s * old, unsigned int n) {
+    struct evhtp_route_edges_s * edges;
+
+    if (!(edges = malloc(sizeof(*edges) + (sizeof(edges->children[0]) + 1) * n))) {
+        return NULL;
+    }
+
+    edges->n      = n;
+    edges->firsts = (unsigned char *)&edges->children[n];
+
+    if (old != NULL) {
+        memcpy(edges->children, old->children, sizeof(edges->children[0]) * old->n);
+        memcpy(edges->firsts, old->firsts, old->n);
+    }
+
+    return edges;
+}
+
+static int
+_evhtp_route_node_add_child(evhtp_callbacks_t * cbs, struct evhtp_route_node_s * node,
+                            struct evhtp_route_node_s * child) {
+    struct evhtp_route_edges_s * old = node->edges;
+    struct evhtp_route_edges_s * edges;
+    unsigned int                 n   = old ? old->n : 0;
+
+    if (!(edges = _evhtp_route_edges_new(old, n + 1))) {
+        return -1;
+    }
+
+    edges->children[n] = child;
+    edges->firsts[n]   = (unsigned char)child->label[0];
+
+    _evhtp_store(&node->edges, edges);
+    _evhtp_retire(cbs, old, free);
+
+    return 0;
+}
+
+static inline struct evhtp_route_node_s *
+_evhtp_route_node_child(struct evhtp_route_node_s * node, unsigned char c) {
+    struct evhtp_route_edges_s * edges = _evhtp_load(&node->edges);
+    unsigned char              * first;
+
+    if (edges == NULL || !(first = memchr(edges->firsts, c, edges->n))) {
+        return NULL;
+    }
+
+    return edges->children[first - edges->firsts];
+}
+
+/**
+ * @brief splits the edge to the index'th child of node after its first
+ *        common bytes. As lookups may be walking it, the child is not
+ *        changed but replaced by a node for the common bytes (mid), which
+ *        leads to a copy of the child for the rest of them.
+ *
+ * @return mid, NULL on error
+ */
+static struct evhtp_route_node_s *
+_evhtp_route_split(evhtp_callbacks_t * cbs, struct evhtp_route_node_s * node,
+                   unsigned int index, size_t common) {
+    struct evhtp_route_edges_s * old   = node->edges;
+    struct evhtp_route_node_s  * child = old->children[index];
+    struct evhtp_route_edges_s * edges;
+    struct evhtp_route_node_s  * mid;
+    struct evhtp_route_node_s  * rest;
+
+    if (!(rest = _evhtp_route_node_new(child->label + common, child->label_len - common, child->min_seq))) {
+        return NULL;
+    }
+
+    rest->callback = child->callback;
+    rest->edges    = child->edges;
+    rest->param    = child->param;
+    rest->catchall = child->catchall;
+    rest->globs    = child->globs;
+
+    if (!(mid = _evhtp_route_node_new(child->label, common, child->min_seq))) {
+        _evhtp_route_node_retired_free(rest);
+        return NULL;
+    }
+
+    if (!(mid->edges = _evhtp_route_edges_new(NULL, 1)) ||
+        !(edges = _evhtp_route_edges_new(old, old->n))) {
+        free(mid->edges);
+        _evhtp_route_node_retired_free(mid);
+        _evhtp_route_node_retired_free(rest);
+        return NULL;
+    }
+
+    mid->edges->children[0] = rest;
+    mid->edges->firsts[0]   = (unsigned char)rest->label[0];
+
+    /* mid takes the place of child, under the same first byte */
+    edges->children[index]  = mid;
+
+    _evhtp_store(&node->edges, edges);
+    _evhtp_retire(cbs, old, free);
+    _evhtp_retire(cbs, child, _evhtp_route_node_retired_free);
+
+    return mid;
+}
+
+/**
+ * @brief walks (and extends) the tree along the literal bytes s, splitting
+ *        an edge where s leaves it.
+ *
+ * @return the node s ends at, NULL on error
+ */
+static struct evhtp_route_node_s *
+_evhtp_route_insert_literal(evhtp_callbacks_t * cbs, struct evhtp_route_node_s * node,
+                            const char * s, size_t len, unsigned int seq) {
+    struct evhtp_route_node_s * child;
+    size_t                      common;
+
+    while (len) {
+        unsigned char * first = NULL;
+
+        if (node->edges) {
+            first = memchr(node->edges->firsts, (unsigned char)*s, node->edges->n);
+        }
+
+        if (first == NULL) {
+            if (!(child = _evhtp_route_node_new(s, len, seq))) {
+                return NULL;
+            }
+
+            if (_evhtp_route_node_add_child(cbs, node, child) == -1) {
+                _evhtp_route_node_free(child);
+                return NULL;
+            }
+
+            return child;
+        }
+
+        child = node->edges->children[first - node->edges->firsts];
+
+        for (common = 1; common < child->label_len && common < len; common++) {
+            if (child->label[common] != s[common]) {
+                break;
+            }
+        }
+
+        if (common < child->label_len &&
+            !(child = _evhtp_route_split(cbs, node, (unsigned int)(first - node->edges->firsts), common))) {
+            return NULL;
+        }
+
+        if (seq < child->min_seq) {
+            _evhtp_store(&child->min_seq, seq);
+        }
+
+        node = child;
+        s   += common;
+        len -= common;
+    }
+
+    return node;
+} /* _evhtp_route_insert_literal */
+
+static struct evhtp_route_node_s *
+_evhtp_route_insert_wild(struct evhtp_route_node_s ** slot, unsigned int seq) {
+    struct evhtp_route_node_s * node = *slot;
+
+    if (node == NULL) {
+        if ((node = _evhtp_route_node_new(NULL, 0, seq))) {
+            _evhtp_store(slot, node);
+        }
+    } else if (seq < node->min_seq) {
+        _evhtp_store(&node->min_seq, seq);
+    }
+
+    return node;
+}
+
+static inline unsigned int
+_evhtp_exact_slot(struct evhtp_exact_s * exact, unsigned int hash) {
+    /* the hash of a path is weak in its low bits, mix them in */
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+
+    return hash & exact->mask;
+}
+
+/**
+ * @brief puts an entry into a free slot of the table, storing the callback
+ *        last as that is what a lookup probing the slot goes by.
+ */
+static void
+_evhtp_exact_put(struct evhtp_exact_s * exact, struct evhtp_callback_ent_s * ent) {
+    unsigned int i = _evhtp_exact_slot(exact, ent->hash);
+
+    while (exact->ents[i].callback != NULL) {
+        i = (i + 1) & exact->mask;
+    }
+
+    exact->ents[i].hash = ent->hash;
+    exact->ents[i].len  = ent->len;
+    _evhtp_store(&exact->ents[i].callback, ent->callback);
+
+    exact->n++;
+}
+
+/**
+ * @brief adds an exact path callback to the hash table, which is kept at
+ *        most half full. When it grows, the bigger table is filled in
+ *        before it replaces the old one, which is retired.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int
+_evhtp_exact_add(evhtp_callbacks_t * cbs, evhtp_callback_t * callback) {
+    struct evhtp_exact_s      * exact = cbs->exact;
+    struct evhtp_callback_ent_s ent;
+
+    ent.hash     = callback->hash;
+    ent.len      = (unsigned int)strlen(callback->val.path);
+    ent.callback = callback;
+
+    if (exact == NULL || (exact->n + 1) * 2 > exact->mask + 1) {
+        struct evhtp_exact_s * old  = exact;
+        unsigned int           size = old ? (old->mask + 1) * 2 : 16;
+        unsigned int           i;
+
+        if (!(exact = calloc(sizeof(*exact) + sizeof(exact->ents[0]) * size, 1))) {
+            return -1;
+        }
+
+        exact->mask = size - 1;
+
+        for (i = 0; old != NULL && i <= old->mask; i++) {
+            if (old->ents[i].callback != NULL) {
+                _evhtp_exact_put(exact, &old->ents[i]);
+            }
+        }
+
+        _evhtp_exact_put(exact, &ent);
+
+        _evhtp_store(&cbs->exact, exact);
+        _evhtp_retire(cbs, old, free);
+
+        return 0;
+    }
+
+    _evhtp_exact_put(exact, &ent);
+
+    return 0;
+}
+
+static inline evhtp_callback_t *
+_evhtp_exact_find(struct evhtp_exact_s * exact, const char * path, size_t len) {
+    evhtp_callback_t * callback;
+    unsigned int       hash = _evhtp_quick_hash(path);
+    unsigned int       i    = _evhtp_exact_slot(exact, hash);
+
+    for (; (callback = _evhtp_load(&exact->ents[i].callback)) != NULL; i = (i + 1) & exact->mask) {
+        struct evhtp_callback_ent_s * ent = &exact->ents[i];
+
+        if (ent->hash == hash && ent->len == len && memcmp(callback->val.path, path, len) == 0) {
+            return callback;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief checks whether a callback goes into the tree, which is the case for
+ *        routes and globs.
+ *
+ * @param callback
+ *
+ * @return 1 if so, 0 if it goes into the fallback list
+ */
+static int
+_evhtp_callback_is_routed(evhtp_callback_t * callback) {
+    switch (callback->type) {
+        case evhtp_callback_type_route:
+            return 1;
+        case evhtp_callback_type_glob:
+            return callback->glob != NULL;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief adds a prefix glob or route callback to the tree
+ *
+ * @param cbs
+ * @param callback
+ *
+ * @return 0 on success, -1 on error
+ */
+static int
+_evhtp_routes_add(evhtp_callbacks_t * cbs, evhtp_callback_t * callback) {
+    struct evhtp_route_node_s * node;
+    const char                * p;
+    size_t                      len;
+
+    if (!(node = _evhtp_route_insert_wild(&cbs->routes, callback->seq))) {
+        return -1;
+    }
+
+    switch (callback->type) {
+        case evhtp_callback_type_glob:
+            p    = callback->val.glob;
+            len  = strcspn(p, "*");
+            node = _evhtp_route_insert_literal(cbs, node, p, len, callback->seq);
+
+            if (node == NULL || p[len] != '*') {
+                break;
+            }
+
+            if (p[strspn(p + len, "*") + len] == '\0') {
+                /* a prefix */
+                node = _evhtp_route_insert_wild(&node->catchall, callback->seq);
+                break;
+            }
+
+            return _evhtp_vec_push(cbs, &node->globs, callback);
+        case evhtp_callback_type_route:
+            p = callback->val.path;
+
+            while (node != NULL && *p != '\0') {
+                if (*p == ':') {
+                    node = _evhtp_route_insert_wild(&node->param, callback->seq);
+                    p   += 1 + strcspn(p + 1, "/");
+                } else if (*p == '*') {
+                    node = _evhtp_route_insert_wild(&node->catchall, callback->seq);
+                    break;
+                } else {
+                    len  = strcspn(p, ":*");
+                    node = _evhtp_route_insert_literal(cbs, node, p, len, callback->seq);
+                    p   += len;
+                }
+            }
+            break;
+        default:
+            return -1;
+    } /* switch */
+
+    if (node == NULL) {
+        return -1;
+    }
+
+    if (node->callback == NULL) {
+        /* otherwise the path is already taken by an earlier callback */
+        _evhtp_store(&node->callback, callback);
+    }
+
+    return 0;
+} /* _evhtp_routes_add */
+
+static inline void
+_evhtp_route_matched(struct evhtp_route_match * match, evhtp_callback_t * callback,
+                     struct evhtp_route_span * spans, unsigned int nspans) {
+    match->callback = callback;
+    match->seq      = callback->seq;
+    match->nspans   = nspans;
+
+    if (nspans) {
+        memcpy(match->spans, spans, sizeof(*spans) * nspans);
+    }
+}
+
+/**
+ * @brief finds the callback with the lowest seq in the tree which matches
+ *        the rest of a path (s). The parts of the path matched by ':' and
+ *        '*' nodes are collected in spans along the way.
+ */
+static void
+_evhtp_route_search(struct evhtp_route_node_s * node, const char * s, size_t len,
+                    struct evhtp_route_span * spans, unsigned int nspans,
+                    struct evhtp_route_match * match) {
+    struct evhtp_route_node_s * child;
+    struct evhtp_vec_s        * globs;
+    evhtp_callback_t          * callback;
+    unsigned int                i;
+    unsigned int                n;
+
+    if (_evhtp_load(&node->min_seq) >= match->seq) {
+        /* nothing from here on can beat the current match */
+        return;
+    }
+
+    if (len == 0 && (callback = _evhtp_load(&node->callback)) != NULL && callback->seq < match->seq) {
+        _evhtp_route_matched(match, callback, spans, nspans);
+    }
+
+    globs = _evhtp_load(&node->globs);
+    n     = globs ? _evhtp_load(&globs->n) : 0;
+
+    for (i = 0; i < n && (callback = globs->items[i])->seq < match->seq; i++) {
+        if (_evhtp_glob_match_tail(callback->glob, s, len)) {
+            _evhtp_route_matched(match, callback, spans, 0);
+            break;
+        }
+    }
+
+    if (len && (child = _evhtp_route_node_child(node, (unsigned char)*s))) {
+        if (child->label_len <= len && memcmp(child->label, s, child->label_len) == 0) {
+            _evhtp_route_search(child, s + child->label_len, len - child->label_len,
+                                spans, nspans, match);
+        }
+    }
+
+    if (nspans == EVHTP_PATH_MAX_PARAMS) {
+        return;
+    }
+
+    if ((child = _evhtp_load(&node->param)) != NULL && len && *s != '/') {
+        const char * end = memchr(s, '/', len);
+        size_t       n   = end ? (size_t)(end - s) : len;
+
+        spans[nspans].val = s;
+        spans[nspans].len = n;
+
+        _evhtp_route_search(child, s + n, len - n, spans, nspans + 1, match);
+    }
+
+    if ((child = _evhtp_load(&node->catchall)) != NULL &&
+        (callback = _evhtp_load(&child->callback)) != NULL && callback->seq < match->seq) {
+        spans[nspans].val = s;
+        spans[nspans].len = len;
+
+        _evhtp_route_matched(match, callback, spans, nspans + 1);
+    }
+} /* _evhtp_route_search */
+
+/**
+ * @brief matches a route against a whole path without the tree, for the
+ *        route callbacks which were inserted into the tailq directly.
+ *
+ * @return 1 if it matched, 0 if not
+ */
+static int
+_evhtp_route_match_path(evhtp_callback_t * callback, const char * path,
+                        evhtp_path_param_t * params, unsigned int * nparams) {
+    const char  * p = callback->val.path;
+    const char  * s = path;
+    unsigned int  n = 0;
+    size_t        len;
+
+    while (*p != '\0') {
+        if (*p == ':' || *p == '*') {
+            len = *p == ':' ? strcspn(s, "/") : strlen(s);
+
+            if (*p == ':' && len == 0) {
+                return 0;
+            }
+
+            params[n].name     = callback->route->names[n].name;
+            params[n].name_len = callback->route->names[n].len;
+            params[n].val      = s;
+            params[n].val_len  = len;
+            n++;
+
+            if (*p == '*') {
+                break;
+            }
+
+            p += 1 + callback->route->names[n - 1].len;
+            s += len;
+        } else if (*p++ != *s++) {
+            return 0;
+        }
+    }
+
+    if (*p != '*' && *s != '\0') {
+        return 0;
+    }
+
+    *nparams = n;
+
+    return 1;
+}
+
+/**
+ * @brief tries a single regex or glob callback (or exact path, for those
+ *        which are not indexed) against a path.
+ *
+ * @return 1 if it matched, 0 if not
+ */
+static int
+_evhtp_callback_match(evhtp_callback_t * callback, const char * path, size_t len,
+                      unsigned int * start_offset, unsigned int * end_offset) {
+#ifndef EVHTP_DISABLE_REGEX
+    regmatch_t pmatch[28];
+#endif
+
+    switch (callback->type) {
+        case evhtp_callback_type_hash:
+            if (strcmp(callback->val.path, path) == 0) {
+                *start_offset = 0;
+                *end_offset   = (unsigned int)len;
+                return 1;
+            }
+            break;
+#ifndef EVHTP_DISABLE_REGEX
+        case evhtp_callback_type_regex:
+            if (callback->glob && !_evhtp_glob_matchn(callback->glob, path, len)) {
+                break;
+            }
+
+            if (regexec(callback->val.regex, path, callback->val.regex->re_nsub + 1, pmatch, 0) == 0) {
+                *start_offset = pmatch[callback->val.regex->re_nsub].rm_so;
+                *end_offset   = pmatch[callback->val.regex->re_nsub].rm_eo;
+                return 1;
+            }
+            break;
+#endif
+        case evhtp_callback_type_glob:
+            if (callback->glob ? _evhtp_glob_matchn(callback->glob, path, len) :
+                _evhtp_glob_match(callback->val.glob, path) == 1) {
+                *start_offset = 0;
+                *end_offset   = (unsigned int)len;
+                return 1;
+            }
+            break;
+        default:
+            /* routes are matched by the tree or _evhtp_route_match_path() */
+            break;
+    } /* switch */
+
+    return 0;
+}
+
+static evhtp_callback_t *
+_evhtp_callback_find(evhtp_callbacks_t  * cbs,
+                     const char         * path,
+                     unsigned int       * start_offset,
+                     unsigned int       * end_offset,
+                     evhtp_path_param_t * params,
+                     unsigned int       * nparams) {
+    struct evhtp_route_match    match;
+    struct evhtp_route_span     spans[EVHTP_PATH_MAX_PARAMS];
+    struct evhtp_exact_s      * exact;
+    struct evhtp_route_node_s * routes;
+    struct evhtp_vec_s        * fallback;
+    evhtp_callback_t          * callback;
+    size_t                      len;
+    unsigned int                i;
+    unsigned int                n;
+#ifndef EVHTP_DISABLE_REGEX
+    struct evhtp_vec_s       * sets;
+    struct evhtp_regex_set_s * set;
+    unsigned int               nsets;
+    unsigned int               j = 0;
+#endif
+
+    if (cbs == NULL || path == NULL) {
+        return NULL;
+    }
+
+    len = strlen(path);
+
+    if ((exact = _evhtp_load(&cbs->exact)) != NULL && (callback = _evhtp_exact_find(exact, path, len))) {
+        *start_offset = 0;
+        *end_offset   = (unsigned int)len;
+        return callback;
+    }
+
+    match.callback = NULL;
+    match.seq      = UINT_MAX;
+    match.nspans   = 0;
+
+    if ((routes = _evhtp_load(&cbs->routes)) != NULL) {
+        _evhtp_route_search(routes, path, len, spans, 0, &match);
+    }
+
+#ifndef EVHTP_DISABLE_REGEX
+    sets  = _evhtp_load(&cbs->regex_sets);
+    nsets = sets ? _evhtp_load(&sets->n) : 0;
+#endif
+
+    /* loaded after the sets, so that it has all of their members */
+    fallback = _evhtp_load(&cbs->fallback);
+    n        = fallback ? _evhtp_load(&fallback->n) : 0;
+
+    for (i = 0; i < n && ((evhtp_callback_t *)fallback->items[i])->seq < match.seq; i++) {
+#ifndef EVHTP_DISABLE_REGEX
+        if (j < nsets && (set = _evhtp_load(&sets->items[j]))->first == i && (j++, set->n > 1)) {
+            if ((callback = _evhtp_regex_set_match(fallback, set, path, len, start_offset, end_offset))) {
+                if (callback->seq < match.seq) {
+                    return callback;
+                }
+
+                /* nothing after it in the list can beat the tree either */
+                break;
+            }
+
+            i += set->n - 1;
+            continue;
+        }
+#endif
+
+        if (_evhtp_callback_match(fallback->items[i], path, len, start_offset, end_offset)) {
+            return fallback->items[i];
+        }
+    }
+
+    if ((callback = match.callback) != NULL) {
+        *start_offset = 0;
+        *end_offset   = (unsigned int)len;
+
+        if (callback->route != NULL) {
+            evhtp_route_t * route = callback->route;
+
+            for (i = 0; i < route->nparams && i < match.nspans; i++) {
+                params[i].name     = route->names[i].name;
+                params[i].name_len = route->names[i].len;
+                params[i].val      = match.spans[i].val;
+                params[i].val_len  = match.spans[i].len;
+            }
+
+            *nparams = i;
+        }
+
+        return callback;
+    }
+
+    /* callbacks which were inserted into the tailq directly come last */
+    callback = _evhtp_load(&cbs->last);
+    callback = _evhtp_load(callback ? &TAILQ_NEXT(callback, next) : &TAILQ_FIRST(cbs));
+
+    for (; callback != NULL; callback = _evhtp_load(&TAILQ_NEXT(callback, next))) {
+        if (callback->type == evhtp_callback_type_route) {
+            if (_evhtp_route_match_path(callback, path, params, nparams)) {
+                *start_offset = 0;
+                *end_offset   = (unsigned int)len;
+                return callback;
+            }
+        } else if (_evhtp_callback_match(callback, path, len, start_offset, end_offset)) {
+            return callback;
+        }
+    }
+
+    return NULL;
+}         /* _evhtp_callback_find */
+
+/*
+ * Per-request arenas.
+ *
+ * Everything evhtp allocates for a request (the request itself, its uri,
+ * path, hooks, header and query lists) is bump allocated from an arena and
+ * released in one go by _evhtp_request_free(). The first block of an arena
+ * holds the arena header and is taken from a per-thread pool, it is sized
+ * after what the requests before it needed, so that in the steady state a
+ * request is served without going to malloc() at all. Anything which does
+ * not fit goes to further blocks, which are free()'d with the arena.
+ */
+#define EVHTP_ARENA_MIN      2048
+#define EVHTP_ARENA_MAX      (64 * 1024)
+#define EVHTP_ARENA_POOL_MAX 64
+#define EVHTP_ARENA_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+struct evhtp_arena_s {
+    char * cur;                        /* the next free byte of the current block */
+    char * end;                        /* the end of the current block */
+    void * blocks;                     /* further blocks, linked through their first word */
+    size_t size;                       /* the size of the first block, starting with this header */
+    size_t used;                       /* bytes handed out, used to size the arenas which follow */
+};
+
+#if defined(__GNUC__)
+#define EVHTP_TLS __thread
+#endif
+
+#ifdef EVHTP_TLS
+static EVHTP_TLS evhtp_arena_t * _evhtp_arena_pool     = NULL;
+static EVHTP_TLS unsigned int    _evhtp_arena_pool_len = 0;
+static EVHTP_TLS size_t          _evhtp_arena_size     = EVHTP_ARENA_MIN;
+#define _evhtp_arena_want()   _evhtp_arena_size
+#else
+#define _evhtp_arena_want()   EVHTP_ARENA_MIN
+#endif
+
+static evhtp_arena_t *
+_evhtp_arena_new(void) {
+    evhtp_arena_t * arena = NULL;
+    size_t          size  = _evhtp_arena_want();
+
+#ifdef EVHTP_TLS
+    if ((arena = _evhtp_arena_pool) != NULL) {
+        _evhtp_arena_pool = arena->blocks;
+        _evhtp_arena_pool_len--;
+
+        if (arena->size < size) {
+            /* outgrown by the requests since it was put back */
+            free(arena);
+            arena = NULL;
+        } else {
+            size = arena->size;
+        }
+    }
+#endif
+
+    if (arena == NULL && !(arena = malloc(size))) {
+        return NULL;
+    }
+
+    arena->cur    = (char *)arena + EVHTP_ARENA_ALIGN(sizeof(evhtp_arena_t));
+    arena->end    = (char *)arena + size;
+    arena->blocks = NULL;
+    arena->size   = size;
+    arena->used   = 0;
+
+    return arena;
+}
+
+static void
+_evhtp_arena_free(evhtp_arena_t * arena) {
+    void * block;
+
+    if (arena == NULL) {
+        return;
+    }
+
+    while ((block = arena->blocks) != NULL) {
+        arena->blocks = *(void **)block;
+        free(block);
+    }
+
+#ifdef EVHTP_TLS
+    {
+        /* grow right away to what this request needed, shrink slowly */
+        size_t need = EVHTP_ARENA_ALIGN(sizeof(evhtp_arena_t)) + arena->used;
+
+        need = (need + 1023) & ~(size_t)1023;
+
+        if (need > _evhtp_arena_size) {
+            _evhtp_arena_size = need > EVHTP_ARENA_MAX ? EVHTP_ARENA_MAX : need;
+        } else {
+            _evhtp_arena_size -= ((_evhtp_arena_size - need) / 8) & ~(size_t)1023;
+        }
+
+        if (arena->size >= _evhtp_arena_size && _evhtp_arena_pool_len < EVHTP_ARENA_POOL_MAX) {
+            arena->blocks     = _evhtp_arena_pool;
+            _evhtp_arena_pool = arena;
+            _evhtp_arena_pool_len++;
+
+            return;
+        }
+    }
+#endif
+
+    free(arena);
+}
+
+static void
+_evhtp_arena_drain(void) {
+#ifdef EVHTP_TLS
+    evhtp_arena_t * arena;
+
+    while ((arena = _evhtp_arena_pool) != NULL) {
+        _evhtp_arena_pool = arena->blocks;
+        free(arena);
+    }
+
+    _evhtp_arena_pool_len = 0;
+#endif
+}
+
+/**
+ * @brief bump allocates len bytes from an arena, they are only released
+ *        along with the arena.
+ *
+ * @return the memory, aligned to 8 bytes, or NULL if a new block could not
+ *         be allocated.
+ */
+static void *
+_evhtp_arena_alloc(evhtp_arena_t * arena, size_t len) {
+    char * block;
+    char * res;
+    size_t size;
+    size_t hdr = EVHTP_ARENA_ALIGN(sizeof(void *));
+
+    len          = EVHTP_ARENA_ALIGN(len);
+    arena->used += len;
+
+    if ((size_t)(arena->end - arena->cur) >= len) {
+        res         = arena->cur;
+        arena->cur += len;
+
+        return res;
+    }
+
+    size = hdr + len > arena->size ? hdr + len : arena->size;
+
+    if (!(block = malloc(size))) {
+        return NULL;
+    }
+
+    *(void **)block = arena->blocks;
+    arena->blocks   = block;
+    res = block + hdr;
+
+    if (size == arena->size) {
+        /* carry on in the new block, a larger one only holds this allocation */
+        arena->cur = res + len;
+        arena->end = block + size;
+    }
+
+    return res;
+}
+
+static void *
+_evhtp_arena_calloc(evhtp_arena_t * arena, size_t len) {
+    void * res;
+
+    if ((res = _evhtp_arena_alloc(arena, len)) != NULL) {
+        memset(res, 0, len);
+    }
+
+    return res;
+}
+
+static char *
+_evhtp_arena_strndup(evhtp_arena_t * arena, const char * str, size_t len) {
+    char * res;
+
+    if ((res = _evhtp_arena_alloc(arena, len + 1)) != NULL) {
+        memcpy(res, str, len);
+        res[len] = '\0';
+    }
+
+    return res;
+}
+
+/*
+ * The evbuffers of a request are recycled through a per-thread pool as well.
+ * A buffer is emptied, and stripped of any callbacks, flags or freezes
+ * the application may have put on it before it is reused.
+ */
+#define EVHTP_EVBUF_POOL_MAX 256
+
+#ifdef EVHTP_TLS
+static EVHTP_TLS evbuf_t    * _evhtp_evbuf_pool[EVHTP_EVBUF_POOL_MAX];
+static EVHTP_TLS unsigned int _evhtp_evbuf_pool_len = 0;
+#endif
+
+static evbuf_t *
+_evhtp_evbuffer_get(void) {
+#ifdef EVHTP_TLS
+    if (_evhtp_evbuf_pool_len) {
+        return _evhtp_evbuf_pool[--_evhtp_evbuf_pool_len];
+    }
+#endif
+
+    return evbuffer_new();
+}
+
+static void
+_evhtp_evbuffer_put(evbuf_t * buf) {
+    if (buf == NULL) {
+        return;
+    }
+
+#ifdef EVHTP_TLS
+    if (_evhtp_evbuf_pool_len < EVHTP_EVBUF_POOL_MAX) {
+        evbuffer_setcb(buf, NULL, NULL);
+        evbuffer_clear_flags(buf, EVBUFFER_FLAG_DRAINS_TO_FD);
+        evbuffer_unfreeze(buf, 0);
+        evbuffer_unfreeze(buf, 1);
+        evbuffer_drain(buf, evbuffer_get_length(buf));
+
+        _evhtp_evbuf_pool[_evhtp_evbuf_pool_len++] = buf;
+        return;
+    }
+#endif
+
+    evbuffer_free(buf);
+}
+
+static void
+_evhtp_evbuffer_drain(void) {
+#ifdef EVHTP_TLS
+    while (_evhtp_evbuf_pool_len) {
+        evbuffer_free(_evhtp_evbuf_pool[--_evhtp_evbuf_pool_len]);
+    }
+#endif
+}
+
+/**
+ * @brief Creates a new evhtp_request_t
+ *
+ * @param c
+ *
+ * @return evhtp_request_t structure on success, otherwise NULL
+ */
+static evhtp_request_t *
+_evhtp_request_new(evhtp_connection_t * c) {
+    evhtp_request_t * req;
+    evhtp_arena_t   * arena;
+
+    if (!(arena = _evhtp_arena_new())) {
+        return NULL;
+    }
+
+    if (!(req = _evhtp_arena_calloc(arena, sizeof(evhtp_request_t)))) {
+        _evhtp_arena_free(arena);
+        return NULL;
+    }
+
+    req->arena       = arena;
+    req->conn        = c;
+    req->htp         = c ? c->htp : NULL;
+    req->status      = EVHTP_RES_OK;
+    req->hooks       = _evhtp_arena_calloc(arena, sizeof(evhtp_hooks_t));
+    req->buffer_in   = _evhtp_evbuffer_get();
+    req->buffer_out  = _evhtp_evbuffer_get();
+    req->headers_in  = _evhtp_kvs_new(arena, 1);
+    req->headers_out = _evhtp_kvs_new(arena, 1);
+
+    if (!req->hooks || !req->buffer_in || !req->buffer_out || !req->headers_in || !req->headers_out) {
+        _evhtp_evbuffer_put(req->buffer_in);
+        _evhtp_evbuffer_put(req->buffer_out);
+        _evhtp_arena_free(arena);
+        return NULL;
+    }
+
+    return req;
+}
+
+/**
+ * @brief frees all data in an evhtp_request_t along with calling finished hooks
+ *
+ * @param request the request structure
+ */
+static void
+_evhtp_request_free(evhtp_request_t * request) {
+    if (request == NULL) {
+        return;
+    }
+
+    _evhtp_request_fini_hook(request);
+    _evhtp_uri_free(request->uri);
+
+    evhtp_headers_free(request->headers_in);
+    evhtp_headers_free(request->headers_out);
+    evhtp_headers_free(request->headers_trailer);
+    mpparser_free(request->multipart);
+
+    _evhtp_evbuffer_put(request->buffer_in);
+    _evhtp_evbuffer_put(request->buffer_out);
+    _evhtp_evbuffer_put(request->buffer_hdrs);
+    _evhtp_evbuffer_put(request->buffer_queued);
+
+    /* the request itself lives in the arena */
+    _evhtp_arena_free(request->arena);
+}
+
+/**
+ * @brief create an overlay URI structure
+ *
+ * @param arena the arena of the request the URI belongs to
+ *
+ * @return evhtp_uri_t
+ */
+static evhtp_uri_t *
+_evhtp_uri_new(evhtp_arena_t * arena) {
+    evhtp_uri_t * uri;
+
+    if (!(uri = _evhtp_arena_calloc(arena, sizeof(evhtp_uri_t)))) {
+        return NULL;
+    }
+
+    uri->arena = arena;
+
+    return uri;
+}
+
+/**
+ * @brief releases what an overlay URI structure holds outside of the arena
+ *        of its request, the structure itself, its path and raw query are
+ *        released along with the arena.
+ *
+ * @param uri evhtp_uri_t
+ */
+static void
+_evhtp_uri_free(evhtp_uri_t * uri) {
+    if (uri == NULL) {
+        return;
+    }
+
+    evhtp_query_free(uri->query);
+
+    free(uri->fragment);
+}
+
+/**
+ * @brief parses the path and file from an input buffer, the result is
+ *        allocated from the arena of the request
+ *
+ * @details in order to properly create a structure that can match
+ *          both a path and a file, this will parse a string into
+ *          what it considers a path, and a file.
+ *
+ * @details if for example the input was "/a/b/c", the parser will
+ *          consider "/a/b/" as the path, and "c" as the file.
+ *
+ * @details only the input itself is copied, the file points into the
+ *          copy and the path is copied out of it on first use, see
+ *          evhtp_path_get_path().
+ *
+ * @param arena the arena of the request
+ * @param data raw input data (assumes a /path/[file] structure)
+ * @param len length of the input data
+ *
+ * @return evhtp_request_t * on success, NULL on error.
+ */
+static evhtp_path_t *
+_evhtp_path_new(evhtp_arena_t * arena, const char * data, size_t len) {
+    evhtp_path_t * req_path;
+    size_t         i;
+
+    if (!(req_path = _evhtp_arena_calloc(arena, sizeof(evhtp_path_t)))) {
+        return NULL;
+    }
+
+    req_path->arena    = arena;
+    req_path->len      = (unsigned int)len;
+    req_path->path_len = 1;
+
+    if (len == 0) {
+        /*
+         * odd situation here, no preceding "/", so just assume the path is "/"
+         */
+        return req_path;
+    }
+
+    if (!(req_path->full = _evhtp_arena_strndup(arena, data, len))) {
+        return NULL;
+    }
+
+    if (*data != '/') {
+        /* request like GET stupid HTTP/1.0, treat stupid as the file, and
+         * assume the path is "/"
+         */
+        req_path->file = req_path->full;
+    } else if (data[len - 1] != '/') {
+        /*
+         * the last character in data is assumed to be a file, not the end of
+         * path, the last "/" (which may be the leading one) ends the path.
+         */
+        for (i = len - 1; data[i] != '/'; i--) {
+            ;
+        }
+
+        req_path->path_len = (unsigned int)(i + 1);
+        req_path->file     = req_path->full + i + 1;
+    } else {
+        /* the last character is a "/", thus the request is just a path */
+        req_path->path_len = (unsigned int)len;
+    }
+
+    return req_path;
+}     /* _evhtp_path_new */
+
+evhtp_query_t *
+evhtp_uri_get_query(evhtp_uri_t * uri) {
+    if (uri->query == NULL && uri->query_raw != NULL) {
+        uri->query = _evhtp_parse_query(uri->arena, (const char *)uri->query_raw, uri->query_raw_len);
+    }
+
+    return uri->query;
+}
+
+const char *
+evhtp_path_get_path(evhtp_path_t * path) {
+    if (path->path == NULL) {
+        if (path->full != NULL && *path->full == '/') {
+            path->path = _evhtp_arena_strndup(path->arena, path->full, path->path_len);
+        } else {
+            path->path = _evhtp_arena_strndup(path->arena, "/", 1);
+        }
+    }
+
+    return path->path;
+}
+
+const char *
+evhtp_path_get_file(evhtp_path_t * path) {
+    return path->file;
+}
+
+const char *
+evhtp_path_get_param(evhtp_path_t * path, const char * name, size_t * len) {
+    size_t       name_len;
+    unsigned int i;
+
+    if (path == NULL || name == NULL) {
+        return NULL;
+    }
+
+    name_len = strlen(name);
+
+    for (i = 0; i < path->nparams; i++) {
+        if (path->params[i].name_len == name_len &&
+            memcmp(path->params[i].name, name, name_len) == 0) {
+            if (len != NULL) {
+                *len = path->params[i].val_len;
+            }
+
+            return path->params[i].val;
+        }
+    }
+
+    return NULL;
+}
+
+const char *
+evhtp_path_get_match_start(evhtp_path_t * path) {
+    if (path->match_start == NULL && path->match_end != NULL) {
+        size_t len = path->matched_eoff - path->matched_soff;
+
+        if (len == 0) {
+            /* no end offset, the match runs to the end of the path */
+            len = path->len - path->matched_soff;
+        }
+
+        path->match_start = _evhtp_arena_strndup(path->arena,
+                                                 path->full + path->matched_soff, len);
+    }
+
+    return path->match_start;
+}
+
+const char *
+evhtp_path_get_match_end(evhtp_path_t * path) {
+    return path->match_end;
+}
+
+static int
+_evhtp_request_parser_start(htparser * p) {
+    evhtp_connection_t * c = htparser_get_userdata(p);
+
+    if (c->type == evhtp_type_client) {
+        return 0;
+    }
+
+    if (c->paused == 1) {
+        return -1;
+    }
+
+    if (c->htp->parent && c->vhost_via_sni == 0) {
+        /* the previous request was served by a virtual host evhtp_t structure
+         * which was *NOT* found via SSL SNI lookup. In this case we want to
+         * reset our connections evhtp_t structure back to the original so
+         * that subsequent requests can have a different Host: header.
+         */
+        c->htp = c->htp->parent;
+    }
+
+    /* any previous request stays queued on the connection until it has been
+     * answered, see _evhtp_connection_advance()
+     */
+    if (!(c->request = _evhtp_request_new(c))) {
+        return -1;
+    }
+
+    TAILQ_INSERT_TAIL(&c->pending, c->request, next);
+
+    c->num_pending    += 1;
+    c->body_bytes_read = 0;
 
-    if (c->request) {
-        if (c->request->finished == 1) {
-            _evhtp_request_free(c->request);
-        } else {
-            return -1;
+    return 0;
+}
+
+/**
+ * @brief returns the buffer a response should be written to. Only the oldest
+ *        request on a connection writes to the connection directly, the
+ *        responses of pipelined requests behind it are held back on the
+ *        request until it is their turn.
+ *
+ * @param request
+ *
+ * @return evbuf_t
+ */
+static evbuf_t *
+_evhtp_request_output(evhtp_request_t * request) {
+    evhtp_connection_t * c = request->conn;
+
+    if (c->type == evhtp_type_server && TAILQ_FIRST(&c->pending) != request) {
+        if (request->buffer_queued == NULL) {
+            request->buffer_queued = _evhtp_evbuffer_get();
         }
+
+        return request->buffer_queued;
     }
 
-    if (!(c->request = _evhtp_request_new(c))) {
-        return -1;
+    return bufferevent_get_output(c->bev);
+}
+
+/**
+ * @brief determines whether parsing has to stop after the request which was
+ *        just read, instead of going on to the next pipelined one.
+ *
+ * @param c
+ *
+ * @return 1 if the remaining input has to wait until the connection is
+ *         resumed, the pipeline drains or the connection is closed, otherwise 0
+ */
+static inline int
+_evhtp_connection_stalled(evhtp_connection_t * c) {
+    if (c->type != evhtp_type_server || c->request == NULL || c->request->complete == 0) {
+        return 0;
+    }
+
+    if (c->paused == 1 || c->request->keepalive == 0) {
+        return 1;
+    }
+
+    if (c->htp->max_pipelined_requests &&
+        c->num_pending >= c->htp->max_pipelined_requests) {
+        return 1;
     }
 
     return 0;
@@ -877,13 +2738,19 @@ _evhtp_request_parser_args(htparser * p, const char * data, size_t len) {
         return 0;
     }
 
-    if (!(uri->query = evhtp_parse_query(data, len))) {
+    if (!(uri->query_raw = (unsigned char *)_evhtp_arena_strndup(c->request->arena, data, len))) {
         c->request->status = EVHTP_RES_ERROR;
         return -1;
     }
 
-    uri->query_raw = calloc(len + 1, 1);
-    memcpy(uri->query_raw, data, len);
+    uri->query_raw_len = len;
+
+#ifndef EVHTP_DISABLE_URI_COMPAT
+    if (!evhtp_uri_get_query(uri)) {
+        c->request->status = EVHTP_RES_ERROR;
+        return -1;
+    }
+#endif
 
     return 0;
 }
@@ -899,22 +2766,61 @@ _evhtp_request_parser_headers_start(htparser * p) {
     return 0;
 }
 
+/**
+ * @brief checks whether data handed to a parser hook points into the input
+ *        buffer currently being parsed, as opposed to the parser's own
+ *        scratch buffer.
+ *
+ * @param c
+ * @param data
+ *
+ * @return 1 if data can be referenced in place, otherwise 0
+ */
+static inline int
+_evhtp_connection_in_input(evhtp_connection_t * c, const char * data) {
+    return data >= c->inbuf && data < c->inbuf + c->inbuf_len;
+}
+
 static int
 _evhtp_request_parser_header_key(htparser * p, const char * data, size_t len) {
     evhtp_connection_t * c = htparser_get_userdata(p);
-    char               * key_s;     /* = strndup(data, len); */
+    char               * key_s;
     evhtp_header_t     * hdr;
 
-    key_s      = malloc(len + 1);
-    key_s[len] = '\0';
-    memcpy(key_s, data, len);
+    if (_evhtp_connection_in_input(c, data)) {
+        /* the key is followed by the ':' which was just consumed, so it can be
+         * terminated and referenced in place. The input is moved over to the
+         * request once the parser returns (see _evhtp_connection_pin_input()).
+         */
+        key_s         = (char *)data;
+        key_s[len]    = '\0';
+        c->inbuf_refs = 1;
+    } else if (!(key_s = _evhtp_arena_strndup(c->request->arena, data, len))) {
+        c->request->status = EVHTP_RES_FATAL;
+        return -1;
+    }
 
-    if ((hdr = evhtp_header_key_add(c->request->headers_in, key_s, 0)) == NULL) {
+    if (!(hdr = _evhtp_arena_alloc(c->request->arena, sizeof(evhtp_header_t)))) {
         c->request->status = EVHTP_RES_FATAL;
         return -1;
     }
 
-    hdr->k_heaped = 1;
+    hdr->heaped   = 0;
+    hdr->k_heaped = 0;
+    hdr->v_heaped = 0;
+    hdr->key      = key_s;
+    hdr->klen     = len;
+    hdr->val      = NULL;
+    hdr->vlen     = 0;
+    hdr->id       = EVHTP_HDR_UNKNOWN;
+
+    if (c->request->headers_trailer != NULL) {
+        /* only set once the last chunk has been read */
+        evhtp_headers_add_header(c->request->headers_trailer, hdr);
+    } else {
+        evhtp_headers_add_header(c->request->headers_in, hdr);
+    }
+
     return 0;
 }
 
@@ -922,21 +2828,42 @@ static int
 _evhtp_request_parser_header_val(htparser * p, const char * data, size_t len) {
     evhtp_connection_t * c = htparser_get_userdata(p);
     char               * val_s;
+    evhtp_headers_t    * headers;
     evhtp_header_t     * header;
 
-    val_s      = malloc(len + 1);
-    val_s[len] = '\0';
-    memcpy(val_s, data, len);
+    if (c->request->headers_trailer != NULL) {
+        headers = c->request->headers_trailer;
+    } else {
+        headers = c->request->headers_in;
+    }
+
+    header = TAILQ_LAST(headers, evhtp_headers_s);
+
+    if (header == NULL || header->val != NULL) {
+        c->request->status = EVHTP_RES_FATAL;
+        return -1;
+    }
 
-    if ((header = evhtp_header_val_add(c->request->headers_in, val_s, 0)) == NULL) {
-        free(val_s);
+    if (_evhtp_connection_in_input(c, data)) {
+        /* terminated in place over the consumed CR */
+        val_s         = (char *)data;
+        val_s[len]    = '\0';
+        c->inbuf_refs = 1;
+    } else if (!(val_s = _evhtp_arena_strndup(c->request->arena, data, len))) {
         c->request->status = EVHTP_RES_FATAL;
         return -1;
     }
 
-    header->v_heaped = 1;
+    header->val  = val_s;
+    header->vlen = len;
+
+    if (headers == c->request->headers_trailer) {
+        c->request->status = _evhtp_trailer_hook(c->request, header);
+    } else {
+        c->request->status = _evhtp_header_hook(c->request, header);
+    }
 
-    if ((c->request->status = _evhtp_header_hook(c->request, header)) != EVHTP_RES_OK) {
+    if (c->request->status != EVHTP_RES_OK) {
         return -1;
     }
 
@@ -947,13 +2874,16 @@ static inline evhtp_t *
 _evhtp_request_find_vhost(evhtp_t * evhtp, const char * name) {
     evhtp_t       * evhtp_vhost;
     evhtp_alias_t * evhtp_alias;
+    size_t          len = strlen(name);
 
     TAILQ_FOREACH(evhtp_vhost, &evhtp->vhosts, next_vhost) {
         if (evhtp_vhost->server_name == NULL) {
             continue;
         }
 
-        if (_evhtp_glob_match(evhtp_vhost->server_name, name) == 1) {
+        if (evhtp_vhost->server_glob != NULL ?
+            _evhtp_glob_matchn(evhtp_vhost->server_glob, name, len) :
+            _evhtp_glob_match(evhtp_vhost->server_name, name) == 1) {
             return evhtp_vhost;
         }
 
@@ -962,7 +2892,9 @@ _evhtp_request_find_vhost(evhtp_t * evhtp, const char * name) {
                 continue;
             }
 
-            if (_evhtp_glob_match(evhtp_alias->alias, name) == 1) {
+            if (evhtp_alias->glob != NULL ?
+                _evhtp_glob_matchn(evhtp_alias->glob, name, len) :
+                _evhtp_glob_match(evhtp_alias->alias, name) == 1) {
                 return evhtp_vhost;
             }
         }
@@ -981,6 +2913,7 @@ _evhtp_request_set_callbacks(evhtp_request_t * request) {
     evhtp_callback_t   * callback;
     evhtp_callback_cb    cb;
     void               * cbarg;
+    evhtp_header_set_t * set;
 
     if (request == NULL) {
         return -1;
@@ -1006,56 +2939,54 @@ _evhtp_request_set_callbacks(evhtp_request_t * request) {
     callback = NULL;
     cb       = NULL;
     cbarg    = NULL;
+    set      = NULL;
+
+    path->nparams = 0;
 
     if ((callback = _evhtp_callback_find(evhtp->callbacks, path->full,
-                                         &path->matched_soff, &path->matched_eoff))) {
+                                         &path->matched_soff, &path->matched_eoff,
+                                         path->params, &path->nparams))) {
         /* matched a callback using both path and file (/a/b/c/d) */
         cb    = callback->cb;
         cbarg = callback->cbarg;
         hooks = callback->hooks;
-    } else if ((callback = _evhtp_callback_find(evhtp->callbacks, path->path,
-                                                &path->matched_soff, &path->matched_eoff))) {
+        set   = callback->hdr_set;
+    } else if ((callback = _evhtp_callback_find(evhtp->callbacks, evhtp_path_get_path(path),
+                                                &path->matched_soff, &path->matched_eoff,
+                                                path->params, &path->nparams))) {
         /* matched a callback using *just* the path (/a/b/c/) */
         cb    = callback->cb;
         cbarg = callback->cbarg;
         hooks = callback->hooks;
+        set   = callback->hdr_set;
     } else {
         /* no callbacks found for either case, use defaults */
         cb    = evhtp->defaults.cb;
         cbarg = evhtp->defaults.cbarg;
 
         path->matched_soff = 0;
-        path->matched_eoff = (unsigned int)strlen(path->full);
+        path->matched_eoff = path->len;
     }
 
-    if (path->match_start == NULL) {
-        path->match_start = calloc(strlen(path->full) + 1, 1);
-    }
-
-    if (path->match_end == NULL) {
-        path->match_end = calloc(strlen(path->full) + 1, 1);
-    }
+    /* match_start is copied out of the full path on first use */
+    path->match_start = NULL;
+    path->match_end   = path->full ? path->full + path->matched_eoff : NULL;
 
-    if (path->matched_eoff - path->matched_soff) {
-        memcpy(path->match_start, (void *)(path->full + path->matched_soff),
-               path->matched_eoff - path->matched_soff);
-    } else {
-        memcpy(path->match_start, (void *)(path->full + path->matched_soff),
-               strlen((const char *)(path->full + path->matched_soff)));
+#ifndef EVHTP_DISABLE_URI_COMPAT
+    if (!evhtp_path_get_path(path) || !evhtp_path_get_match_start(path)) {
+        return -1;
     }
-
-    memcpy(path->match_end,
-           (void *)(path->full + path->matched_eoff),
-           strlen(path->full) - path->matched_eoff);
+#endif
 
     if (hooks != NULL) {
-        if (request->hooks == NULL) {
-            request->hooks = malloc(sizeof(evhtp_hooks_t));
-        }
-
+        /* request->hooks is allocated along with the request */
         memcpy(request->hooks, hooks, sizeof(evhtp_hooks_t));
     }
 
+    if (set != NULL) {
+        request->hdr_set = set;
+    }
+
     request->cb    = cb;
     request->cbarg = cbarg;
 
@@ -1068,6 +2999,10 @@ _evhtp_request_parser_hostname(htparser * p, const char * data, size_t len) {
     evhtp_t            * evhtp;
     evhtp_t            * evhtp_vhost;
 
+    if (_evhtp_connection_in_input(c, data)) {
+        ((char *)data)[len] = '\0';
+    }
+
 #ifndef EVHTP_DISABLE_SSL
     if (c->vhost_via_sni == 1 && c->ssl != NULL) {
         /* use the SNI set hostname instead of the header hostname */
@@ -1120,13 +3055,12 @@ _evhtp_request_parser_path(htparser * p, const char * data, size_t len) {
     evhtp_uri_t        * uri;
     evhtp_path_t       * path;
 
-    if (!(uri = _evhtp_uri_new())) {
+    if (!(uri = _evhtp_uri_new(c->request->arena))) {
         c->request->status = EVHTP_RES_FATAL;
         return -1;
     }
 
-    if (!(path = _evhtp_path_new(data, len))) {
-        _evhtp_uri_free(uri);
+    if (!(path = _evhtp_path_new(c->request->arena, data, len))) {
         c->request->status = EVHTP_RES_FATAL;
         return -1;
     }
@@ -1167,11 +3101,11 @@ _evhtp_request_parser_headers(htparser * p) {
         /* only send a 100 continue response if it hasn't been disabled via
          * evhtp_disable_100_continue.
          */
-        if (!evhtp_header_find(c->request->headers_in, "Expect")) {
+        if (!evhtp_header_find_id(c->request->headers_in, EVHTP_HDR_EXPECT)) {
             return 0;
         }
 
-        evbuffer_add_printf(bufferevent_get_output(c->bev),
+        evbuffer_add_printf(_evhtp_request_output(c->request),
                             "HTTP/%d.%d 100 Continue\r\n\r\n",
                             htparser_get_major(p),
                             htparser_get_minor(p));
@@ -1180,35 +3114,75 @@ _evhtp_request_parser_headers(htparser * p) {
     return 0;
 }
 
+/**
+ * @brief hands len bytes of body to the request, running the on_read hook
+ *        if one is set; whatever the hook leaves behind ends up in
+ *        request->buffer_in.
+ *
+ *        The bytes come either from data, which is copied, or from the
+ *        front of src, whose chains are moved over without copying.
+ *
+ * @param c
+ * @param data
+ * @param src
+ * @param len
+ *
+ * @return 0 on success, -1 with request->status set on error
+ */
 static int
-_evhtp_request_parser_body(htparser * p, const char * data, size_t len) {
-    evhtp_connection_t * c   = htparser_get_userdata(p);
-    evbuf_t            * buf;
-    int                  res = 0;
+_evhtp_request_body(evhtp_connection_t * c, const char * data, evbuf_t * src, size_t len) {
+    evhtp_request_t * request = c->request;
+    evbuf_t         * buf;
+    int               res     = 0;
 
     if (c->max_body_size > 0 && c->body_bytes_read + len >= c->max_body_size) {
-        c->error           = 1;
-        c->request->status = EVHTP_RES_DATA_TOO_LONG;
+        c->error        = 1;
+        request->status = EVHTP_RES_DATA_TOO_LONG;
+
+        return -1;
+    }
+
+    c->body_bytes_read += len;
+
+    if (!HOOK_AVAIL(request, on_read) && !HOOK_AVAIL(c, on_read)) {
+        if (src != NULL) {
+            evbuffer_remove_buffer(src, request->buffer_in, len);
+        } else {
+            evbuffer_add(request->buffer_in, data, len);
+        }
+
+        return 0;
+    }
 
+    if (!(buf = _evhtp_evbuffer_get())) {
+        request->status = EVHTP_RES_FATAL;
         return -1;
     }
 
-    buf = evbuffer_new();
-    evbuffer_add(buf, data, len);
+    if (src != NULL) {
+        evbuffer_remove_buffer(src, buf, len);
+    } else {
+        evbuffer_add(buf, data, len);
+    }
 
-    if ((c->request->status = _evhtp_body_hook(c->request, buf)) != EVHTP_RES_OK) {
+    if ((request->status = _evhtp_body_hook(request, buf)) != EVHTP_RES_OK) {
         res = -1;
     }
 
     if (evbuffer_get_length(buf)) {
-        evbuffer_add_buffer(c->request->buffer_in, buf);
+        evbuffer_add_buffer(request->buffer_in, buf);
     }
 
-    evbuffer_free(buf);
-
-    c->body_bytes_read += len;
+    _evhtp_evbuffer_put(buf);
 
     return res;
+} /* _evhtp_request_body */
+
+static int
+_evhtp_request_parser_body(htparser * p, const char * data, size_t len) {
+    evhtp_connection_t * c = htparser_get_userdata(p);
+
+    return _evhtp_request_body(c, data, NULL, len);
 }
 
 static int
@@ -1242,6 +3216,14 @@ _evhtp_request_parser_chunks_fini(htparser * p) {
         return -1;
     }
 
+    /* any headers the parser hands over from here on are trailers */
+    if (c->request->headers_trailer == NULL) {
+        if (!(c->request->headers_trailer = _evhtp_kvs_new(c->request->arena, 0))) {
+            c->request->status = EVHTP_RES_FATAL;
+            return -1;
+        }
+    }
+
     return 0;
 }
 
@@ -1263,7 +3245,7 @@ _evhtp_should_parse_query_body(evhtp_request_t * req) {
         return 0;
     }
 
-    if (req->uri == NULL || req->uri->query != NULL) {
+    if (req->uri == NULL || req->uri->query_raw != NULL) {
         return 0;
     }
 
@@ -1276,7 +3258,7 @@ _evhtp_should_parse_query_body(evhtp_request_t * req) {
         return 0;
     }
 
-    content_type = evhtp_kv_find(req->headers_in, "content-type");
+    content_type = evhtp_header_find_id(req->headers_in, EVHTP_HDR_CONTENT_TYPE);
 
     if (content_type == NULL) {
         return 0;
@@ -1308,10 +3290,12 @@ _evhtp_request_parser_fini(htparser * p) {
         body_len       = evbuffer_get_length(buf_in);
         body           = (const char *)evbuffer_pullup(buf_in, body_len);
 
-        uri->query_raw = calloc(body_len + 1, 1);
-        memcpy(uri->query_raw, body, body_len);
+        uri->query_raw     = (unsigned char *)_evhtp_arena_strndup(c->request->arena, body, body_len);
+        uri->query_raw_len = body_len;
 
-        uri->query     = evhtp_parse_query(body, body_len);
+#ifndef EVHTP_DISABLE_URI_COMPAT
+        evhtp_uri_get_query(uri);
+#endif
     }
 
 
@@ -1325,6 +3309,15 @@ _evhtp_request_parser_fini(htparser * p) {
         (c->request->cb)(c->request, c->request->cbarg);
     }
 
+    if (c->request) {
+        c->request->complete = 1;
+    }
+
+    if (_evhtp_connection_stalled(c)) {
+        /* stop the parser here, the rest of the input is left for later */
+        return -1;
+    }
+
     return 0;
 }
 
@@ -1339,95 +3332,389 @@ _evhtp_create_headers(evhtp_header_t * header, void * arg) {
     return 0;
 }
 
-static evbuf_t *
-_evhtp_create_reply(evhtp_request_t * request, evhtp_res code) {
-    evbuf_t    * buf          = evbuffer_new();
-    const char * content_type = evhtp_header_find(request->headers_out, "Content-Type");
+/**
+ * @brief formats the current time as the value of a Date: header. The value
+ *        is taken from the cached time of the event loop, and formatted at
+ *        most once a second per thread.
+ *
+ * @param evbase
+ * @param out filled with the value, at least 32 bytes
+ *
+ * @return the length of the value
+ */
+static size_t
+_evhtp_date_format(evbase_t * evbase, char * out) {
+    static const char * days[]   = {
+        "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+    };
+    static const char * months[] = {
+        "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+    };
+#ifdef EVHTP_TLS
+    static EVHTP_TLS char   date[32];
+    static EVHTP_TLS size_t date_len = 0;
+    static EVHTP_TLS time_t date_sec = -1;
+#else
+    char                  * date     = out;
+    size_t                  date_len = 0;
+    time_t                  date_sec = -1;
+#endif
+    struct timeval          tv;
+    struct tm               tm;
+    int                     res;
+
+    event_base_gettimeofday_cached(evbase, &tv);
+
+    if (tv.tv_sec != date_sec) {
+        /* not strftime(), the names must not depend on the locale */
+        gmtime_r(&tv.tv_sec, &tm);
+        res = snprintf(date, 32, "%s, %02d %s %d %02d:%02d:%02d GMT",
+                       days[tm.tm_wday], tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900,
+                       tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+        date_len = res > 0 && res < 32 ? (size_t)res : 0;
+        date_sec = tv.tv_sec;
+    }
+
+    if (date != out) {
+        memcpy(out, date, date_len);
+    }
+
+    return date_len;
+}
+
+/**
+ * @brief writes the decimal representation of n to the end of buf
+ *
+ * @param n
+ * @param end one past the last byte available
+ *
+ * @return the start of the number within buf
+ */
+static char *
+_evhtp_uint_to_str(uint64_t n, char * end) {
+    do {
+        *--end = (char)('0' + n % 10);
+        n     /= 10;
+    } while (n);
+
+    return end;
+}
+
+#define _evhtp_put(p, s, l)  do { memcpy(p, s, l); p += l; } while (0)
+#define _evhtp_put_lit(p, s) _evhtp_put(p, s, sizeof(s) - 1)
+
+/**
+ * @brief checks whether headers has a header of the same name as kv
+ *
+ * @param headers
+ * @param kv
+ *
+ * @return 1 if found, 0 if not
+ */
+static inline int
+_evhtp_headers_has(evhtp_headers_t * headers, evhtp_header_t * kv) {
+    if (kv->id != EVHTP_HDR_UNKNOWN) {
+        return evhtp_kvs_find_kv_id(headers, kv->id) != NULL;
+    }
+
+    return _evhtp_kvs_find(headers, kv->key, kv->klen) != NULL;
+}
+
+/**
+ * @brief writes the status line and headers of a response to out, followed
+ *        by whatever is in request->buffer_out.
+ *
+ *        The headers the user did not set (Content-Length, Content-Type,
+ *        Connection and Date) are worked out first, the size of the whole
+ *        block is added up, and then it is written in one go into space
+ *        reserved at the end of out. The body is moved behind it by
+ *        reference.
+ *
+ *        The header set of the request, if any, goes right after the status
+ *        line. It is copied out as a single block unless headers_out
+ *        replaces one of its headers, in which case its headers are
+ *        written one by one, leaving out the replaced ones.
+ *
+ * @param request
+ * @param code
+ * @param out
+ *
+ * @return 0 on success, -1 if the space could not be reserved
+ */
+static int
+_evhtp_create_reply(evhtp_request_t * request, evhtp_res code, evbuf_t * out) {
+    evhtp_headers_t      * headers  = request->headers_out;
+    evhtp_header_set_t   * set      = request->hdr_set;
+    int                    set_whole;
+    size_t                 body_len = evbuffer_get_length(request->buffer_out);
+    const char           * status;
+    size_t                 status_len;
+    char                   status_buf[64];
+    const char           * clen     = NULL;
+    size_t                 clen_len = 0;
+    char                   clen_buf[24];
+    int                    add_type = 0;
+    const char           * conn     = NULL;
+    size_t                 conn_len = 0;
+    char                   date[32];
+    size_t                 date_len = 0;
+    int                    minor    = 0;
+    size_t                 len;
+    struct evbuffer_iovec  iov;
+    evhtp_header_t       * header;
+    char                 * p;
+
+    if (body_len && request->chunked == 0) {
+        /* add extra headers (like content-length/type) if not already present */
+        if (!evhtp_header_find_id(headers, EVHTP_HDR_CONTENT_LENGTH)) {
+            clen     = _evhtp_uint_to_str(body_len, clen_buf + sizeof(clen_buf));
+            clen_len = (size_t)(clen_buf + sizeof(clen_buf) - clen);
+        }
+
+        if (!evhtp_header_find_id(headers, EVHTP_HDR_CONTENT_TYPE) &&
+            !(set && evhtp_header_find_id(set->headers, EVHTP_HDR_CONTENT_TYPE))) {
+            add_type = 1;
+        }
+    } else if (!evhtp_header_find_id(headers, EVHTP_HDR_CONTENT_LENGTH)) {
+        const char * chunked = evhtp_header_find_id(headers, EVHTP_HDR_TRANSFER_ENCODING);
+
+        if (!chunked || !strstr(chunked, "chunked")) {
+            clen     = "0";
+            clen_len = 1;
+        }
+    }
+
+    /* add the proper keep-alive type headers based on http version */
+    switch (request->proto) {
+        case EVHTP_PROTO_11:
+            if (request->keepalive == 0) {
+                /* protocol is HTTP/1.1 but client wanted to close */
+                conn     = "close";
+                conn_len = 5;
+            }
+
+            minor = 1;
+            break;
+        case EVHTP_PROTO_10:
+            if (request->keepalive == 1) {
+                /* protocol is HTTP/1.0 and clients wants to keep established */
+                conn     = "keep-alive";
+                conn_len = 10;
+            }
+            break;
+        default:
+            /* this sometimes happens when a response is made but paused before
+             * the method has been parsed, answer as HTTP/1.0 */
+            break;
+    } /* switch */
+
+    if (request->conn->htp && request->conn->htp->add_date_hdr &&
+        !evhtp_header_find_id(headers, EVHTP_HDR_DATE) &&
+        !(set && evhtp_header_find_id(set->headers, EVHTP_HDR_DATE))) {
+        date_len = _evhtp_date_format(request->conn->evbase, date);
+    }
+
+    set_whole = set != NULL;
+
+    if (set != NULL && TAILQ_FIRST(headers) != NULL) {
+        TAILQ_FOREACH(header, set->headers, next) {
+            if (_evhtp_headers_has(headers, header)) {
+                set_whole = 0;
+                break;
+            }
+        }
+    }
+
+    /* the status line, the version is taken from the request since the
+     * parser may already be reading a pipelined request behind this one */
+    if (code < SCODE_MAX && status_codes[code].str != NULL) {
+        status     = status_codes[code].line[minor];
+        status_len = status_codes[code].line_len;
+    } else {
+        int res = snprintf(status_buf, sizeof(status_buf), "HTTP/1.%d %d %s\r\n",
+                           minor, code, status_code_to_str(code));
+
+        if (res < 0 || res >= (int)sizeof(status_buf)) {
+            return -1;
+        }
+
+        status     = status_buf;
+        status_len = (size_t)res;
+    }
+
+    len = status_len + 2;
+
+    if (set_whole) {
+        len += set->len;
+    } else if (set != NULL) {
+        TAILQ_FOREACH(header, set->headers, next) {
+            if (!_evhtp_headers_has(headers, header)) {
+                len += header->klen + header->vlen + 4;
+            }
+        }
+    }
+
+    TAILQ_FOREACH(header, headers, next) {
+        len += header->klen + header->vlen + 4;
+    }
+
+    if (clen != NULL) {
+        len += sizeof("Content-Length: \r\n") - 1 + clen_len;
+    }
+
+    if (add_type) {
+        len += sizeof("Content-Type: text/plain\r\n") - 1;
+    }
+
+    if (conn != NULL) {
+        len += sizeof("Connection: \r\n") - 1 + conn_len;
+    }
+
+    if (date_len) {
+        len += sizeof("Date: \r\n") - 1 + date_len;
+    }
+
+    if (evbuffer_reserve_space(out, len, &iov, 1) < 1) {
+        return -1;
+    }
+
+    p = iov.iov_base;
+
+    _evhtp_put(p, status, status_len);
+
+    if (set_whole) {
+        _evhtp_put(p, set->buf, set->len);
+    } else if (set != NULL) {
+        TAILQ_FOREACH(header, set->headers, next) {
+            if (!_evhtp_headers_has(headers, header)) {
+                _evhtp_put(p, header->key, header->klen);
+                _evhtp_put_lit(p, ": ");
+                _evhtp_put(p, header->val, header->vlen);
+                _evhtp_put_lit(p, "\r\n");
+            }
+        }
+    }
 
-    if (htparser_get_multipart(request->conn->parser) == 1) {
-        goto check_proto;
+    TAILQ_FOREACH(header, headers, next) {
+        _evhtp_put(p, header->key, header->klen);
+        _evhtp_put_lit(p, ": ");
+
+        if (header->vlen) {
+            _evhtp_put(p, header->val, header->vlen);
+        }
+
+        _evhtp_put_lit(p, "\r\n");
+    }
+
+    if (clen != NULL) {
+        _evhtp_put_lit(p, "Content-Length: ");
+        _evhtp_put(p, clen, clen_len);
+        _evhtp_put_lit(p, "\r\n");
+    }
+
+    if (add_type) {
+        _evhtp_put_lit(p, "Content-Type: text/plain\r\n");
+    }
+
+    if (conn != NULL) {
+        _evhtp_put_lit(p, "Connection: ");
+        _evhtp_put(p, conn, conn_len);
+        _evhtp_put_lit(p, "\r\n");
+    }
+
+    if (date_len) {
+        _evhtp_put_lit(p, "Date: ");
+        _evhtp_put(p, date, date_len);
+        _evhtp_put_lit(p, "\r\n");
+    }
+
+    _evhtp_put_lit(p, "\r\n");
+
+    iov.iov_len = len;
+
+    if (evbuffer_commit_space(out, &iov, 1) != 0) {
+        return -1;
+    }
+
+    if (body_len) {
+        evbuffer_add_buffer(out, request->buffer_out);
+    }
+
+    return 0;
+}     /* _evhtp_create_reply */
+
+/**
+ * @brief retires answered requests from the front of the pipeline, handing
+ *        the connection output over to the request behind each one. A
+ *        request is retired once it has been read in full and its response
+ *        is finished.
+ *
+ * @param c
+ *
+ * @return -1 if the connection was freed, otherwise 0
+ */
+static int
+_evhtp_connection_advance(evhtp_connection_t * c) {
+    evhtp_request_t * request;
+    evbuf_t         * output;
+
+    if (c->paused == 1) {
+        return 0;
     }
 
-    if (evbuffer_get_length(request->buffer_out) && request->chunked == 0) {
-        /* add extra headers (like content-length/type) if not already present */
+    output = bufferevent_get_output(c->bev);
 
-        if (!evhtp_header_find(request->headers_out, "Content-Length")) {
-            char lstr[128];
-            int  sres;
-#ifndef WIN32
-            sres = snprintf(lstr, sizeof(lstr), "%zu",
-#else
-            sres = snprintf(lstr, sizeof(lstr), "%u",
-#endif
-                            evbuffer_get_length(request->buffer_out));
+    while ((request = TAILQ_FIRST(&c->pending)) != NULL) {
+        if (request->finished == 0 || request->complete == 0) {
+            break;
+        }
 
-            if (sres >= sizeof(lstr) || sres < 0) {
-                /* overflow condition, this should never happen, but if it does,
-                 * well lets just shut the connection down */
+        /*
+         * if there is a set maximum number of keepalive requests configured, check
+         * to make sure we are not over it. If we have gone over the max we set the
+         * keepalive bit to 0, thus closing the connection.
+         */
+        if (c->htp->max_keepalive_requests) {
+            if (++c->num_requests >= c->htp->max_keepalive_requests) {
                 request->keepalive = 0;
-                goto check_proto;
             }
-
-            evhtp_headers_add_header(request->headers_out,
-                                     evhtp_header_new("Content-Length", lstr, 0, 1));
         }
 
-        if (!content_type) {
-            evhtp_headers_add_header(request->headers_out,
-                                     evhtp_header_new("Content-Type", "text/plain", 0, 0));
+        if (request->keepalive == 0) {
+            /* close once the response has been written out */
+            if (evbuffer_get_length(output) == 0) {
+                evhtp_connection_free(c);
+                return -1;
+            }
+
+            return 0;
         }
-    } else {
-        if (!evhtp_header_find(request->headers_out, "Content-Length")) {
-            const char * chunked = evhtp_header_find(request->headers_out,
-                                                     "transfer-encoding");
 
-            if (!chunked || !strstr(chunked, "chunked")) {
-                evhtp_headers_add_header(request->headers_out,
-                                         evhtp_header_new("Content-Length", "0", 0, 0));
-            }
+        TAILQ_REMOVE(&c->pending, request, next);
+        c->num_pending -= 1;
+
+        if (c->request == request) {
+            c->request = NULL;
         }
-    }
 
-check_proto:
-    /* add the proper keep-alive type headers based on http version */
-    switch (request->proto) {
-        case EVHTP_PROTO_11:
-            if (request->keepalive == 0) {
-                /* protocol is HTTP/1.1 but client wanted to close */
-                evhtp_headers_add_header(request->headers_out,
-                                         evhtp_header_new("Connection", "close", 0, 0));
-            }
-            break;
-        case EVHTP_PROTO_10:
-            if (request->keepalive == 1) {
-                /* protocol is HTTP/1.0 and clients wants to keep established */
-                evhtp_headers_add_header(request->headers_out,
-                                         evhtp_header_new("Connection", "keep-alive", 0, 0));
-            }
-            break;
-        default:
-            /* this sometimes happens when a response is made but paused before
-             * the method has been parsed */
-            htparser_set_major(request->conn->parser, 1);
-            htparser_set_minor(request->conn->parser, 0);
-            break;
-    } /* switch */
+        _evhtp_request_free(request);
 
-    /* add the status line */
-    evbuffer_add_printf(buf, "HTTP/%d.%d %d %s\r\n",
-                        htparser_get_major(request->conn->parser),
-                        htparser_get_minor(request->conn->parser),
-                        code, status_code_to_str(code));
+        request = TAILQ_FIRST(&c->pending);
 
-    evhtp_headers_for_each(request->headers_out, _evhtp_create_headers, buf);
-    evbuffer_add(buf, "\r\n", 2);
+        if (request && request->buffer_queued) {
+            evbuffer_add_buffer(output, request->buffer_queued);
+        }
+    }
 
-    if (evbuffer_get_length(request->buffer_out)) {
-        evbuffer_add_buffer(buf, request->buffer_out);
+    if (!(bufferevent_get_enabled(c->bev) & EV_READ) && !_evhtp_connection_stalled(c)) {
+        /* reading stopped on a full pipeline, continue with the rest of the input */
+        evhtp_connection_resume(c);
     }
 
-    return buf;
-}     /* _evhtp_create_reply */
+    return 0;
+} /* _evhtp_connection_advance */
 
 static void
 _evhtp_connection_resumecb(int fd, short events, void * arg) {
@@ -1446,17 +3733,138 @@ _evhtp_connection_resumecb(int fd, short events, void * arg) {
         return;
     }
 
+    if (c->type == evhtp_type_server && _evhtp_connection_advance(c) == -1) {
+        return;
+    }
+
     _evhtp_connection_readcb(c->bev, c);
 }
 
 static void
-_evhtp_connection_readcb(evbev_t * bev, void * arg) {
-    evhtp_connection_t * c = arg;
-    void               * buf;
-    size_t               nread;
-    size_t               avail;
+_evhtp_headers_rebase(evhtp_headers_t * headers, const char * buf, size_t nread, char * copy) {
+    evhtp_header_t * header;
+
+    if (headers == NULL) {
+        return;
+    }
+
+    TAILQ_FOREACH(header, headers, next) {
+        if (!header->k_heaped && header->key >= buf && header->key < buf + nread) {
+            header->key = copy + (header->key - buf);
+        }
+
+        if (!header->v_heaped && header->val >= buf && header->val < buf + nread) {
+            header->val = copy + (header->val - buf);
+        }
+    }
+}
+
+/**
+ * @brief hands the input consumed by the parser over to the last request
+ *        read, so that the headers which reference it in place stay valid for
+ *        as long as the request does. Pipelined requests read in the same pass
+ *        share it, and are always freed before the last one.
+ *
+ *        Segments consumed in full are whole chains of input and are simply
+ *        moved over. Only the consumed part of a segment the parser stopped
+ *        in the middle of is copied.
+ *
+ * @param c
+ * @param input the connection input buffer
+ * @param nread the number of bytes consumed by the parser
+ * @param tail the segment the parser stopped in, if any
+ * @param tail_len the number of bytes consumed from tail, 0 if nread ends on
+ *        a chain boundary
+ *
+ * @return 0 on success, -1 if the input could not be kept
+ */
+static int
+_evhtp_connection_pin_input(evhtp_connection_t * c, evbuf_t * input, size_t nread,
+                            const char * tail, size_t tail_len) {
+    evhtp_request_t * request = c->request;
+    evhtp_request_t * pending;
+    size_t            head    = nread - tail_len;
+    char            * copy;
+
+    if (head > 0) {
+        if (request->buffer_hdrs == NULL) {
+            request->buffer_hdrs = _evhtp_evbuffer_get();
+        }
+
+        if (request->buffer_hdrs == NULL ||
+            evbuffer_remove_buffer(input, request->buffer_hdrs, head) != (int)head) {
+            return -1;
+        }
+    }
+
+    if (tail_len == 0) {
+        return 0;
+    }
+
+    /* the bufferevent does not allow its input to be appended to, so the
+     * unparsed rest of the segment cannot be put back after a move. Instead
+     * make a copy of what was consumed in the arena of the request and point
+     * the headers at it.
+     */
+    if (!(copy = _evhtp_arena_alloc(request->arena, tail_len))) {
+        return -1;
+    }
+
+    memcpy(copy, tail, tail_len);
+
+    if (c->type == evhtp_type_server) {
+        TAILQ_FOREACH(pending, &c->pending, next) {
+            _evhtp_headers_rebase(pending->headers_in, tail, tail_len, copy);
+            _evhtp_headers_rebase(pending->headers_trailer, tail, tail_len, copy);
+        }
+    } else {
+        _evhtp_headers_rebase(request->headers_in, tail, tail_len, copy);
+        _evhtp_headers_rebase(request->headers_trailer, tail, tail_len, copy);
+    }
+
+    evbuffer_drain(input, tail_len);
+
+    return 0;
+} /* _evhtp_connection_pin_input */
+
+/**
+ * @brief removes what the parser consumed from the front of the input,
+ *        keeping it around if headers still reference it.
+ *
+ * @see _evhtp_connection_pin_input()
+ *
+ * @return 0 on success, -1 if the input could not be kept
+ */
+static int
+_evhtp_connection_consume_input(evhtp_connection_t * c, evbuf_t * input, size_t nread,
+                                const char * tail, size_t tail_len) {
+    int res = 0;
+
+    if (c->inbuf_refs == 1 && c->request) {
+        res = _evhtp_connection_pin_input(c, input, nread, tail, tail_len);
+    } else {
+        evbuffer_drain(input, nread);
+    }
+
+    c->inbuf_refs = 0;
+
+    return res;
+}
 
-    avail = evbuffer_get_length(bufferevent_get_input(bev));
+static void
+_evhtp_connection_readcb(evbev_t * bev, void * arg) {
+    evhtp_connection_t  * c     = arg;
+    evbuf_t             * input = bufferevent_get_input(bev);
+    struct evbuffer_ptr   ptr;
+    struct evbuffer_iovec seg   = { NULL, 0 };
+    uint64_t              pending;
+    size_t                avail;
+    size_t                nread = 0;
+    size_t                used  = 0;
+    size_t                len;
+    int                   res;
+
+    avail = evbuffer_get_length(input);
 
     if (c->request) {
         c->request->status = EVHTP_RES_OK;
@@ -1466,20 +3874,83 @@ _evhtp_connection_readcb(evbev_t * bev, void * arg) {
         return;
     }
 
-    buf = evbuffer_pullup(bufferevent_get_input(bev), avail);
+    if (_evhtp_connection_stalled(c)) {
+        bufferevent_disable(bev, EV_READ);
+        return;
+    }
+
+    c->inbuf_refs = 0;
 
+    evbuffer_ptr_set(input, &ptr, 0, EVBUFFER_PTR_SET);
+
+    /*
+     * the input is parsed one chain at a time where it lies, rather than
+     * being pulled up into a single buffer first. nread is the number of bytes
+     * consumed from the front of input so far, used the part of those which
+     * is in a segment the parser did not finish.
+     */
     bufferevent_disable(bev, EV_WRITE);
-    {
-        nread = htparser_run(c->parser, &request_psets, (const char *) buf, avail);
+
+    while (nread < avail) {
+        if (c->request && (pending = htparser_get_body_pending(c->parser)) > 0) {
+            /* body the parser is waiting on is moved over to the request
+             * chain by chain. What was parsed before it ends on a chain
+             * boundary and is moved out of the way first.
+             */
+            if (_evhtp_connection_consume_input(c, input, nread, NULL, 0) == -1) {
+                bufferevent_enable(bev, EV_WRITE);
+                evhtp_connection_free(c);
+                return;
+            }
+
+            avail -= nread;
+            nread  = 0;
+            len    = avail < pending ? avail : (size_t)pending;
+            res    = _evhtp_request_body(c, NULL, input, len);
+
+            if (res == -1 && c->request->status == EVHTP_RES_DATA_TOO_LONG) {
+                break;
+            }
+
+            avail -= len;
+
+            if (htparser_body_consumed(c->parser, &request_psets, len) == -1 || res == -1) {
+                break;
+            }
+
+            evbuffer_ptr_set(input, &ptr, 0, EVBUFFER_PTR_SET);
+            continue;
+        }
+
+        if (evbuffer_peek(input, -1, &ptr, &seg, 1) < 1) {
+            break;
+        }
+
+        c->inbuf     = seg.iov_base;
+        c->inbuf_len = seg.iov_len;
+
+        len          = htparser_run(c->parser, &request_psets, seg.iov_base, seg.iov_len);
+        nread       += len;
+
+        if (len < seg.iov_len) {
+            used = len;
+            break;
+        }
+
+        evbuffer_ptr_set(input, &ptr, len, EVBUFFER_PTR_ADD);
     }
+
     bufferevent_enable(bev, EV_WRITE);
 
+    c->inbuf     = NULL;
+    c->inbuf_len = 0;
+
     if (c->owner != 1) {
         /*
          * someone has taken the ownership of this connection, we still need to
          * drain the input buffer that had been read up to this point.
          */
-        evbuffer_drain(bufferevent_get_input(bev), nread);
+        evbuffer_drain(input, nread);
         evhtp_connection_free(c);
         return;
     }
@@ -1497,12 +3968,28 @@ _evhtp_connection_readcb(evbev_t * bev, void * arg) {
         }
     }
 
-    evbuffer_drain(bufferevent_get_input(bev), nread);
+    if (_evhtp_connection_consume_input(c, input, nread, seg.iov_base, used) == -1) {
+        evhtp_connection_free(c);
+        return;
+    }
 
     if (c->request && c->request->status == EVHTP_RES_PAUSE) {
         evhtp_request_pause(c->request);
+        return;
+    }
+
+    if (_evhtp_connection_stalled(c)) {
+        /* the parser stopped after a complete request, any pipelined input
+         * behind it is parsed once the connection can take it */
+        bufferevent_disable(bev, EV_READ);
     } else if (avail != nread) {
         evhtp_connection_free(c);
+        return;
+    }
+
+    if (c->type == evhtp_type_server) {
+        /* a request may have been answered before it was read in full */
+        _evhtp_connection_advance(c);
     }
 } /* _evhtp_connection_readcb */
 
@@ -1516,58 +4003,15 @@ _evhtp_connection_writecb(evbev_t * bev, void * arg) {
 
     _evhtp_connection_write_hook(c);
 
-    if (c->paused == 1) {
-        return;
-    }
-
-    if (c->request->finished == 0 || evbuffer_get_length(bufferevent_get_output(bev))) {
-        return;
-    }
-
-    /*
-     * if there is a set maximum number of keepalive requests configured, check
-     * to make sure we are not over it. If we have gone over the max we set the
-     * keepalive bit to 0, thus closing the connection.
-     */
-    if (c->htp->max_keepalive_requests) {
-        if (++c->num_requests >= c->htp->max_keepalive_requests) {
-            c->request->keepalive = 0;
-        }
-    }
-
-    if (c->request->keepalive) {
-        _evhtp_request_free(c->request);
-
-        c->request         = NULL;
-        c->body_bytes_read = 0;
-
-        if (c->htp->parent && c->vhost_via_sni == 0) {
-            /* this request was servied by a virtual host evhtp_t structure
-             * which was *NOT* found via SSL SNI lookup. In this case we want to
-             * reset our connections evhtp_t structure back to the original so
-             * that subsequent requests can have a different Host: header.
-             */
-            evhtp_t * orig_htp = c->htp->parent;
-
-            c->htp = orig_htp;
-        }
-
-        htparser_init(c->parser, htp_type_request);
-
-
-        htparser_set_userdata(c->parser, c);
-        return;
-    } else {
-        evhtp_connection_free(c);
-        return;
+    if (c->type == evhtp_type_server) {
+        _evhtp_connection_advance(c);
     }
-
-    return;
-} /* _evhtp_connection_writecb */
+}
 
 static void
 _evhtp_connection_eventcb(evbev_t * bev, short events, void * arg) {
     evhtp_connection_t * c = arg;
+    evhtp_request_t    * request;
 
     if ((events & BEV_EVENT_CONNECTED)) {
         if (c->type == evhtp_type_client) {
@@ -1591,7 +4035,15 @@ _evhtp_connection_eventcb(evbev_t * bev, short events, void * arg) {
 
     c->error = 1;
 
-    if (c->request && c->request->hooks && c->request->hooks->on_error) {
+    if (c->type == evhtp_type_server) {
+        /* every pipelined request still waiting on a response is affected */
+        TAILQ_FOREACH(request, &c->pending, next) {
+            if (request->hooks && request->hooks->on_error) {
+                (*request->hooks->on_error)(request, events,
+                                            request->hooks->on_error_arg);
+            }
+        }
+    } else if (c->request && c->request->hooks && c->request->hooks->on_error) {
         (*c->request->hooks->on_error)(c->request, events,
                                        c->request->hooks->on_error_arg);
     }
@@ -1673,8 +4125,16 @@ end:
 
     evhtp_connection_set_timeouts(connection, c_recv_timeo, c_send_timeo);
 
-    connection->resume_ev = event_new(evbase, -1, EV_READ | EV_PERSIST,
-                                      _evhtp_connection_resumecb, connection);
+    /* allocated here rather than by event_new(), so that a connection in
+     * the pool can be released without touching the base the event was
+     * last set up for, which may be gone by then */
+    if (connection->resume_ev == NULL &&
+        !(connection->resume_ev = malloc(event_get_struct_event_size()))) {
+        return -1;
+    }
+
+    event_assign(connection->resume_ev, evbase, -1, EV_READ | EV_PERSIST,
+                 _evhtp_connection_resumecb, connection);
     event_add(connection->resume_ev, NULL);
 
     bufferevent_enable(connection->bev, EV_READ);
@@ -1691,9 +4151,102 @@ _evhtp_default_request_cb(evhtp_request_t * request, void * arg) {
     evhtp_send_reply(request, EVHTP_RES_NOTFOUND);
 }
 
+/*
+ * Server connections are recycled through a per-thread pool once they are
+ * freed: the structure is kept along with its parser, resume event and
+ * address storage, so that accepting a connection on a thread which has
+ * served others before does not have to allocate any of them.
+ */
+#define EVHTP_CONN_POOL_MAX 64
+
+#ifdef EVHTP_TLS
+static EVHTP_TLS evhtp_connection_t * _evhtp_connection_pool[EVHTP_CONN_POOL_MAX];
+static EVHTP_TLS unsigned int         _evhtp_connection_pool_len = 0;
+#endif
+
+/**
+ * @brief frees what is left of a connection once it has been torn down, or
+ *        taken out of the pool: its parser, resume event and address.
+ */
+static void
+_evhtp_connection_release(evhtp_connection_t * connection) {
+    htparser_free(connection->parser);
+    free(connection->saddr);
+    free(connection->resume_ev);
+    free(connection);
+}
+
+static void
+_evhtp_connection_drain(void) {
+#ifdef EVHTP_TLS
+    while (_evhtp_connection_pool_len) {
+        _evhtp_connection_release(_evhtp_connection_pool[--_evhtp_connection_pool_len]);
+    }
+#endif
+}
+
 static evhtp_connection_t *
-_evhtp_connection_new(evhtp_t * htp, evutil_socket_t sock, evhtp_type type) {
+_evhtp_connection_get(void) {
+#ifdef EVHTP_TLS
     evhtp_connection_t * connection;
+    htparser           * parser;
+    event_t            * resume_ev;
+    struct sockaddr    * saddr;
+
+    if (_evhtp_connection_pool_len == 0) {
+        return NULL;
+    }
+
+    connection = _evhtp_connection_pool[--_evhtp_connection_pool_len];
+    parser     = connection->parser;
+    resume_ev  = connection->resume_ev;
+    saddr      = connection->saddr;
+
+    memset(connection, 0, sizeof(evhtp_connection_t));
+
+    connection->parser    = parser;
+    connection->resume_ev = resume_ev;
+    connection->saddr     = saddr;
+
+    return connection;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * @brief returns a connection, which has been torn down apart from the
+ *        parser, resume event and address storage, to the pool of the
+ *        calling thread.
+ *
+ * @return 0 if the connection was pooled, -1 if the pool is full.
+ */
+static int
+_evhtp_connection_put(evhtp_connection_t * connection) {
+#ifdef EVHTP_TLS
+    if (connection->type != evhtp_type_server ||
+        _evhtp_connection_pool_len == EVHTP_CONN_POOL_MAX) {
+        return -1;
+    }
+
+    if (connection->resume_ev) {
+        event_del(connection->resume_ev);
+    }
+
+    /* hands any scratch buffer the parser holds back */
+    htparser_init(connection->parser, htp_type_request);
+
+    _evhtp_connection_pool[_evhtp_connection_pool_len++] = connection;
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+static evhtp_connection_t *
+_evhtp_connection_new(evhtp_t * htp, evutil_socket_t sock, evhtp_type type) {
+    evhtp_connection_t * connection = NULL;
     htp_type             ptype;
 
     switch (type) {
@@ -1707,8 +4260,26 @@ _evhtp_connection_new(evhtp_t * htp, evutil_socket_t sock, evhtp_type type) {
             return NULL;
     }
 
-    if (!(connection = calloc(sizeof(evhtp_connection_t), 1))) {
-        return NULL;
+    if (type == evhtp_type_server) {
+        connection = _evhtp_connection_get();
+    }
+
+    if (connection == NULL) {
+        if (!(connection = calloc(sizeof(evhtp_connection_t), 1))) {
+            return NULL;
+        }
+
+        if (!(connection->parser = htparser_new())) {
+            free(connection);
+            return NULL;
+        }
+
+        if (type == evhtp_type_server &&
+            !(connection->saddr = malloc(sizeof(struct sockaddr_storage)))) {
+            htparser_free(connection->parser);
+            free(connection);
+            return NULL;
+        }
     }
 
     connection->error  = 0;
@@ -1717,7 +4288,6 @@ _evhtp_connection_new(evhtp_t * htp, evutil_socket_t sock, evhtp_type type) {
     connection->sock   = sock;
     connection->htp    = htp;
     connection->type   = type;
-    connection->parser = htparser_new();
 
     htparser_init(connection->parser, ptype);
     htparser_set_userdata(connection->parser, connection);
@@ -1756,10 +4326,26 @@ _evhtp_run_post_accept(evhtp_t * htp, evhtp_connection_t * connection) {
 }
 
 #ifndef EVHTP_DISABLE_EVTHR
+/**
+ * @brief sets up an accepted socket on a worker thread, arg holds the socket
+ *        itself so that the connection is taken from (and later returned to)
+ *        the pool of the thread which serves it.
+ */
 static void
 _evhtp_run_in_thread(evthr_t * thr, void * arg, void * shared) {
-    evhtp_t            * htp        = shared;
-    evhtp_connection_t * connection = arg;
+    evhtp_t            * htp  = shared;
+    evutil_socket_t      sock = (evutil_socket_t)(intptr_t)arg;
+    evhtp_connection_t * connection;
+    socklen_t            sl   = sizeof(struct sockaddr_storage);
+
+    if (!(connection = _evhtp_connection_new(htp, sock, evhtp_type_server))) {
+        evutil_closesocket(sock);
+        return;
+    }
+
+    if (getpeername(sock, connection->saddr, &sl) < 0) {
+        memset(connection->saddr, 0, sizeof(struct sockaddr_storage));
+    }
 
     connection->evbase = evthr_get_base(thr);
     connection->thread = thr;
@@ -1784,23 +4370,27 @@ _evhtp_accept_cb(evserv_t * serv, int fd, struct sockaddr * s, int sl, void * ar
     evhtp_t            * htp = arg;
     evhtp_connection_t * connection;
 
-    if (!(connection = _evhtp_connection_new(htp, fd, evhtp_type_server))) {
-        return;
-    }
-
-    connection->saddr = malloc(sl);
-    memcpy(connection->saddr, s, sl);
-
 #ifndef EVHTP_DISABLE_EVTHR
     if (htp->thr_pool != NULL) {
-        if (evthr_pool_defer(htp->thr_pool, _evhtp_run_in_thread, connection) != EVTHR_RES_OK) {
-            evutil_closesocket(connection->sock);
-            evhtp_connection_free(connection);
-            return;
+        /* the connection is set up by the thread which ends up serving it */
+        if (evthr_pool_defer(htp->thr_pool, _evhtp_run_in_thread, (void *)(intptr_t)fd) != EVTHR_RES_OK) {
+            evutil_closesocket(fd);
         }
+
         return;
     }
 #endif
+
+    if (!(connection = _evhtp_connection_new(htp, fd, evhtp_type_server))) {
+        evutil_closesocket(fd);
+        return;
+    }
+
+    if ((size_t)sl > sizeof(struct sockaddr_storage)) {
+        sl = sizeof(struct sockaddr_storage);
+    }
+
+    memcpy(connection->saddr, s, sl);
     connection->evbase = htp->evbase;
 
     if (_evhtp_connection_accept(htp->evbase, connection) < 0) {
@@ -2038,34 +4628,517 @@ evhtp_header_val_add(evhtp_headers_t * headers, const char * val, char valloc) {
     return header;
 }
 
-evhtp_kvs_t *
-evhtp_kvs_new(void) {
-    evhtp_kvs_t * kvs = malloc(sizeof(evhtp_kvs_t));
+static const char * _evhtp_header_names[EVHTP_HDR_MAX] = {
+    [EVHTP_HDR_ACCEPT]                           = "Accept",
+    [EVHTP_HDR_ACCEPT_CHARSET]                   = "Accept-Charset",
+    [EVHTP_HDR_ACCEPT_ENCODING]                  = "Accept-Encoding",
+    [EVHTP_HDR_ACCEPT_LANGUAGE]                  = "Accept-Language",
+    [EVHTP_HDR_ACCEPT_RANGES]                    = "Accept-Ranges",
+    [EVHTP_HDR_ACCESS_CONTROL_ALLOW_CREDENTIALS] = "Access-Control-Allow-Credentials",
+    [EVHTP_HDR_ACCESS_CONTROL_ALLOW_HEADERS]     = "Access-Control-Allow-Headers",
+    [EVHTP_HDR_ACCESS_CONTROL_ALLOW_METHODS]     = "Access-Control-Allow-Methods",
+    [EVHTP_HDR_ACCESS_CONTROL_ALLOW_ORIGIN]      = "Access-Control-Allow-Origin",
+    [EVHTP_HDR_ACCESS_CONTROL_EXPOSE_HEADERS]    = "Access-Control-Expose-Headers",
+    [EVHTP_HDR_ACCESS_CONTROL_MAX_AGE]           = "Access-Control-Max-Age",
+    [EVHTP_HDR_ACCESS_CONTROL_REQUEST_HEADERS]   = "Access-Control-Request-Headers",
+    [EVHTP_HDR_ACCESS_CONTROL_REQUEST_METHOD]    = "Access-Control-Request-Method",
+    [EVHTP_HDR_AGE]                              = "Age",
+    [EVHTP_HDR_ALLOW]                            = "Allow",
+    [EVHTP_HDR_AUTHORIZATION]                    = "Authorization",
+    [EVHTP_HDR_CACHE_CONTROL]                    = "Cache-Control",
+    [EVHTP_HDR_CONNECTION]                       = "Connection",
+    [EVHTP_HDR_CONTENT_DISPOSITION]              = "Content-Disposition",
+    [EVHTP_HDR_CONTENT_ENCODING]                 = "Content-Encoding",
+    [EVHTP_HDR_CONTENT_LANGUAGE]                 = "Content-Language",
+    [EVHTP_HDR_CONTENT_LENGTH]                   = "Content-Length",
+    [EVHTP_HDR_CONTENT_LOCATION]                 = "Content-Location",
+    [EVHTP_HDR_CONTENT_RANGE]                    = "Content-Range",
+    [EVHTP_HDR_CONTENT_TYPE]                     = "Content-Type",
+    [EVHTP_HDR_COOKIE]                           = "Cookie",
+    [EVHTP_HDR_DATE]                             = "Date",
+    [EVHTP_HDR_ETAG]                             = "ETag",
+    [EVHTP_HDR_EXPECT]                           = "Expect",
+    [EVHTP_HDR_EXPIRES]                          = "Expires",
+    [EVHTP_HDR_FORWARDED]                        = "Forwarded",
+    [EVHTP_HDR_FROM]                             = "From",
+    [EVHTP_HDR_HOST]                             = "Host",
+    [EVHTP_HDR_IF_MATCH]                         = "If-Match",
+    [EVHTP_HDR_IF_MODIFIED_SINCE]                = "If-Modified-Since",
+    [EVHTP_HDR_IF_NONE_MATCH]                    = "If-None-Match",
+    [EVHTP_HDR_IF_RANGE]                         = "If-Range",
+    [EVHTP_HDR_IF_UNMODIFIED_SINCE]              = "If-Unmodified-Since",
+    [EVHTP_HDR_KEEP_ALIVE]                       = "Keep-Alive",
+    [EVHTP_HDR_LAST_MODIFIED]                    = "Last-Modified",
+    [EVHTP_HDR_LINK]                             = "Link",
+    [EVHTP_HDR_LOCATION]                         = "Location",
+    [EVHTP_HDR_MAX_FORWARDS]                     = "Max-Forwards",
+    [EVHTP_HDR_ORIGIN]                           = "Origin",
+    [EVHTP_HDR_PRAGMA]                           = "Pragma",
+    [EVHTP_HDR_PROXY_AUTHENTICATE]               = "Proxy-Authenticate",
+    [EVHTP_HDR_PROXY_AUTHORIZATION]              = "Proxy-Authorization",
+    [EVHTP_HDR_PROXY_CONNECTION]                 = "Proxy-Connection",
+    [EVHTP_HDR_RANGE]                            = "Range",
+    [EVHTP_HDR_REFERER]                          = "Referer",
+    [EVHTP_HDR_RETRY_AFTER]                      = "Retry-After",
+    [EVHTP_HDR_SERVER]                           = "Server",
+    [EVHTP_HDR_SET_COOKIE]                       = "Set-Cookie",
+    [EVHTP_HDR_STRICT_TRANSPORT_SECURITY]        = "Strict-Transport-Security",
+    [EVHTP_HDR_TE]                               = "TE",
+    [EVHTP_HDR_TRAILER]                          = "Trailer",
+    [EVHTP_HDR_TRANSFER_ENCODING]                = "Transfer-Encoding",
+    [EVHTP_HDR_UPGRADE]                          = "Upgrade",
+    [EVHTP_HDR_USER_AGENT]                       = "User-Agent",
+    [EVHTP_HDR_VARY]                             = "Vary",
+    [EVHTP_HDR_VIA]                              = "Via",
+    [EVHTP_HDR_WWW_AUTHENTICATE]                 = "WWW-Authenticate",
+    [EVHTP_HDR_WARNING]                          = "Warning",
+    [EVHTP_HDR_X_FORWARDED_FOR]                  = "X-Forwarded-For",
+    [EVHTP_HDR_X_FORWARDED_HOST]                 = "X-Forwarded-Host",
+    [EVHTP_HDR_X_FORWARDED_PROTO]                = "X-Forwarded-Proto",
+    [EVHTP_HDR_X_REAL_IP]                        = "X-Real-IP",
+    [EVHTP_HDR_X_REQUESTED_WITH]                 = "X-Requested-With",
+};
+
+/* perfect hash of the lowercased names above, see _evhtp_header_hash() */
+static const uint8_t _evhtp_header_hash_tbl[256] = {
+    [  7] = EVHTP_HDR_X_REAL_IP,
+    [ 13] = EVHTP_HDR_ACCEPT,
+    [ 14] = EVHTP_HDR_IF_RANGE,
+    [ 17] = EVHTP_HDR_HOST,
+    [ 23] = EVHTP_HDR_WWW_AUTHENTICATE,
+    [ 28] = EVHTP_HDR_ACCESS_CONTROL_ALLOW_HEADERS,
+    [ 30] = EVHTP_HDR_TRAILER,
+    [ 42] = EVHTP_HDR_ACCESS_CONTROL_EXPOSE_HEADERS,
+    [ 46] = EVHTP_HDR_CONTENT_LENGTH,
+    [ 49] = EVHTP_HDR_KEEP_ALIVE,
+    [ 57] = EVHTP_HDR_ACCESS_CONTROL_ALLOW_ORIGIN,
+    [ 61] = EVHTP_HDR_FROM,
+    [ 65] = EVHTP_HDR_ACCEPT_RANGES,
+    [ 68] = EVHTP_HDR_IF_MATCH,
+    [ 73] = EVHTP_HDR_RANGE,
+    [ 74] = EVHTP_HDR_UPGRADE,
+    [ 80] = EVHTP_HDR_CONNECTION,
+    [ 82] = EVHTP_HDR_SET_COOKIE,
+    [ 84] = EVHTP_HDR_CONTENT_ENCODING,
+    [ 86] = EVHTP_HDR_PROXY_AUTHORIZATION,
+    [ 87] = EVHTP_HDR_CONTENT_DISPOSITION,
+    [ 91] = EVHTP_HDR_EXPIRES,
+    [ 94] = EVHTP_HDR_X_REQUESTED_WITH,
+    [103] = EVHTP_HDR_TE,
+    [104] = EVHTP_HDR_ORIGIN,
+    [105] = EVHTP_HDR_ACCESS_CONTROL_ALLOW_METHODS,
+    [107] = EVHTP_HDR_VARY,
+    [115] = EVHTP_HDR_ACCESS_CONTROL_REQUEST_HEADERS,
+    [117] = EVHTP_HDR_MAX_FORWARDS,
+    [122] = EVHTP_HDR_USER_AGENT,
+    [125] = EVHTP_HDR_DATE,
+    [126] = EVHTP_HDR_X_FORWARDED_PROTO,
+    [133] = EVHTP_HDR_PRAGMA,
+    [138] = EVHTP_HDR_X_FORWARDED_FOR,
+    [141] = EVHTP_HDR_CACHE_CONTROL,
+    [143] = EVHTP_HDR_ETAG,
+    [146] = EVHTP_HDR_AGE,
+    [152] = EVHTP_HDR_TRANSFER_ENCODING,
+    [158] = EVHTP_HDR_ACCEPT_CHARSET,
+    [159] = EVHTP_HDR_CONTENT_LANGUAGE,
+    [167] = EVHTP_HDR_WARNING,
+    [169] = EVHTP_HDR_ACCEPT_ENCODING,
+    [170] = EVHTP_HDR_ACCESS_CONTROL_MAX_AGE,
+    [189] = EVHTP_HDR_FORWARDED,
+    [194] = EVHTP_HDR_LOCATION,
+    [195] = EVHTP_HDR_PROXY_CONNECTION,
+    [198] = EVHTP_HDR_X_FORWARDED_HOST,
+    [202] = EVHTP_HDR_CONTENT_TYPE,
+    [205] = EVHTP_HDR_ACCESS_CONTROL_REQUEST_METHOD,
+    [206] = EVHTP_HDR_AUTHORIZATION,
+    [209] = EVHTP_HDR_EXPECT,
+    [212] = EVHTP_HDR_LAST_MODIFIED,
+    [213] = EVHTP_HDR_ACCESS_CONTROL_ALLOW_CREDENTIALS,
+    [214] = EVHTP_HDR_CONTENT_RANGE,
+    [218] = EVHTP_HDR_ACCEPT_LANGUAGE,
+    [221] = EVHTP_HDR_SERVER,
+    [222] = EVHTP_HDR_CONTENT_LOCATION,
+    [225] = EVHTP_HDR_COOKIE,
+    [226] = EVHTP_HDR_RETRY_AFTER,
+    [227] = EVHTP_HDR_ALLOW,
+    [229] = EVHTP_HDR_IF_UNMODIFIED_SINCE,
+    [233] = EVHTP_HDR_LINK,
+    [236] = EVHTP_HDR_PROXY_AUTHENTICATE,
+    [238] = EVHTP_HDR_REFERER,
+    [241] = EVHTP_HDR_VIA,
+    [242] = EVHTP_HDR_IF_MODIFIED_SINCE,
+    [246] = EVHTP_HDR_IF_NONE_MATCH,
+    [254] = EVHTP_HDR_STRICT_TRANSPORT_SECURITY,
+};
+
+/**
+ * @brief case-insensitive hash of a key, used by the lookup table of a
+ *        evhtp_kvs_t and folded down for the table of well-known headers.
+ *
+ * @param key
+ * @param len
+ *
+ * @return
+ */
+static inline uint32_t
+_evhtp_kv_hash(const char * key, size_t len) {
+    uint32_t h = 4579;
+    size_t   i;
+
+    for (i = 0; i < len; i++) {
+        h = (h * 33) ^ (uint32_t)(key[i] | 0x20);
+    }
+
+    return h;
+}
+
+static inline uint8_t
+_evhtp_header_hash(const char * key, size_t len) {
+    uint32_t h = _evhtp_kv_hash(key, len);
+
+    return (uint8_t)(h ^ (h >> 8));
+}
+
+evhtp_hdr_id
+evhtp_header_id(const char * key, size_t len) {
+    evhtp_hdr_id id;
+    const char * name;
+
+    if (key == NULL || len == 0) {
+        return EVHTP_HDR_UNKNOWN;
+    }
+
+    id = _evhtp_header_hash_tbl[_evhtp_header_hash(key, len)];
+
+    if (id == EVHTP_HDR_UNKNOWN) {
+        return EVHTP_HDR_UNKNOWN;
+    }
+
+    name = _evhtp_header_names[id];
+
+    if (strncasecmp(name, key, len) || name[len] != '\0') {
+        return EVHTP_HDR_UNKNOWN;
+    }
+
+    return id;
+}
+
+const char *
+evhtp_header_id_name(evhtp_hdr_id id) {
+    if (id <= EVHTP_HDR_UNKNOWN || id >= EVHTP_HDR_MAX) {
+        return NULL;
+    }
+
+    return _evhtp_header_names[id];
+}
+
+/**
+ * @brief an entry of the lookup table of a evhtp_kvs_t, the entries are in
+ *        the same order as the tailq so that the first match is the same kv
+ *        a walk of the tailq would have found.
+ */
+struct evhtp_kv_ent_s {
+    uint32_t     hash;
+    uint32_t     klen;
+    evhtp_kv_t * kv;
+};
+
+/**
+ * @brief the lookup state of a evhtp_kvs_t made by _evhtp_kvs_new(), which
+ *        lives right after it in the same allocation.
+ */
+struct evhtp_kvs_ix_s {
+    evhtp_kv_t           ** index;    /**< first kv per evhtp_hdr_id, NULL if not indexed */
+    evhtp_kv_t            * indexed;  /**< the last kv of the tailq as of the last update of index */
+    struct evhtp_kv_ent_s * ents;     /**< flat lookup table, NULL until the first lookup */
+    uint32_t                nents;
+    uint32_t                ents_cap;
+    evhtp_arena_t         * arena;    /**< where ents is allocated from, NULL if malloc()'d */
+    char                    heaped;   /**< set to 1 if the list can be free()'d, 0 if it belongs to a request */
+};
+
+/**
+ * @brief checks that the id of kv can index the table of a evhtp_kvs_t, kv's
+ *        built by the caller may not have set it.
+ */
+static inline int
+_evhtp_kv_id_valid(evhtp_kv_t * kv) {
+    return kv->id >= EVHTP_HDR_UNKNOWN && kv->id < EVHTP_HDR_MAX;
+}
+
+#define _EVHTP_KVS_IX_MAGIC ((uintptr_t)0x6b767369UL)
+
+static inline uintptr_t
+_evhtp_kvs_ix_check(evhtp_kvs_t * kvs, struct evhtp_kvs_ix_s * ix) {
+    return (uintptr_t)kvs ^ (uintptr_t)ix ^ _EVHTP_KVS_IX_MAGIC;
+}
+
+/**
+ * @brief returns the lookup state of kvs, or NULL for a list the caller set
+ *        up with TAILQ_INIT() (or copied), whose trailing members are not
+ *        ours to trust: the check word ties the state to the address of the
+ *        list it was made for.
+ *
+ * @param kvs
+ *
+ * @return
+ */
+static inline struct evhtp_kvs_ix_s *
+_evhtp_kvs_ix(evhtp_kvs_t * kvs) {
+    if (kvs->ix_check != _evhtp_kvs_ix_check(kvs, kvs->ix)) {
+        return NULL;
+    }
+
+    return kvs->ix;
+}
+
+/**
+ * @brief creates a evhtp_kvs_t, from the arena of a request if one is given
+ *        (released along with the request), otherwise with malloc (released
+ *        by evhtp_kvs_free()).
+ *
+ * @param arena the arena of a request, or NULL
+ * @param indexed if 1, the list also keeps an index of its kv's by
+ *        evhtp_hdr_id, allocated along with it.
+ *
+ * @return
+ */
+static evhtp_kvs_t *
+_evhtp_kvs_new(evhtp_arena_t * arena, int indexed) {
+    evhtp_kvs_t           * kvs;
+    struct evhtp_kvs_ix_s * ix;
+    size_t                  len = sizeof(evhtp_kvs_t) + sizeof(struct evhtp_kvs_ix_s);
+
+    if (indexed) {
+        len += sizeof(evhtp_kv_t *) * EVHTP_HDR_MAX;
+    }
+
+    if (!(kvs = arena ? _evhtp_arena_alloc(arena, len) : malloc(len))) {
+        return NULL;
+    }
+
+    ix           = (struct evhtp_kvs_ix_s *)(kvs + 1);
+    ix->index    = NULL;
+    ix->indexed  = NULL;
+    ix->ents     = NULL;
+    ix->nents    = 0;
+    ix->ents_cap = 0;
+    ix->arena    = arena;
+    ix->heaped   = arena == NULL;
+
+    if (indexed) {
+        ix->index = (evhtp_kv_t **)(ix + 1);
+        memset(ix->index, 0, sizeof(evhtp_kv_t *) * EVHTP_HDR_MAX);
+    }
 
     TAILQ_INIT(kvs);
+    kvs->ix       = ix;
+    kvs->ix_check = _evhtp_kvs_ix_check(kvs, ix);
+
     return kvs;
 }
 
-evhtp_kv_t *
-evhtp_kv_new(const char * key, const char * val, char kalloc, char valloc) {
+evhtp_kvs_t *
+evhtp_kvs_new(void) {
+    return _evhtp_kvs_new(NULL, 0);
+}
+
+/**
+ * @brief makes room for n entries in the lookup table of kvs
+ *
+ * @param kvs
+ * @param n
+ *
+ * @return 0 on success, -1 on error, in which case the table is unchanged
+ */
+static int
+_evhtp_kvs_ents_reserve(struct evhtp_kvs_ix_s * ix, uint32_t n) {
+    struct evhtp_kv_ent_s * ents;
+    uint32_t                cap;
+
+    if (n <= ix->ents_cap) {
+        return 0;
+    }
+
+    cap = ix->ents_cap ? ix->ents_cap : 16;
+
+    while (cap < n) {
+        cap *= 2;
+    }
+
+    if (ix->arena != NULL) {
+        /* the previous table is released along with the arena */
+        if (!(ents = _evhtp_arena_alloc(ix->arena, sizeof(*ents) * cap))) {
+            return -1;
+        }
+
+        if (ix->nents) {
+            memcpy(ents, ix->ents, sizeof(*ents) * ix->nents);
+        }
+    } else if (!(ents = realloc(ix->ents, sizeof(*ents) * cap))) {
+        return -1;
+    }
+
+    ix->ents     = ents;
+    ix->ents_cap = cap;
+
+    return 0;
+}
+
+static inline void
+_evhtp_kvs_ent_set(struct evhtp_kv_ent_s * ent, evhtp_kv_t * kv) {
+    ent->hash = kv->key ? _evhtp_kv_hash(kv->key, kv->klen) : 0;
+    ent->klen = (uint32_t)kv->klen;
+    ent->kv   = kv;
+}
+
+/**
+ * @brief checks whether the lookup table still matches the tailq. This only
+ *        catches the tailq having been appended to directly, which is the
+ *        one change code outside of this file commonly makes.
+ *
+ * @param kvs
+ * @param ix the lookup state of kvs
+ *
+ * @return 1 if the table has to be rebuilt
+ */
+static inline int
+_evhtp_kvs_ents_stale(evhtp_kvs_t * kvs, struct evhtp_kvs_ix_s * ix) {
+    if (ix->nents == 0) {
+        return TAILQ_FIRST(kvs) != NULL;
+    }
+
+    return ix->ents[ix->nents - 1].kv != TAILQ_LAST(kvs, evhtp_kvs_s);
+}
+
+/**
+ * @brief same as _evhtp_kvs_ents_stale() for the index by evhtp_hdr_id
+ */
+static inline int
+_evhtp_kvs_index_stale(evhtp_kvs_t * kvs, struct evhtp_kvs_ix_s * ix) {
+    return ix->indexed != TAILQ_LAST(kvs, evhtp_kvs_s);
+}
+
+/**
+ * @brief rebuilds the index by evhtp_hdr_id, the id of each kv is worked
+ *        out from its key again.
+ */
+static void
+_evhtp_kvs_index_build(evhtp_kvs_t * kvs, struct evhtp_kvs_ix_s * ix) {
+    evhtp_kv_t * kv;
+
+    memset(ix->index, 0, sizeof(evhtp_kv_t *) * EVHTP_HDR_MAX);
+
+    TAILQ_FOREACH(kv, kvs, next) {
+        kv->id = kv->key ? evhtp_header_id(kv->key, kv->klen) : EVHTP_HDR_UNKNOWN;
+
+        if (kv->id != EVHTP_HDR_UNKNOWN && ix->index[kv->id] == NULL) {
+            ix->index[kv->id] = kv;
+        }
+    }
+
+    ix->indexed = TAILQ_LAST(kvs, evhtp_kvs_s);
+}
+
+static int
+_evhtp_kvs_ents_build(evhtp_kvs_t * kvs, struct evhtp_kvs_ix_s * ix) {
+    evhtp_kv_t * kv;
+    uint32_t     n = 0;
+
+    ix->nents = 0;
+
+    TAILQ_FOREACH(kv, kvs, next) {
+        n++;
+    }
+
+    if (_evhtp_kvs_ents_reserve(ix, n) == -1) {
+        return -1;
+    }
+
+    TAILQ_FOREACH(kv, kvs, next) {
+        _evhtp_kvs_ent_set(&ix->ents[ix->nents++], kv);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief finds the first kv of key (case-insensitive), through the lookup
+ *        table, which is (re)built here if needed.
+ *
+ * @param kvs
+ * @param key
+ * @param len the length of key
+ *
+ * @return
+ */
+static evhtp_kv_t *
+_evhtp_kvs_find(evhtp_kvs_t * kvs, const char * key, size_t len) {
+    struct evhtp_kvs_ix_s * ix = _evhtp_kvs_ix(kvs);
+    struct evhtp_kv_ent_s * ent;
+    struct evhtp_kv_ent_s * end;
+    evhtp_kv_t            * kv;
+    uint32_t                hash;
+
+    if (ix == NULL || (_evhtp_kvs_ents_stale(kvs, ix) && _evhtp_kvs_ents_build(kvs, ix) == -1)) {
+        /* a list of the caller's, or no memory for the table: fall back to
+         * walking the tailq */
+        TAILQ_FOREACH(kv, kvs, next) {
+            if (kv->key && kv->klen == len && strncasecmp(kv->key, key, len) == 0) {
+                return kv;
+            }
+        }
+
+        return NULL;
+    }
+
+    hash = _evhtp_kv_hash(key, len);
+    end  = ix->ents + ix->nents;
+
+    for (ent = ix->ents; ent < end; ent++) {
+        if (ent->hash != hash || ent->klen != len) {
+            continue;
+        }
+
+        if (ent->kv->key && strncasecmp(ent->kv->key, key, len) == 0) {
+            return ent->kv;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief creates a evhtp_kv_t, from the arena of a request if one is given,
+ *        in which case the copies of key and val are made there too and
+ *        nothing of it is free()'d by evhtp_kv_free().
+ *
+ * @param arena the arena of a request, or NULL
+ *
+ * @return
+ */
+static evhtp_kv_t *
+_evhtp_kv_new(evhtp_arena_t * arena, const char * key, const char * val, char kalloc, char valloc) {
     evhtp_kv_t * kv;
 
-    if (!(kv = malloc(sizeof(evhtp_kv_t)))) {
+    if (!(kv = arena ? _evhtp_arena_alloc(arena, sizeof(evhtp_kv_t)) : malloc(sizeof(evhtp_kv_t)))) {
         return NULL;
     }
 
-    kv->k_heaped = kalloc;
-    kv->v_heaped = valloc;
+    kv->heaped   = arena == NULL;
+    kv->k_heaped = arena ? 0 : kalloc;
+    kv->v_heaped = arena ? 0 : valloc;
     kv->klen     = 0;
     kv->vlen     = 0;
     kv->key      = NULL;
     kv->val      = NULL;
+    kv->id       = EVHTP_HDR_UNKNOWN;
 
     if (key != NULL) {
         kv->klen = strlen(key);
 
         if (kalloc == 1) {
-            char * s = malloc(kv->klen + 1);
+            char * s = arena ? _evhtp_arena_alloc(arena, kv->klen + 1) : malloc(kv->klen + 1);
 
             s[kv->klen] = '\0';
             memcpy(s, key, kv->klen);
@@ -2079,7 +5152,7 @@ evhtp_kv_new(const char * key, const char * val, char kalloc, char valloc) {
         kv->vlen = strlen(val);
 
         if (valloc == 1) {
-            char * s = malloc(kv->vlen + 1);
+            char * s = arena ? _evhtp_arena_alloc(arena, kv->vlen + 1) : malloc(kv->vlen + 1);
 
             s[kv->vlen] = '\0';
             memcpy(s, val, kv->vlen);
@@ -2090,7 +5163,12 @@ evhtp_kv_new(const char * key, const char * val, char kalloc, char valloc) {
     }
 
     return kv;
-}     /* evhtp_kv_new */
+}     /* _evhtp_kv_new */
+
+evhtp_kv_t *
+evhtp_kv_new(const char * key, const char * val, char kalloc, char valloc) {
+    return _evhtp_kv_new(NULL, key, val, kalloc, valloc);
+}
 
 void
 evhtp_kv_free(evhtp_kv_t * kv) {
@@ -2106,15 +5184,61 @@ evhtp_kv_free(evhtp_kv_t * kv) {
         free(kv->val);
     }
 
-    free(kv);
+    if (kv->heaped) {
+        free(kv);
+    }
 }
 
 void
 evhtp_kv_rm_and_free(evhtp_kvs_t * kvs, evhtp_kv_t * kv) {
+    struct evhtp_kvs_ix_s * ix;
+
     if (kvs == NULL || kv == NULL) {
         return;
     }
 
+    if (!(ix = _evhtp_kvs_ix(kvs))) {
+        TAILQ_REMOVE(kvs, kv, next);
+
+        evhtp_kv_free(kv);
+        return;
+    }
+
+    if (ix->index != NULL && _evhtp_kvs_index_stale(kvs, ix)) {
+        /* left to be rebuilt on the next lookup */
+    } else if (ix->index != NULL && _evhtp_kv_id_valid(kv) && ix->index[kv->id] == kv) {
+        evhtp_kv_t * dup;
+
+        /* the index points at the first kv of an id, so move it to the next
+         * one if there are duplicates */
+        for (dup = TAILQ_NEXT(kv, next); dup != NULL; dup = TAILQ_NEXT(dup, next)) {
+            if (dup->id == kv->id) {
+                break;
+            }
+        }
+
+        ix->index[kv->id] = dup;
+    }
+
+    if (ix->index != NULL && ix->indexed == kv) {
+        ix->indexed = TAILQ_PREV(kv, evhtp_kvs_s, next);
+    }
+
+    if (ix->nents && !_evhtp_kvs_ents_stale(kvs, ix)) {
+        uint32_t i;
+
+        for (i = 0; i < ix->nents; i++) {
+            if (ix->ents[i].kv == kv) {
+                memmove(&ix->ents[i], &ix->ents[i + 1],
+                        sizeof(*ix->ents) * (ix->nents - i - 1));
+                ix->nents--;
+                break;
+            }
+        }
+    } else {
+        ix->nents = 0;
+    }
+
     TAILQ_REMOVE(kvs, kv, next);
 
     evhtp_kv_free(kv);
@@ -2122,8 +5246,9 @@ evhtp_kv_rm_and_free(evhtp_kvs_t * kvs, evhtp_kv_t * kv) {
 
 void
 evhtp_kvs_free(evhtp_kvs_t * kvs) {
-    evhtp_kv_t * kv;
-    evhtp_kv_t * save;
+    struct evhtp_kvs_ix_s * ix;
+    evhtp_kv_t            * kv;
+    evhtp_kv_t            * save;
 
     if (kvs == NULL) {
         return;
@@ -2137,7 +5262,40 @@ evhtp_kvs_free(evhtp_kvs_t * kvs) {
         evhtp_kv_free(kv);
     }
 
-    free(kvs);
+    if (!(ix = _evhtp_kvs_ix(kvs))) {
+        /* a list of the caller's, which evhtp_kvs_free() always released */
+        free(kvs);
+        return;
+    }
+
+    if (ix->arena == NULL) {
+        free(ix->ents);
+    }
+
+    /* the memory may be handed out again, do not leave a valid check word
+     * behind in it */
+    kvs->ix_check = 0;
+
+    if (ix->heaped) {
+        free(kvs);
+    }
+}
+
+void
+evhtp_kvs_reindex(evhtp_kvs_t * kvs) {
+    struct evhtp_kvs_ix_s * ix;
+    evhtp_kv_t            * kv;
+
+    if (kvs == NULL || !(ix = _evhtp_kvs_ix(kvs))) {
+        return;
+    }
+
+    if (ix->index != NULL) {
+        _evhtp_kvs_index_build(kvs, ix);
+    }
+
+    /* rebuilt on the next lookup */
+    ix->nents = 0;
 }
 
 int
@@ -2160,46 +5318,98 @@ evhtp_kvs_for_each(evhtp_kvs_t * kvs, evhtp_kvs_iterator cb, void * arg) {
 }
 
 const char *
-evhtp_kv_find(evhtp_kvs_t * kvs, const char * key) {
+evhtp_kv_find(evhtp_kvs_t * kvs, const char * key) {
+    evhtp_kv_t * kv;
+
+    if (kvs == NULL || key == NULL) {
+        return NULL;
+    }
+
+    if (!(kv = _evhtp_kvs_find(kvs, key, strlen(key)))) {
+        return NULL;
+    }
+
+    return kv->val;
+}
+
+evhtp_kv_t *
+evhtp_kvs_find_kv_id(evhtp_kvs_t * kvs, evhtp_hdr_id id) {
+    struct evhtp_kvs_ix_s * ix;
+    const char            * name;
+
+    if (kvs == NULL || (name = evhtp_header_id_name(id)) == NULL) {
+        return NULL;
+    }
+
+    if ((ix = _evhtp_kvs_ix(kvs)) != NULL && ix->index != NULL) {
+        if (_evhtp_kvs_index_stale(kvs, ix)) {
+            /* kv's were appended to (or removed from) the tailq directly */
+            _evhtp_kvs_index_build(kvs, ix);
+        }
+
+        return ix->index[id];
+    }
+
+    return _evhtp_kvs_find(kvs, name, strlen(name));
+}
+
+const char *
+evhtp_kv_find_id(evhtp_kvs_t * kvs, evhtp_hdr_id id) {
     evhtp_kv_t * kv;
 
-    if (kvs == NULL || key == NULL) {
+    if (!(kv = evhtp_kvs_find_kv_id(kvs, id))) {
         return NULL;
     }
 
-    TAILQ_FOREACH(kv, kvs, next) {
-        if (strcasecmp(kv->key, key) == 0) {
-            return kv->val;
-        }
-    }
-
-    return NULL;
+    return kv->val;
 }
 
 evhtp_kv_t *
 evhtp_kvs_find_kv(evhtp_kvs_t * kvs, const char * key) {
-    evhtp_kv_t * kv;
-
     if (kvs == NULL || key == NULL) {
         return NULL;
     }
 
-    TAILQ_FOREACH(kv, kvs, next) {
-        if (strcasecmp(kv->key, key) == 0) {
-            return kv;
-        }
-    }
-
-    return NULL;
+    return _evhtp_kvs_find(kvs, key, strlen(key));
 }
 
 void
 evhtp_kvs_add_kv(evhtp_kvs_t * kvs, evhtp_kv_t * kv) {
+    struct evhtp_kvs_ix_s * ix;
+    int                     synced;
+
     if (kvs == NULL || kv == NULL) {
         return;
     }
 
+    if (!(ix = _evhtp_kvs_ix(kvs))) {
+        TAILQ_INSERT_TAIL(kvs, kv, next);
+        return;
+    }
+
+    /* only keep the lookup table going once there has been a lookup */
+    synced = ix->ents != NULL && !_evhtp_kvs_ents_stale(kvs, ix);
+
+    if (ix->index != NULL) {
+        if (_evhtp_kvs_index_stale(kvs, ix)) {
+            _evhtp_kvs_index_build(kvs, ix);
+        }
+
+        /* worked out from the key, whatever id the caller may have set */
+        kv->id = kv->key ? evhtp_header_id(kv->key, kv->klen) : EVHTP_HDR_UNKNOWN;
+
+        if (kv->id != EVHTP_HDR_UNKNOWN && ix->index[kv->id] == NULL) {
+            ix->index[kv->id] = kv;
+        }
+
+        ix->indexed = kv;
+    }
+
     TAILQ_INSERT_TAIL(kvs, kv, next);
+
+    if (synced && _evhtp_kvs_ents_reserve(ix, ix->nents + 1) == 0) {
+        _evhtp_kvs_ent_set(&ix->ents[ix->nents++], kv);
+    }
 }
 
 void
@@ -2211,8 +5421,89 @@ evhtp_kvs_add_kvs(evhtp_kvs_t * dst, evhtp_kvs_t * src) {
     evhtp_kv_t * kv;
 
     TAILQ_FOREACH(kv, src, next) {
-        evhtp_kvs_add_kv(dst, evhtp_kv_new(kv->key, kv->val, kv->k_heaped, kv->v_heaped));
+        /* always copy, src may reference memory it does not own */
+        evhtp_kvs_add_kv(dst, evhtp_kv_new(kv->key, kv->val, 1, 1));
+    }
+}
+
+evhtp_header_set_t *
+evhtp_header_set_new(evhtp_headers_t * headers) {
+    evhtp_header_set_t * set;
+    evhtp_header_t     * header;
+    char               * p;
+
+    if (headers == NULL) {
+        return NULL;
+    }
+
+    if (!(set = calloc(sizeof(evhtp_header_set_t), 1))) {
+        return NULL;
+    }
+
+    if (!(set->headers = _evhtp_kvs_new(NULL, 1))) {
+        free(set);
+        return NULL;
+    }
+
+    TAILQ_FOREACH(header, headers, next) {
+        evhtp_header_t * copy;
+
+        if (header->key == NULL || header->val == NULL) {
+            goto error;
+        }
+
+        if (!(copy = evhtp_header_new(header->key, header->val, 1, 1))) {
+            goto error;
+        }
+
+        evhtp_headers_add_header(set->headers, copy);
+
+        switch (copy->id) {
+            case EVHTP_HDR_CONTENT_LENGTH:
+            case EVHTP_HDR_TRANSFER_ENCODING:
+            case EVHTP_HDR_CONNECTION:
+                /* set by each reply */
+                goto error;
+            default:
+                break;
+        }
+
+        set->len += copy->klen + copy->vlen + 4;
+    }
+
+    if (set->len && !(set->buf = malloc(set->len))) {
+        goto error;
+    }
+
+    p = set->buf;
+
+    TAILQ_FOREACH(header, set->headers, next) {
+        memcpy(p, header->key, header->klen);
+        p   += header->klen;
+        *p++ = ':';
+        *p++ = ' ';
+        memcpy(p, header->val, header->vlen);
+        p   += header->vlen;
+        *p++ = '\r';
+        *p++ = '\n';
+    }
+
+    return set;
+error:
+    evhtp_header_set_free(set);
+
+    return NULL;
+} /* evhtp_header_set_new */
+
+void
+evhtp_header_set_free(evhtp_header_set_t * set) {
+    if (set == NULL) {
+        return;
     }
+
+    evhtp_headers_free(set->headers);
+    free(set->buf);
+    free(set);
 }
 
 typedef enum {
@@ -2334,55 +5625,60 @@ evhtp_unescape_string(unsigned char ** out, unsigned char * str, size_t str_len)
     return 0;
 }         /* evhtp_unescape_string */
 
-evhtp_query_t *
-evhtp_parse_query(const char * query, size_t len) {
+/**
+ * @brief parses query arguments, when given the arena of a request the
+ *        arguments and everything they hold are allocated from there.
+ *
+ * @details the keys and values are spans of the query, which are left
+ *          escaped (see evhtp_unescape_string()). They are terminated in
+ *          place in a single copy of the query, so the query is only
+ *          walked once.
+ *
+ * @param arena the arena of a request, or NULL
+ * @param query
+ * @param len
+ *
+ * @return
+ */
+static evhtp_query_t *
+_evhtp_parse_query(evhtp_arena_t * arena, const char * query, size_t len) {
     evhtp_query_t    * query_args;
-    query_parser_state state   = s_query_start;
-    char             * key_buf = NULL;
-    char             * val_buf = NULL;
-    int                key_idx;
-    int                val_idx;
+    evhtp_kv_t       * kv;
+    query_parser_state state = s_query_start;
+    char             * buf;
+    char             * key   = NULL;   /* the start of the current key */
+    char             * val   = NULL;   /* the start of its value, once the '=' is seen */
     unsigned char      ch;
     size_t             i;
 
-    query_args = evhtp_query_new();
-
-    if (!(key_buf = malloc(len + 1))) {
+    if (!(query_args = _evhtp_kvs_new(arena, 0))) {
         return NULL;
     }
 
-    if (!(val_buf = malloc(len + 1))) {
-        free(key_buf);
+    if (!(buf = arena ? _evhtp_arena_alloc(arena, len + 1) : malloc(len + 1))) {
+        evhtp_query_free(query_args);
         return NULL;
     }
 
-    key_idx = 0;
-    val_idx = 0;
+    memcpy(buf, query, len);
+    buf[len] = '\0';
 
     for (i = 0; i < len; i++) {
-        ch = query[i];
-
-        if (key_idx >= len || val_idx >= len) {
-            goto error;
-        }
+        ch = (unsigned char)buf[i];
 
         switch (state) {
             case s_query_start:
-                memset(key_buf, 0, len);
-                memset(val_buf, 0, len);
-
-                key_idx = 0;
-                val_idx = 0;
-
                 switch (ch) {
                     case '?':
                         state = s_query_key;
+                        key   = &buf[i + 1];
                         break;
                     case '/':
                         state = s_query_question_mark;
                         break;
                     default:
                         state = s_query_key;
+                        key   = &buf[i];
                         goto query_key;
                 }
 
@@ -2391,9 +5687,9 @@ evhtp_parse_query(const char * query, size_t len) {
                 switch (ch) {
                     case '?':
                         state = s_query_key;
+                        key   = &buf[i + 1];
                         break;
                     case '/':
-                        state = s_query_question_mark;
                         break;
                     default:
                         goto error;
@@ -2403,37 +5699,28 @@ query_key:
             case s_query_key:
                 switch (ch) {
                     case '=':
-                        state = s_query_val;
+                        buf[i] = '\0';
+                        val    = &buf[i + 1];
+                        state  = s_query_val;
                         break;
                     case '%':
-                        key_buf[key_idx++] = ch;
-                        key_buf[key_idx] = '\0';
-                        state = s_query_key_hex_1;
+                        state  = s_query_key_hex_1;
                         break;
                     default:
-                        key_buf[key_idx++] = ch;
-                        key_buf[key_idx]   = '\0';
                         break;
                 }
                 break;
             case s_query_key_hex_1:
                 if (!evhtp_is_hex_query_char(ch)) {
                     /* not hex, so we treat as a normal key */
-                    if ((key_idx + 2) >= len) {
-                        /* we need to insert \%<ch>, but not enough space */
+                    if ((size_t)(&buf[i] - key) + 2 >= len) {
                         goto error;
                     }
 
-                    key_buf[key_idx - 1] = '%';
-                    key_buf[key_idx++]   = ch;
-                    key_buf[key_idx]     = '\0';
                     state = s_query_key;
                     break;
                 }
 
-                key_buf[key_idx++] = ch;
-                key_buf[key_idx]   = '\0';
-
                 state = s_query_key_hex_2;
                 break;
             case s_query_key_hex_2:
@@ -2441,59 +5728,42 @@ query_key:
                     goto error;
                 }
 
-                key_buf[key_idx++] = ch;
-                key_buf[key_idx]   = '\0';
-
                 state = s_query_key;
                 break;
             case s_query_val:
                 switch (ch) {
                     case ';':
                     case '&':
-                        evhtp_kvs_add_kv(query_args, evhtp_kv_new(key_buf, val_buf, 1, 1));
+                        buf[i] = '\0';
 
-                        memset(key_buf, 0, len);
-                        memset(val_buf, 0, len);
+                        if (!(kv = _evhtp_kv_new(arena, key, val, arena == NULL, arena == NULL))) {
+                            goto error;
+                        }
 
-                        key_idx            = 0;
-                        val_idx            = 0;
-
-                        state              = s_query_key;
+                        evhtp_kvs_add_kv(query_args, kv);
 
+                        key   = &buf[i + 1];
+                        val   = NULL;
+                        state = s_query_key;
                         break;
                     case '%':
-                        val_buf[val_idx++] = ch;
-                        val_buf[val_idx]   = '\0';
-
-                        state              = s_query_val_hex_1;
+                        state = s_query_val_hex_1;
                         break;
                     default:
-                        val_buf[val_idx++] = ch;
-                        val_buf[val_idx]   = '\0';
-
                         break;
                 }     /* switch */
                 break;
             case s_query_val_hex_1:
                 if (!evhtp_is_hex_query_char(ch)) {
                     /* not really a hex val */
-                    if ((val_idx + 2) >= len) {
-                      /* we need to insert \%<ch>, but not enough space */
+                    if ((size_t)(&buf[i] - val) + 2 >= len) {
                         goto error;
                     }
 
-
-                    val_buf[val_idx - 1] = '%';
-                    val_buf[val_idx++]   = ch;
-                    val_buf[val_idx]     = '\0';
-
                     state = s_query_val;
                     break;
                 }
 
-                val_buf[val_idx++] = ch;
-                val_buf[val_idx]   = '\0';
-
                 state = s_query_val_hex_2;
                 break;
             case s_query_val_hex_2:
@@ -2501,9 +5771,6 @@ query_key:
                     goto error;
                 }
 
-                val_buf[val_idx++] = ch;
-                val_buf[val_idx]   = '\0';
-
                 state = s_query_val;
                 break;
             default:
@@ -2512,44 +5779,50 @@ query_key:
         }       /* switch */
     }
 
-    if (key_idx && val_idx) {
-        evhtp_kvs_add_kv(query_args, evhtp_kv_new(key_buf, val_buf, 1, 1));
+    /* the last argument is only taken with both a key and a value */
+    if (key != NULL && *key != '\0' && val != NULL && *val != '\0') {
+        if (!(kv = _evhtp_kv_new(arena, key, val, arena == NULL, arena == NULL))) {
+            goto error;
+        }
+
+        evhtp_kvs_add_kv(query_args, kv);
     }
 
-    free(key_buf);
-    free(val_buf);
+    if (arena == NULL) {
+        free(buf);
+    }
 
     return query_args;
 error:
-    free(key_buf);
-    free(val_buf);
+    if (arena == NULL) {
+        free(buf);
+    }
+
+    evhtp_query_free(query_args);
 
     return NULL;
-}     /* evhtp_parse_query */
+}     /* _evhtp_parse_query */
+
+evhtp_query_t *
+evhtp_parse_query(const char * query, size_t len) {
+    return _evhtp_parse_query(NULL, query, len);
+}
 
 void
 evhtp_send_reply_start(evhtp_request_t * request, evhtp_res code) {
     evhtp_connection_t * c;
-    evbuf_t            * reply_buf;
 
     c = evhtp_request_get_connection(request);
 
-    if (!(reply_buf = _evhtp_create_reply(request, code))) {
+    if (_evhtp_create_reply(request, code, _evhtp_request_output(request)) == -1) {
         evhtp_connection_free(c);
         return;
     }
-
-    bufferevent_write_buffer(c->bev, reply_buf);
-    evbuffer_free(reply_buf);
 }
 
 void
 evhtp_send_reply_body(evhtp_request_t * request, evbuf_t * buf) {
-    evhtp_connection_t * c;
-
-    c = request->conn;
-
-    bufferevent_write_buffer(c->bev, buf);
+    evbuffer_add_buffer(_evhtp_request_output(request), buf);
 }
 
 void
@@ -2562,19 +5835,12 @@ evhtp_send_reply_end(evhtp_request_t * request) {
 
 void
 evhtp_send_reply(evhtp_request_t * request, evhtp_res code) {
-    evhtp_connection_t * c;
-    evbuf_t            * reply_buf;
-
-    c = evhtp_request_get_connection(request);
     request->finished = 1;
 
-    if (!(reply_buf = _evhtp_create_reply(request, code))) {
+    if (_evhtp_create_reply(request, code, _evhtp_request_output(request)) == -1) {
         evhtp_connection_free(request->conn);
         return;
     }
-
-    bufferevent_write_buffer(evhtp_connection_get_bev(c), reply_buf);
-    evbuffer_free(reply_buf);
 }
 
 int
@@ -2612,7 +5878,7 @@ evhtp_send_reply_chunk_start(evhtp_request_t * request, evhtp_res code) {
                 evhtp_kv_rm_and_free(request->headers_out, content_len);
 
                 evhtp_headers_add_header(request->headers_out,
-                                         evhtp_header_new("Content-Length", "0", 0, 0));
+                                         _evhtp_kv_new(request->arena, "Content-Length", "0", 0, 0));
 
                 request->chunked = 1;
                 break;
@@ -2626,7 +5892,7 @@ evhtp_send_reply_chunk_start(evhtp_request_t * request, evhtp_res code) {
 
     if (request->chunked == 1) {
         evhtp_headers_add_header(request->headers_out,
-                                 evhtp_header_new("Transfer-Encoding", "chunked", 0, 0));
+                                 _evhtp_kv_new(request->arena, "Transfer-Encoding", "chunked", 0, 0));
 
         /*
          * if data already exists on the output buffer, we automagically convert
@@ -2658,7 +5924,7 @@ void
 evhtp_send_reply_chunk(evhtp_request_t * request, evbuf_t * buf) {
     evbuf_t * output;
 
-    output = bufferevent_get_output(request->conn->bev);
+    output = _evhtp_request_output(request);
 
     if (evbuffer_get_length(buf) == 0) {
         return;
@@ -2677,8 +5943,7 @@ evhtp_send_reply_chunk(evhtp_request_t * request, evbuf_t * buf) {
 void
 evhtp_send_reply_chunk_end(evhtp_request_t * request) {
     if (request->chunked) {
-        evbuffer_add(bufferevent_get_output(evhtp_request_get_bev(request)),
-                     "0\r\n\r\n", 5);
+        evbuffer_add(_evhtp_request_output(request), "0\r\n\r\n", 5);
     }
 
     evhtp_send_reply_end(request);
@@ -2791,8 +6056,9 @@ evhtp_bind_socket(evhtp_t * htp, const char * baddr, uint16_t port, int backlog)
 
 void
 evhtp_callbacks_free(evhtp_callbacks_t * callbacks) {
-    evhtp_callback_t * callback;
-    evhtp_callback_t * tmp;
+    evhtp_callback_t       * callback;
+    evhtp_callback_t       * tmp;
+    struct evhtp_retired_s * retired;
 
     if (callbacks == NULL) {
         return;
@@ -2804,6 +6070,23 @@ evhtp_callbacks_free(evhtp_callbacks_t * callbacks) {
         evhtp_callback_free(callback);
     }
 
+    _evhtp_route_node_free(callbacks->routes);
+    free(callbacks->exact);
+
+#ifndef EVHTP_DISABLE_REGEX
+    while (callbacks->regex_sets && callbacks->regex_sets->n) {
+        _evhtp_regex_set_free(callbacks->regex_sets->items[--callbacks->regex_sets->n]);
+    }
+#endif
+    free(callbacks->regex_sets);
+    free(callbacks->fallback);
+
+    while ((retired = callbacks->retired) != NULL) {
+        callbacks->retired = retired->next;
+        retired->release(retired->ptr);
+        free(retired);
+    }
+
     free(callbacks);
 }
 
@@ -2833,10 +6116,28 @@ evhtp_callback_new(const char * path, evhtp_callback_type type, evhtp_callback_c
                 free(hcb);
                 return NULL;
             }
+
+            hcb->glob = _evhtp_regex_glob_new(path);
+
+            if (_evhtp_regex_combinable(path)) {
+                /* kept to build the set it may go into */
+                hcb->pattern = strdup(path);
+            }
             break;
 #endif
         case evhtp_callback_type_glob:
-            hcb->val.glob = strdup(path);
+            if (!(hcb->val.glob = strdup(path)) || !(hcb->glob = _evhtp_glob_new(path))) {
+                free(hcb->val.glob);
+                free(hcb);
+                return NULL;
+            }
+            break;
+        case evhtp_callback_type_route:
+            if (!(hcb->val.path = strdup(path)) || !(hcb->route = _evhtp_route_new(hcb->val.path))) {
+                free(hcb->val.path);
+                free(hcb);
+                return NULL;
+            }
             break;
         default:
             free(hcb);
@@ -2854,6 +6155,7 @@ evhtp_callback_free(evhtp_callback_t * callback) {
 
     switch (callback->type) {
         case evhtp_callback_type_hash:
+        case evhtp_callback_type_route:
             free(callback->val.path);
             break;
         case evhtp_callback_type_glob:
@@ -2871,17 +6173,72 @@ evhtp_callback_free(evhtp_callback_t * callback) {
         free(callback->hooks);
     }
 
+    free(callback->route);
+    free(callback->glob);
+    free(callback->pattern);
     free(callback);
 
     return;
 }
 
+void
+evhtp_callback_set_header_set(evhtp_callback_t * callback, evhtp_header_set_t * set) {
+    callback->hdr_set = set;
+}
+
 int
 evhtp_callbacks_add_callback(evhtp_callbacks_t * cbs, evhtp_callback_t * cb) {
-    TAILQ_INSERT_TAIL(cbs, cb, next);
+    if (cbs->last != TAILQ_LAST(cbs, evhtp_callbacks_s)) {
+        /* callbacks were inserted into the tailq directly, which are matched
+         * after the indexed ones, so this one has to come after them too */
+        TAILQ_INSERT_TAIL(cbs, cb, next);
+        return 0;
+    }
+
+    cb->seq = cbs->count;
+
+    if (cb->type == evhtp_callback_type_hash) {
+        evhtp_path_param_t params[EVHTP_PATH_MAX_PARAMS];
+        unsigned int       nparams = 0;
+        unsigned int       soff;
+        unsigned int       eoff;
+
+        /* if a callback before this one takes the path, it never matches */
+        if (_evhtp_callback_find(cbs, cb->val.path, &soff, &eoff, params, &nparams) == NULL &&
+            _evhtp_exact_add(cbs, cb) == -1) {
+            return -1;
+        }
+    } else if (_evhtp_callback_is_routed(cb)) {
+        if (_evhtp_routes_add(cbs, cb) == -1) {
+            return -1;
+        }
+    } else {
+        if (_evhtp_vec_push(cbs, &cbs->fallback, cb) == -1) {
+            return -1;
+        }
+
+#ifndef EVHTP_DISABLE_REGEX
+        if (cb->type == evhtp_callback_type_regex) {
+            _evhtp_regex_sets_add(cbs, cb, cbs->fallback->n - 1);
+        }
+#endif
+    }
+
+    cbs->count++;
+
+    /* TAILQ_INSERT_TAIL(), but storing the link to cb the way the rest of
+     * the index is: a lookup which has not seen cb as the last one indexed
+     * yet may follow it, and then finds cb in the tailq, which is just as
+     * well as nothing before it matched */
+    TAILQ_NEXT(cb, next) = NULL;
+    cb->next.tqe_prev    = cbs->tqh_last;
+    _evhtp_store(cbs->tqh_last, cb);
+    cbs->tqh_last        = &TAILQ_NEXT(cb, next);
+
+    _evhtp_store(&cbs->last, cb);
 
     return 0;
-}
+} /* evhtp_callbacks_add_callback */
 
 int
 evhtp_set_hook(evhtp_hooks_t ** hooks, evhtp_hook_type type, evhtp_hook cb, void * arg) {
@@ -2944,6 +6301,10 @@ evhtp_set_hook(evhtp_hooks_t ** hooks, evhtp_hook_type type, evhtp_hook cb, void
             (*hooks)->on_write = (evhtp_hook_write_cb)cb;
             (*hooks)->on_write_arg           = arg;
             break;
+        case evhtp_hook_on_trailer:
+            (*hooks)->on_trailer             = (evhtp_hook_header_cb)cb;
+            (*hooks)->on_trailer_arg         = arg;
+            break;
         default:
             return -1;
     }     /* switch */
@@ -3012,6 +6373,10 @@ evhtp_unset_all_hooks(evhtp_hooks_t ** hooks) {
         return -1;
     }
 
+    if (evhtp_unset_hook(hooks, evhtp_hook_on_trailer)) {
+        return -1;
+    }
+
     return res;
 } /* evhtp_unset_all_hooks */
 
@@ -3055,6 +6420,11 @@ _evhtp_thread_init(evthr_t * thr, void * arg) {
     }
 }
 
+static void
+_evhtp_thread_exit(evthr_t * thr, void * arg) {
+    evhtp_thread_drain();
+}
+
 int
 evhtp_use_threads(evhtp_t * htp, evhtp_thread_init_cb init_cb, int nthreads, void * arg) {
     htp->thread_init_cb    = init_cb;
@@ -3068,6 +6438,7 @@ evhtp_use_threads(evhtp_t * htp, evhtp_thread_init_cb init_cb, int nthreads, voi
         return -1;
     }
 
+    evthr_pool_set_exit_cb(htp->thr_pool, _evhtp_thread_exit);
     evthr_pool_start(htp->thr_pool);
     return 0;
 }
@@ -3153,6 +6524,36 @@ evhtp_set_glob_cb(evhtp_t * htp, const char * pattern, evhtp_callback_cb cb, voi
     return hcb;
 }
 
+evhtp_callback_t *
+evhtp_set_route_cb(evhtp_t * htp, const char * route, evhtp_callback_cb cb, void * arg) {
+    evhtp_callback_t * hcb;
+
+    _evhtp_lock(htp);
+
+    if (htp->callbacks == NULL) {
+        if (!(htp->callbacks = calloc(sizeof(evhtp_callbacks_t), sizeof(char)))) {
+            _evhtp_unlock(htp);
+            return NULL;
+        }
+
+        TAILQ_INIT(htp->callbacks);
+    }
+
+    if (!(hcb = evhtp_callback_new(route, evhtp_callback_type_route, cb, arg))) {
+        _evhtp_unlock(htp);
+        return NULL;
+    }
+
+    if (evhtp_callbacks_add_callback(htp->callbacks, hcb)) {
+        evhtp_callback_free(hcb);
+        _evhtp_unlock(htp);
+        return NULL;
+    }
+
+    _evhtp_unlock(htp);
+    return hcb;
+}
+
 void
 evhtp_set_gencb(evhtp_t * htp, evhtp_callback_cb cb, void * arg) {
     htp->defaults.cb    = cb;
@@ -3403,22 +6804,91 @@ evhtp_request_set_max_body_size(evhtp_request_t * req, uint64_t len) {
     evhtp_connection_set_max_body_size(req->conn, len);
 }
 
+void
+evhtp_request_set_header_set(evhtp_request_t * request, evhtp_header_set_t * set) {
+    request->hdr_set = set;
+}
+
+/**
+ * @brief the on_read hook set by evhtp_request_set_multipart(), which runs
+ *        the multipart parser over each segment of the body read and then
+ *        drains it.
+ */
+static evhtp_res
+_evhtp_request_multipart_read(evhtp_request_t * req, evbuf_t * buf, void * arg) {
+    struct evbuffer_iovec vec;
+    size_t                nread;
+
+    while (evbuffer_peek(buf, -1, NULL, &vec, 1) > 0) {
+        nread = mpparser_run(req->multipart, req->multipart_hooks, vec.iov_base, vec.iov_len);
+
+        switch (mpparser_get_error(req->multipart)) {
+            case mpparse_error_none:
+                break;
+            case mpparse_error_user:
+                return EVHTP_RES_USER;
+            default:
+                return EVHTP_RES_BADREQ;
+        }
+
+        evbuffer_drain(buf, nread);
+    }
+
+    return EVHTP_RES_OK;
+}
+
+int
+evhtp_request_set_multipart(evhtp_request_t * req, mpparse_hooks * hooks, void * arg) {
+    evhtp_header_t * ctype;
+    const char     * boundary;
+    size_t           len;
+
+    if (!(ctype = evhtp_headers_find_header_id(req->headers_in, EVHTP_HDR_CONTENT_TYPE))) {
+        return -1;
+    }
+
+    if (!(boundary = mpparse_get_boundary(ctype->val, ctype->vlen, &len))) {
+        return -1;
+    }
+
+    if (req->multipart == NULL && !(req->multipart = mpparser_new())) {
+        return -1;
+    }
+
+    if (mpparser_init(req->multipart, boundary, len) == -1) {
+        return -1;
+    }
+
+    mpparser_set_userdata(req->multipart, arg);
+    req->multipart_hooks = hooks;
+
+    return evhtp_set_hook(&req->hooks, evhtp_hook_on_read,
+                          (evhtp_hook)_evhtp_request_multipart_read, NULL);
+}
+
 void
 evhtp_connection_free(evhtp_connection_t * connection) {
+    evhtp_request_t * request;
+
     if (connection == NULL) {
         return;
     }
 
+    /* oldest first, later requests may own input the earlier ones reference */
+    while ((request = TAILQ_FIRST(&connection->pending)) != NULL) {
+        TAILQ_REMOVE(&connection->pending, request, next);
+
+        if (request == connection->request) {
+            connection->request = NULL;
+        }
+
+        _evhtp_request_free(request);
+    }
+
     _evhtp_request_free(connection->request);
     _evhtp_connection_fini_hook(connection);
 
-    free(connection->parser);
     free(connection->hooks);
-    free(connection->saddr);
-
-    if (connection->resume_ev) {
-        event_free(connection->resume_ev);
-    }
 
     if (connection->bev) {
 #ifdef LIBEVENT_HAS_SHUTDOWN
@@ -3440,7 +6910,15 @@ evhtp_connection_free(evhtp_connection_t * connection) {
     }
 #endif
 
-    free(connection);
+    if (_evhtp_connection_put(connection) == 0) {
+        return;
+    }
+
+    if (connection->resume_ev) {
+        event_del(connection->resume_ev);
+    }
+
+    _evhtp_connection_release(connection);
 }     /* evhtp_connection_free */
 
 void
@@ -3464,6 +6942,11 @@ evhtp_set_max_keepalive_requests(evhtp_t * htp, uint64_t num) {
     htp->max_keepalive_requests = num;
 }
 
+void
+evhtp_set_max_pipelined_requests(evhtp_t * htp, uint64_t num) {
+    htp->max_pipelined_requests = num;
+}
+
 /**
  * @brief set bufferevent flags, defaults to BEV_OPT_CLOSE_ON_FREE
  *
@@ -3485,6 +6968,11 @@ evhtp_disable_100_continue(evhtp_t * htp) {
     htp->disable_100_cont = 1;
 }
 
+void
+evhtp_enable_date_header(evhtp_t * htp) {
+    htp->add_date_hdr = 1;
+}
+
 int
 evhtp_add_alias(evhtp_t * evhtp, const char * name) {
     evhtp_alias_t * alias;
@@ -3497,7 +6985,11 @@ evhtp_add_alias(evhtp_t * evhtp, const char * name) {
         return -1;
     }
 
-    alias->alias = strdup(name);
+    if (!(alias->alias = strdup(name)) || !(alias->glob = _evhtp_glob_new(name))) {
+        free(alias->alias);
+        free(alias);
+        return -1;
+    }
 
     TAILQ_INSERT_TAIL(&evhtp->aliases, alias, next);
 
@@ -3535,6 +7027,12 @@ evhtp_add_vhost(evhtp_t * evhtp, const char * name, evhtp_t * vhost) {
         return -1;
     }
 
+    if (!(vhost->server_glob = _evhtp_glob_new(name))) {
+        free(vhost->server_name);
+        vhost->server_name = NULL;
+        return -1;
+    }
+
     /* set the parent of this vhost so when the request has been completely
      * serviced, the vhost can be reset to the original evhtp structure.
      *
@@ -3547,6 +7045,7 @@ evhtp_add_vhost(evhtp_t * evhtp, const char * name, evhtp_t * vhost) {
     vhost->bev_flags              = evhtp->bev_flags;
     vhost->max_body_size          = evhtp->max_body_size;
     vhost->max_keepalive_requests = evhtp->max_keepalive_requests;
+    vhost->max_pipelined_requests = evhtp->max_pipelined_requests;
     vhost->recv_timeo             = evhtp->recv_timeo;
     vhost->send_timeo             = evhtp->send_timeo;
 
@@ -3567,12 +7066,13 @@ evhtp_new(evbase_t * evbase, void * arg) {
         return NULL;
     }
 
-    status_code_init();
 
     htp->arg       = arg;
     htp->evbase    = evbase;
     htp->bev_flags = BEV_OPT_CLOSE_ON_FREE;
 
+    evhtp_set_max_pipelined_requests(htp, 16);
+
     TAILQ_INIT(&htp->vhosts);
     TAILQ_INIT(&htp->aliases);
 
@@ -3598,6 +7098,8 @@ evhtp_free(evhtp_t * evhtp) {
         free(evhtp->server_name);
     }
 
+    free(evhtp->server_glob);
+
     if (evhtp->callbacks) {
         evhtp_callbacks_free(evhtp->callbacks);
     }
@@ -3606,13 +7108,24 @@ evhtp_free(evhtp_t * evhtp) {
         if (evhtp_alias->alias != NULL) {
             free(evhtp_alias->alias);
         }
+        free(evhtp_alias->glob);
         TAILQ_REMOVE(&evhtp->aliases, evhtp_alias, next);
         free(evhtp_alias);
     }
 
+    evhtp_thread_drain();
+
     free(evhtp);
 }
 
+void
+evhtp_thread_drain(void) {
+    _evhtp_connection_drain();
+    _evhtp_arena_drain();
+    _evhtp_evbuffer_drain();
+    htparser_pool_drain();
+}
+
 /*****************************************************************
 * client request functions                                      *
 *****************************************************************/
@@ -6,6 +6,7 @@
 #endif
 
 #include <htparse.h>
+#include <mpparse.h>
 
 #include <sys/queue.h>
 #include <event2/event.h>
@@ -55,13 +56,18 @@ typedef struct evhtp_s            evhtp_t;
 typedef struct evhtp_defaults_s   evhtp_defaults_t;
 typedef struct evhtp_callbacks_s  evhtp_callbacks_t;
 typedef struct evhtp_callback_s   evhtp_callback_t;
+typedef struct evhtp_route_s      evhtp_route_t;
+typedef struct evhtp_glob_s       evhtp_glob_t;
 typedef struct evhtp_defaults_s   evhtp_defaults_5;
 typedef struct evhtp_kv_s         evhtp_kv_t;
 typedef struct evhtp_kvs_s        evhtp_kvs_t;
+typedef struct evhtp_header_set_s evhtp_header_set_t;
 typedef struct evhtp_uri_s        evhtp_uri_t;
 typedef struct evhtp_path_s       evhtp_path_t;
+typedef struct evhtp_path_param_s evhtp_path_param_t;
 typedef struct evhtp_authority_s  evhtp_authority_t;
 typedef struct evhtp_request_s    evhtp_request_t;
+typedef struct evhtp_arena_s      evhtp_arena_t;
 typedef struct evhtp_hooks_s      evhtp_hooks_t;
 typedef struct evhtp_connection_s evhtp_connection_t;
 typedef struct evhtp_ssl_cfg_s    evhtp_ssl_cfg_t;
@@ -102,7 +108,8 @@ enum evhtp_hook_type {
     evhtp_hook_on_headers_start,
     evhtp_hook_on_error,        /**< type which defines to hook whenever an error occurs */
     evhtp_hook_on_hostname,
-    evhtp_hook_on_write
+    evhtp_hook_on_write,
+    evhtp_hook_on_trailer       /**< type which defines to hook after one trailer of a chunked body has been parsed */
 };
 
 enum evhtp_callback_type {
@@ -110,7 +117,8 @@ enum evhtp_callback_type {
 #ifndef EVHTP_DISABLE_REGEX
     evhtp_callback_type_regex,
 #endif
-    evhtp_callback_type_glob
+    evhtp_callback_type_glob,
+    evhtp_callback_type_route
 };
 
 enum evhtp_proto {
@@ -124,11 +132,90 @@ enum evhtp_type {
     evhtp_type_server
 };
 
+/**
+ * @brief well-known header names, assigned to each evhtp_header_t added to
+ *        a request so they can be looked up with evhtp_header_find_id()
+ *        instead of comparing strings.
+ */
+enum evhtp_hdr_id {
+    EVHTP_HDR_UNKNOWN = 0,
+    EVHTP_HDR_ACCEPT,
+    EVHTP_HDR_ACCEPT_CHARSET,
+    EVHTP_HDR_ACCEPT_ENCODING,
+    EVHTP_HDR_ACCEPT_LANGUAGE,
+    EVHTP_HDR_ACCEPT_RANGES,
+    EVHTP_HDR_ACCESS_CONTROL_ALLOW_CREDENTIALS,
+    EVHTP_HDR_ACCESS_CONTROL_ALLOW_HEADERS,
+    EVHTP_HDR_ACCESS_CONTROL_ALLOW_METHODS,
+    EVHTP_HDR_ACCESS_CONTROL_ALLOW_ORIGIN,
+    EVHTP_HDR_ACCESS_CONTROL_EXPOSE_HEADERS,
+    EVHTP_HDR_ACCESS_CONTROL_MAX_AGE,
+    EVHTP_HDR_ACCESS_CONTROL_REQUEST_HEADERS,
+    EVHTP_HDR_ACCESS_CONTROL_REQUEST_METHOD,
+    EVHTP_HDR_AGE,
+    EVHTP_HDR_ALLOW,
+    EVHTP_HDR_AUTHORIZATION,
+    EVHTP_HDR_CACHE_CONTROL,
+    EVHTP_HDR_CONNECTION,
+    EVHTP_HDR_CONTENT_DISPOSITION,
+    EVHTP_HDR_CONTENT_ENCODING,
+    EVHTP_HDR_CONTENT_LANGUAGE,
+    EVHTP_HDR_CONTENT_LENGTH,
+    EVHTP_HDR_CONTENT_LOCATION,
+    EVHTP_HDR_CONTENT_RANGE,
+    EVHTP_HDR_CONTENT_TYPE,
+    EVHTP_HDR_COOKIE,
+    EVHTP_HDR_DATE,
+    EVHTP_HDR_ETAG,
+    EVHTP_HDR_EXPECT,
+    EVHTP_HDR_EXPIRES,
+    EVHTP_HDR_FORWARDED,
+    EVHTP_HDR_FROM,
+    EVHTP_HDR_HOST,
+    EVHTP_HDR_IF_MATCH,
+    EVHTP_HDR_IF_MODIFIED_SINCE,
+    EVHTP_HDR_IF_NONE_MATCH,
+    EVHTP_HDR_IF_RANGE,
+    EVHTP_HDR_IF_UNMODIFIED_SINCE,
+    EVHTP_HDR_KEEP_ALIVE,
+    EVHTP_HDR_LAST_MODIFIED,
+    EVHTP_HDR_LINK,
+    EVHTP_HDR_LOCATION,
+    EVHTP_HDR_MAX_FORWARDS,
+    EVHTP_HDR_ORIGIN,
+    EVHTP_HDR_PRAGMA,
+    EVHTP_HDR_PROXY_AUTHENTICATE,
+    EVHTP_HDR_PROXY_AUTHORIZATION,
+    EVHTP_HDR_PROXY_CONNECTION,
+    EVHTP_HDR_RANGE,
+    EVHTP_HDR_REFERER,
+    EVHTP_HDR_RETRY_AFTER,
+    EVHTP_HDR_SERVER,
+    EVHTP_HDR_SET_COOKIE,
+    EVHTP_HDR_STRICT_TRANSPORT_SECURITY,
+    EVHTP_HDR_TE,
+    EVHTP_HDR_TRAILER,
+    EVHTP_HDR_TRANSFER_ENCODING,
+    EVHTP_HDR_UPGRADE,
+    EVHTP_HDR_USER_AGENT,
+    EVHTP_HDR_VARY,
+    EVHTP_HDR_VIA,
+    EVHTP_HDR_WWW_AUTHENTICATE,
+    EVHTP_HDR_WARNING,
+    EVHTP_HDR_X_FORWARDED_FOR,
+    EVHTP_HDR_X_FORWARDED_HOST,
+    EVHTP_HDR_X_FORWARDED_PROTO,
+    EVHTP_HDR_X_REAL_IP,
+    EVHTP_HDR_X_REQUESTED_WITH,
+    EVHTP_HDR_MAX
+};
+
 typedef enum evhtp_hook_type       evhtp_hook_type;
 typedef enum evhtp_callback_type   evhtp_callback_type;
 typedef enum evhtp_proto           evhtp_proto;
 typedef enum evhtp_ssl_scache_type evhtp_ssl_scache_type;
 typedef enum evhtp_type            evhtp_type;
+typedef enum evhtp_hdr_id          evhtp_hdr_id;
 
 typedef void (*evhtp_thread_init_cb)(evhtp_t * htp, evthr_t * thr, void * arg);
 typedef void (*evhtp_callback_cb)(evhtp_request_t * req, void * arg);
@@ -243,7 +330,8 @@ struct evhtp_defaults_s {
 };
 
 struct evhtp_alias_s {
-    char * alias;
+    char         * alias;
+    evhtp_glob_t * glob;  /**< the compiled alias */
 
     TAILQ_ENTRY(evhtp_alias_s) next;
 };
@@ -252,15 +340,18 @@ struct evhtp_alias_s {
  * @brief main structure containing all configuration information
  */
 struct evhtp_s {
-    evhtp_t  * parent;           /**< only when this is a vhost */
-    evbase_t * evbase;           /**< the initialized event_base */
-    evserv_t * server;           /**< the libevent listener struct */
-    char     * server_name;      /**< the name included in Host: responses */
-    void     * arg;              /**< user-defined evhtp_t specific arguments */
-    int        bev_flags;        /**< bufferevent flags to use on bufferevent_*_socket_new() */
-    uint64_t   max_body_size;
-    uint64_t   max_keepalive_requests;
-    int        disable_100_cont; /**< if set, evhtp will not respond to Expect: 100-continue */
+    evhtp_t      * parent;           /**< only when this is a vhost */
+    evbase_t     * evbase;           /**< the initialized event_base */
+    evserv_t     * server;           /**< the libevent listener struct */
+    char         * server_name;      /**< the name included in Host: responses */
+    evhtp_glob_t * server_glob;      /**< the compiled server_name of a vhost */
+    void         * arg;              /**< user-defined evhtp_t specific arguments */
+    int            bev_flags;        /**< bufferevent flags to use on bufferevent_*_socket_new() */
+    uint64_t       max_body_size;
+    uint64_t       max_keepalive_requests;
+    uint64_t       max_pipelined_requests;
+    int            disable_100_cont; /**< if set, evhtp will not respond to Expect: 100-continue */
+    int            add_date_hdr;     /**< if set, a Date: header is added to responses lacking one */
 
 #ifndef DISABLE_SSL
     evhtp_ssl_ctx_t * ssl_ctx;   /**< if ssl enabled, this is the servers CTX */
@@ -305,11 +396,16 @@ struct evhtp_s {
 typedef struct regex_t;
 #endif
 struct evhtp_callback_s {
-    evhtp_callback_type type;           /**< the type of callback (regex|path) */
-    evhtp_callback_cb   cb;             /**< the actual callback function */
-    unsigned int        hash;           /**< the full hash generated integer */
-    void              * cbarg;          /**< user-defind arguments passed to the cb */
-    evhtp_hooks_t     * hooks;          /**< per-callback hooks */
+    evhtp_callback_type  type;          /**< the type of callback (regex|path) */
+    evhtp_callback_cb    cb;            /**< the actual callback function */
+    unsigned int         hash;          /**< the full hash generated integer */
+    void               * cbarg;         /**< user-defind arguments passed to the cb */
+    evhtp_hooks_t      * hooks;         /**< per-callback hooks */
+    evhtp_header_set_t * hdr_set;       /**< headers written by every reply, see evhtp_callback_set_header_set() */
+    unsigned int         seq;           /**< position in the list, the first matching callback wins */
+    evhtp_route_t      * route;         /**< the parameters of a route callback */
+    evhtp_glob_t       * glob;          /**< the compiled val.glob, or the prefilter of a regex */
+    char               * pattern;       /**< the source of a regex which may be combined with others */
 
     union {
         char * path;
@@ -322,7 +418,31 @@ struct evhtp_callback_s {
     TAILQ_ENTRY(evhtp_callback_s) next;
 };
 
-TAILQ_HEAD(evhtp_callbacks_s, evhtp_callback_s);
+/**
+ * @brief the list of callbacks of a evhtp_t. The first two members are those
+ *        of TAILQ_HEAD().
+ *
+ *        Callbacks added with evhtp_callbacks_add_callback() (which all of
+ *        the evhtp_set_*cb() functions use) are also indexed so that a path
+ *        is not tried against each of them in turn: exact paths go into a
+ *        hash table, globs and routes into a radix tree, and regular
+ *        expressions into a fallback list which is walked in order, runs
+ *        of anchored ones being searched as one. Callbacks inserted into
+ *        the tailq directly are still matched, after all of the indexed
+ *        ones. Callbacks may be added by one thread at a time while other
+ *        threads look paths up.
+ */
+struct evhtp_callbacks_s {
+    struct evhtp_callback_s     * tqh_first;
+    struct evhtp_callback_s    ** tqh_last;
+    struct evhtp_exact_s        * exact;        /**< open addressing table of the exact path callbacks */
+    struct evhtp_route_node_s   * routes;       /**< radix tree of the prefix and route callbacks */
+    struct evhtp_vec_s          * fallback;     /**< the other callbacks, in list order */
+    struct evhtp_vec_s          * regex_sets;   /**< runs of the fallback list searched as one regex */
+    unsigned int                  count;        /**< the number of callbacks indexed */
+    struct evhtp_callback_s     * last;         /**< the last callback indexed */
+    struct evhtp_retired_s      * retired;      /**< replaced parts of the index, freed along with it */
+};
 
 /**
  * @brief a generic key/value structure
@@ -336,24 +456,75 @@ struct evhtp_kv_s {
 
     char k_heaped; /**< set to 1 if the key can be free()'d */
     char v_heaped; /**< set to 1 if the val can be free()'d */
+    char heaped;   /**< set to 1 if the kv itself can be free()'d, 0 if it belongs to a request */
+
+    evhtp_hdr_id id; /**< well-known header id, worked out from key once added to an indexed evhtp_kvs_t */
 
     TAILQ_ENTRY(evhtp_kv_s) next;
 };
 
-TAILQ_HEAD(evhtp_kvs_s, evhtp_kv_s);
+struct evhtp_kvs_ix_s;
+
+/**
+ * @brief a tailq of key/value structures. The first two members are those of
+ *        TAILQ_HEAD(), so a list set up with TAILQ_INIT() by the caller is
+ *        still a valid evhtp_kvs_t: it is simply searched by walking it.
+ *
+ *        Lists made by evhtp_kvs_new() and by the library (request headers,
+ *        query args) carry private lookup state: lookups by name scan a flat
+ *        array of (hash, key length, kv) records in list order which is built
+ *        on the first lookup and kept up to date by the evhtp_kvs_* /
+ *        evhtp_kv_* functions, and request headers are indexed by
+ *        evhtp_hdr_id. Appending with TAILQ_INSERT_TAIL() is picked up on the
+ *        next lookup, by name or by id; any other change made to the tailq
+ *        directly must be followed by evhtp_kvs_reindex().
+ *
+ *        Note that the two trailing members make this struct larger than
+ *        TAILQ_HEAD(), which is an ABI change from 1.2.5: code allocating it
+ *        itself has to be rebuilt against this header.
+ */
+struct evhtp_kvs_s {
+    struct evhtp_kv_s     * tqh_first;
+    struct evhtp_kv_s    ** tqh_last;
+    struct evhtp_kvs_ix_s * ix;       /**< private lookup state, only used if ix_check matches */
+    uintptr_t               ix_check;
+};
+
+/**
+ * @brief iterates over a evhtp_kvs_t, for code which used TAILQ_FOREACH()
+ *        on it directly.
+ */
+#define evhtp_kvs_foreach(kv, kvs) \
+    for ((kv) = TAILQ_FIRST(kvs); (kv) != NULL; (kv) = TAILQ_NEXT((kv), next))
+
+/**
+ * @brief a set of response headers which is serialized once and written out
+ *        as-is by every reply it is attached to, see evhtp_header_set_new()
+ */
+struct evhtp_header_set_s {
+    evhtp_headers_t * headers; /**< an indexed copy of the headers, for lookups on reply */
+    char            * buf;     /**< the headers as written on the wire */
+    size_t            len;
+};
 
 
 
 /**
  * @brief a generic container representing an entire URI strucutre
+ *
+ * The query is parsed on first use by evhtp_uri_get_query(). Unless built
+ * with EVHTP_DISABLE_URI_COMPAT, evhtp parses it while reading the request
+ * so that the query field can be read directly as before.
  */
 struct evhtp_uri_s {
     evhtp_authority_t * authority;
     evhtp_path_t      * path;
-    unsigned char     * fragment;     /**< data after '#' in uri */
-    unsigned char     * query_raw;    /**< the unparsed query arguments */
-    evhtp_query_t     * query;        /**< list of k/v for query arguments */
-    htp_scheme          scheme;       /**< set if a scheme is found */
+    unsigned char     * fragment;      /**< data after '#' in uri */
+    unsigned char     * query_raw;     /**< the unparsed query arguments */
+    evhtp_query_t     * query;         /**< list of k/v for query arguments */
+    htp_scheme          scheme;        /**< set if a scheme is found */
+    size_t              query_raw_len; /**< the length of query_raw */
+    evhtp_arena_t     * arena;         /**< where the query is parsed to */
 };
 
 
@@ -368,42 +539,81 @@ struct evhtp_authority_s {
 };
 
 
+#define EVHTP_PATH_MAX_PARAMS 8
+
+/**
+ * @brief a parameter of a route callback (:name or *name), see
+ *        evhtp_set_route_cb()
+ */
+struct evhtp_path_param_s {
+    const char * name;                /**< the name in the route, not null terminated */
+    size_t       name_len;
+    const char * val;                 /**< the part of the path matched, not null terminated */
+    size_t       val_len;
+};
+
 /**
  * @brief structure which represents a URI path and or file
+ *
+ * The path is kept as a single copy of the URI (full), file and match_end
+ * point into it. path and match_start need copies of their own, which are
+ * made on first use by evhtp_path_get_path() and
+ * evhtp_path_get_match_start(). Unless built with EVHTP_DISABLE_URI_COMPAT,
+ * evhtp makes them before calling any handler so that the fields can be
+ * read directly as before.
  */
 struct evhtp_path_s {
-    char       * full;                /**< the full path+file (/a/b/c.html) */
-    char       * path;                /**< the path (/a/b/) */
-    char       * file;                /**< the filename if present (c.html) */
-    char       * match_start;
-    char       * match_end;
-    unsigned int matched_soff;        /**< offset of where the uri starts
-                                       *   mainly used for regex matching
-                                       */
-    unsigned int matched_eoff;        /**< offset of where the uri ends
-                                       *   mainly used for regex matching
-                                       */
+    char               * full;            /**< the full path+file (/a/b/c.html) */
+    char               * path;            /**< the path (/a/b/) */
+    char               * file;            /**< the filename if present (c.html) */
+    char               * match_start;
+    char               * match_end;
+    unsigned int         matched_soff;    /**< offset of where the uri starts
+                                           *   mainly used for regex matching
+                                           */
+    unsigned int         matched_eoff;    /**< offset of where the uri ends
+                                           *   mainly used for regex matching
+                                           */
+    unsigned int         len;             /**< the length of full */
+    unsigned int         path_len;        /**< the length of path, a prefix of full if full starts with a "/" */
+    evhtp_arena_t      * arena;           /**< where path and match_start are copied to */
+    unsigned int         nparams;         /**< the number of params, set when a route callback matched */
+    evhtp_path_param_t   params[EVHTP_PATH_MAX_PARAMS];
 };
 
 
 /**
  * @brief a structure containing all information for a http request.
+ *
+ * The request, and everything evhtp allocates on its behalf (uri, path,
+ * query and header lists), is carved out of a single arena which is
+ * released by evhtp_request_free(). None of it can be kept after the
+ * request is gone, copy what is needed. Headers added by the application
+ * with evhtp_header_new() are free()'d along with the request, as before.
  */
 struct evhtp_request_s {
+    evhtp_arena_t      * arena;       /**< backs the request itself and its parsed data */
     evhtp_t            * htp;         /**< the parent evhtp_t structure */
     evhtp_connection_t * conn;        /**< the associated connection */
     evhtp_hooks_t      * hooks;       /**< request specific hooks */
     evhtp_uri_t        * uri;         /**< request URI information */
     evbuf_t            * buffer_in;   /**< buffer containing data from client */
     evbuf_t            * buffer_out;  /**< buffer containing data to client */
+    evbuf_t            * buffer_hdrs; /**< consumed input which headers_in reference */
+    evbuf_t            * buffer_queued; /**< response held back until earlier pipelined requests are answered */
     evhtp_headers_t    * headers_in;  /**< headers from client */
     evhtp_headers_t    * headers_out; /**< headers to client */
+    evhtp_headers_t    * headers_trailer; /**< trailers from client, NULL unless the body was chunked */
+    evhtp_header_set_t * hdr_set;     /**< written before headers_out, see evhtp_request_set_header_set() */
     evhtp_proto          proto;       /**< HTTP protocol used */
     htp_method           method;      /**< HTTP method used */
     evhtp_res            status;      /**< The HTTP response code or other error conditions */
     int                  keepalive;   /**< set to 1 if the connection is keep-alive */
     int                  finished;    /**< set to 1 if the request is fully processed */
+    int                  complete;    /**< set to 1 once the whole request has been read */
     int                  chunked;     /**< set to 1 if the request is chunked */
+    mpparser           * multipart;   /**< body parser, see evhtp_request_set_multipart() */
+    mpparse_hooks      * multipart_hooks;
 
     evhtp_callback_cb cb;             /**< the function to call when fully processed */
     void            * cbarg;          /**< argument which is passed to the cb function */
@@ -434,11 +644,15 @@ struct evhtp_connection_s {
     uint64_t          max_body_size;
     uint64_t          body_bytes_read;
     uint64_t          num_requests;
+    uint64_t          num_pending;         /**< number of requests in pending */
     evhtp_type        type;                /**< server or client */
     char              paused;
     char              free_connection;
+    const char      * inbuf;               /**< input being parsed, only valid within htparser_run() */
+    size_t            inbuf_len;
+    uint8_t           inbuf_refs;          /**< set to 1 if headers reference inbuf in place */
 
-    TAILQ_HEAD(, evhtp_request_s) pending; /**< client pending data */
+    TAILQ_HEAD(, evhtp_request_s) pending; /**< server requests waiting on a response, in the order received */
 };
 
 struct evhtp_hooks_s {
@@ -455,6 +669,7 @@ struct evhtp_hooks_s {
     evhtp_hook_chunks_fini_cb     on_chunks_fini;
     evhtp_hook_hostname_cb        on_hostname;
     evhtp_hook_write_cb           on_write;
+    evhtp_hook_header_cb          on_trailer;
 
     void * on_headers_start_arg;
     void * on_header_arg;
@@ -469,6 +684,7 @@ struct evhtp_hooks_s {
     void * on_chunks_fini_arg;
     void * on_hostname_arg;
     void * on_write_arg;
+    void * on_trailer_arg;
 };
 
 struct evhtp_ssl_cfg_s {
@@ -506,6 +722,14 @@ struct evhtp_ssl_cfg_s {
 evhtp_t * evhtp_new(evbase_t * evbase, void * arg);
 void      evhtp_free(evhtp_t * evhtp);
 
+/**
+ * @brief releases what the calling thread keeps cached for the requests to
+ *        come (arenas, evbuffers, parser blocks). Done by evhtp_free() and
+ *        by the threads of evhtp_use_threads() on exit; a thread of the
+ *        application's own which ran evhtp should call it before exiting.
+ */
+void evhtp_thread_drain(void);
+
 
 /**
  * @brief set a read/write timeout on all things evhtp_t. When the timeout
@@ -530,6 +754,14 @@ int  evhtp_ssl_init(evhtp_t * htp, evhtp_ssl_cfg_t * ssl_cfg);
  */
 void evhtp_disable_100_continue(evhtp_t * htp);
 
+/**
+ * @brief adds a Date: header to every response which does not already have
+ *        one. The value is formatted at most once a second per thread.
+ *
+ * @param htp
+ */
+void evhtp_enable_date_header(evhtp_t * htp);
+
 /**
  * @brief creates a lock around callbacks and hooks, allowing for threaded
  * applications to add/remove/modify hooks & callbacks in a thread-safe manner.
@@ -595,6 +827,26 @@ evhtp_callback_t * evhtp_set_regex_cb(evhtp_t * htp, const char * pattern, evhtp
  */
 evhtp_callback_t * evhtp_set_glob_cb(evhtp_t * htp, const char * pattern, evhtp_callback_cb cb, void * arg);
 
+/**
+ * @brief sets a callback to be executed on paths matching a route. A route
+ *        is a path in which ":name" matches one non-empty path segment (up
+ *        to the next '/') and a trailing "*name" matches the rest of the
+ *        path. For instance, with "/users/:id/files/" and "*file" joined
+ *        into one route, id is the segment after "/users/" and file is all
+ *        that follows "/files/". The matched values are returned by
+ *        evhtp_path_get_param(), at most EVHTP_PATH_MAX_PARAMS per route.
+ *
+ *        As with the other callbacks, the first one set which matches wins.
+ *
+ * @param htp
+ * @param route
+ * @param cb
+ * @param arg
+ *
+ * @return evhtp_callback_t * on success, NULL on error (or an invalid route)
+ */
+evhtp_callback_t * evhtp_set_route_cb(evhtp_t * htp, const char * route, evhtp_callback_cb cb, void * arg);
+
 /**
  * @brief sets a callback hook for either a connection or a path/regex .
  *
@@ -759,6 +1011,16 @@ void evhtp_send_reply_chunk_end(evhtp_request_t * request);
 evhtp_callback_t * evhtp_callback_new(const char * path, evhtp_callback_type type, evhtp_callback_cb cb, void * arg);
 void               evhtp_callback_free(evhtp_callback_t * callback);
 
+/**
+ * @brief attaches a header set to a callback, it is written out by the reply
+ *        to every request which is dispatched to this callback.
+ *
+ * @param callback
+ * @param set a set from evhtp_header_set_new(), or NULL to detach. It is
+ *        not owned by the callback, and must outlive it.
+ */
+void evhtp_callback_set_header_set(evhtp_callback_t * callback, evhtp_header_set_t * set);
+
 
 /**
  * @brief Adds a evhtp_callback_t to the evhtp_callbacks_t list
@@ -818,6 +1080,38 @@ void          evhtp_kv_rm_and_free(evhtp_kvs_t * kvs, evhtp_kv_t * kv);
 const char  * evhtp_kv_find(evhtp_kvs_t * kvs, const char * key);
 evhtp_kv_t  * evhtp_kvs_find_kv(evhtp_kvs_t * kvs, const char * key);
 
+/**
+ * @brief finds a kv by its well-known header id, this is constant time on
+ *        the indexed headers of a request (headers_in / headers_out), and
+ *        falls back to a string comparison walk otherwise.
+ *
+ * @param kvs an evhtp_kvs_t structure
+ * @param id the id of the header, see evhtp_hdr_id
+ *
+ * @return the first kv (or its value) with this id, NULL if not found
+ */
+const char  * evhtp_kv_find_id(evhtp_kvs_t * kvs, evhtp_hdr_id id);
+evhtp_kv_t  * evhtp_kvs_find_kv_id(evhtp_kvs_t * kvs, evhtp_hdr_id id);
+
+/**
+ * @brief returns the well-known header id for a header name
+ *
+ * @param key the header name, which does not need to be null terminated
+ * @param len the length of key
+ *
+ * @return the evhtp_hdr_id, or EVHTP_HDR_UNKNOWN
+ */
+evhtp_hdr_id  evhtp_header_id(const char * key, size_t len);
+
+/**
+ * @brief returns the canonical name of a well-known header id
+ *
+ * @param id
+ *
+ * @return a null terminated string, or NULL if the id is unknown
+ */
+const char  * evhtp_header_id_name(evhtp_hdr_id id);
+
 
 /**
  * @brief appends a key/val structure to a evhtp_kvs_t tailq
@@ -837,6 +1131,34 @@ void evhtp_kvs_add_kvs(evhtp_kvs_t * dst, evhtp_kvs_t * src);
 
 int  evhtp_kvs_for_each(evhtp_kvs_t * kvs, evhtp_kvs_iterator cb, void * arg);
 
+/**
+ * @brief rebuilds the lookup structures of a evhtp_kvs_t after its tailq has
+ *        been modified directly (TAILQ_REMOVE(), TAILQ_INSERT_HEAD() ...),
+ *        or after the key of one of its kv's was changed.
+ *
+ * @param kvs an evhtp_kvs_t structure
+ */
+void evhtp_kvs_reindex(evhtp_kvs_t * kvs);
+
+/**
+ * @brief serializes a set of response headers once, for headers which are
+ *        the same on every reply (Server, Cache-Control, CORS ...). A reply
+ *        with a set attached copies the serialized block out in one go
+ *        instead of formatting each header, and the request only needs to
+ *        add its own headers to headers_out. A header in headers_out
+ *        replaces the one of the same name in the set.
+ *
+ *        The headers are copied, so the set can not be changed afterwards.
+ *        Content-Length, Transfer-Encoding and Connection are refused since
+ *        they depend on each reply.
+ *
+ * @param headers the headers to serialize
+ *
+ * @return a evhtp_header_set_t on success, NULL on error
+ */
+evhtp_header_set_t * evhtp_header_set_new(evhtp_headers_t * headers);
+void                 evhtp_header_set_free(evhtp_header_set_t * set);
+
 /**
  * @brief Parses the query portion of the uri into a set of key/values
  *
@@ -850,6 +1172,68 @@ int  evhtp_kvs_for_each(evhtp_kvs_t * kvs, evhtp_kvs_iterator cb, void * arg);
 evhtp_query_t * evhtp_parse_query(const char * query, size_t len);
 
 
+/**
+ * @brief returns the query arguments of a request URI, parsing them on first
+ *        use. The keys and values are left escaped.
+ *
+ * @param uri
+ *
+ * @return the query arguments, valid for as long as the request, NULL if
+ *         the URI has no query or it could not be parsed.
+ */
+evhtp_query_t * evhtp_uri_get_query(evhtp_uri_t * uri);
+
+/**
+ * @brief returns the path (/a/b/) of a request path, copying it out of the
+ *        full path on first use.
+ *
+ * @param path
+ *
+ * @return the path, valid for as long as the request, NULL on error
+ */
+const char * evhtp_path_get_path(evhtp_path_t * path);
+
+/**
+ * @brief returns the file (c.html) of a request path
+ *
+ * @param path
+ *
+ * @return the file, or NULL if the path has none
+ */
+const char * evhtp_path_get_file(evhtp_path_t * path);
+
+/**
+ * @brief returns the part of a request path matched by its callback,
+ *        copying it out of the full path on first use.
+ *
+ * @param path
+ *
+ * @return the match, valid for as long as the request, NULL on error
+ */
+const char * evhtp_path_get_match_start(evhtp_path_t * path);
+
+/**
+ * @brief returns the rest of a request path after the part matched by its
+ *        callback.
+ *
+ * @param path
+ *
+ * @return the rest of the path, NULL if no callback was matched yet
+ */
+const char * evhtp_path_get_match_end(evhtp_path_t * path);
+
+/**
+ * @brief returns a parameter of the route callback a request path matched
+ *
+ * @param path
+ * @param name the name of the parameter, without the ':' or '*'
+ * @param len set to the length of the value
+ *
+ * @return the value, pointing into the path and not null terminated, or NULL
+ *         if there is no such parameter
+ */
+const char * evhtp_path_get_param(evhtp_path_t * path, const char * name, size_t * len);
+
 /**
  * @brief Unescapes strings like '%7B1,%202,%203%7D' would become '{1, 2, 3}'
  *
@@ -916,18 +1300,22 @@ void evhtp_headers_add_header(evhtp_headers_t * headers, evhtp_header_t * header
  */
 const char * evhtp_header_find(evhtp_headers_t * headers, const char * key);
 
-#define evhtp_header_find         evhtp_kv_find
-#define evhtp_headers_find_header evhtp_kvs_find_kv
-#define evhtp_headers_for_each    evhtp_kvs_for_each
-#define evhtp_header_new          evhtp_kv_new
-#define evhtp_header_free         evhtp_kv_free
-#define evhtp_headers_new         evhtp_kvs_new
-#define evhtp_headers_free        evhtp_kvs_free
-#define evhtp_header_rm_and_free  evhtp_kv_rm_and_free
-#define evhtp_headers_add_header  evhtp_kvs_add_kv
-#define evhtp_headers_add_headers evhtp_kvs_add_kvs
-#define evhtp_query_new           evhtp_kvs_new
-#define evhtp_query_free          evhtp_kvs_free
+#define evhtp_header_find            evhtp_kv_find
+#define evhtp_headers_find_header    evhtp_kvs_find_kv
+#define evhtp_header_find_id         evhtp_kv_find_id
+#define evhtp_headers_find_header_id evhtp_kvs_find_kv_id
+#define evhtp_headers_for_each       evhtp_kvs_for_each
+#define evhtp_headers_foreach        evhtp_kvs_foreach
+#define evhtp_headers_reindex        evhtp_kvs_reindex
+#define evhtp_header_new             evhtp_kv_new
+#define evhtp_header_free            evhtp_kv_free
+#define evhtp_headers_new            evhtp_kvs_new
+#define evhtp_headers_free           evhtp_kvs_free
+#define evhtp_header_rm_and_free     evhtp_kv_rm_and_free
+#define evhtp_headers_add_header     evhtp_kvs_add_kv
+#define evhtp_headers_add_headers    evhtp_kvs_add_kvs
+#define evhtp_query_new              evhtp_kvs_new
+#define evhtp_query_free             evhtp_kvs_free
 
 
 /**
@@ -1053,6 +1441,34 @@ void evhtp_connection_set_max_body_size(evhtp_connection_t * conn, uint64_t len)
  */
 void evhtp_request_set_max_body_size(evhtp_request_t * request, uint64_t len);
 
+/**
+ * @brief attaches a header set to the reply of a request, instead of the one
+ *        of the callback it was dispatched to (if any).
+ *
+ * @param request
+ * @param set a set from evhtp_header_set_new(), or NULL for none. It is not
+ *        owned by the request, and must outlive it.
+ */
+void evhtp_request_set_header_set(evhtp_request_t * request, evhtp_header_set_t * set);
+
+/**
+ * @brief parses a multipart request body as it is read, instead of it being
+ *        collected in buffer_in. The hooks are passed views of the body
+ *        which are only valid for the duration of the call, so each part
+ *        can be streamed elsewhere with bounded memory.
+ *
+ *        This sets the on_read hook of the request, and is meant to be
+ *        called from an on_headers hook.
+ *
+ * @param request
+ * @param hooks the multipart hooks, which must outlive the request
+ * @param arg passed on as the mpparser userdata
+ *
+ * @return 0 on success, -1 if the request has no multipart Content-Type
+ *         with a valid boundary
+ */
+int evhtp_request_set_multipart(evhtp_request_t * request, mpparse_hooks * hooks, void * arg);
+
 /**
  * @brief sets a maximum number of requests that a single connection can make.
  *
@@ -1061,6 +1477,17 @@ void evhtp_request_set_max_body_size(evhtp_request_t * request, uint64_t len);
  */
 void evhtp_set_max_keepalive_requests(evhtp_t * htp, uint64_t num);
 
+/**
+ * @brief sets the maximum number of pipelined requests a connection may have
+ *        waiting on a response. Once reached, no further input is parsed
+ *        until the oldest request has been answered. Responses are always
+ *        sent in the order the requests were received.
+ *
+ * @param htp
+ * @param num the limit, 0 for no limit (defaults to 16)
+ */
+void evhtp_set_max_pipelined_requests(evhtp_t * htp, uint64_t num);
+
 /*****************************************************************
 * client request functions                                      *
 *****************************************************************/
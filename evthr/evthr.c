@@ -51,6 +51,7 @@ struct evthr {
     int             rdr;
     int             wdr;
     char            err;
+    char            running;
     ev_t          * event;
     evbase_t      * evbase;
     pthread_mutex_t lock;
@@ -58,6 +59,7 @@ struct evthr {
     pthread_mutex_t rlock;
     pthread_t     * thr;
     evthr_init_cb   init_cb;
+    evthr_exit_cb   exit_cb;
     void          * arg;
     void          * aux;
 
@@ -198,6 +200,10 @@ _evthr_loop(void * args) {
         fprintf(stderr, "FATAL ERROR!\n");
     }
 
+    if (thread->exit_cb != NULL) {
+        thread->exit_cb(thread, thread->arg);
+    }
+
     pthread_exit(NULL);
 }
 
@@ -274,6 +280,11 @@ evthr_get_aux(evthr_t * thr) {
     return thr->aux;
 }
 
+void
+evthr_set_exit_cb(evthr_t * thr, evthr_exit_cb exit_cb) {
+    thr->exit_cb = exit_cb;
+}
+
 evthr_t *
 evthr_new(evthr_init_cb init_cb, void * args) {
     evthr_t * thread;
@@ -316,8 +327,6 @@ evthr_new(evthr_init_cb init_cb, void * args) {
 
 int
 evthr_start(evthr_t * thread) {
-    int res;
-
     if (thread == NULL || thread->thr == NULL) {
         return -1;
     }
@@ -326,9 +335,10 @@ evthr_start(evthr_t * thread) {
         return -1;
     }
 
-    res = pthread_detach(*thread->thr);
+    /* joined by evthr_free() */
+    thread->running = 1;
 
-    return res;
+    return 0;
 }
 
 void
@@ -337,6 +347,19 @@ evthr_free(evthr_t * thread) {
         return;
     }
 
+    if (thread->running) {
+        /* the thread uses its base and fds until its loop has stopped, and
+         * has its exit callback to run */
+        evthr_stop(thread);
+
+        if (pthread_equal(pthread_self(), *thread->thr)) {
+            /* it can not wait for itself, it is left to exit on its own */
+            pthread_detach(*thread->thr);
+        } else {
+            pthread_join(*thread->thr, NULL);
+        }
+    }
+
     if (thread->rdr > 0) {
         close(thread->rdr);
     }
@@ -484,6 +507,15 @@ evthr_pool_set_max_backlog(evthr_pool_t * pool, int max) {
     }
 }
 
+void
+evthr_pool_set_exit_cb(evthr_pool_t * pool, evthr_exit_cb exit_cb) {
+    evthr_t * thr;
+
+    TAILQ_FOREACH(thr, &pool->threads, next) {
+        evthr_set_exit_cb(thr, exit_cb);
+    }
+}
+
 int
 evthr_pool_start(evthr_pool_t * pool) {
     evthr_t * evthr = NULL;
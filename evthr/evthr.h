@@ -35,9 +35,17 @@ typedef enum evthr_res    evthr_res;
 typedef void (*evthr_cb)(evthr_t * thr, void * cmd_arg, void * shared);
 typedef void (*evthr_init_cb)(evthr_t * thr, void * shared);
 
+/* run by the thread itself once its loop has stopped, right before it exits */
+typedef void (*evthr_exit_cb)(evthr_t * thr, void * shared);
+
+/* evthr_free() (and so evthr_pool_free()) stops a started thread and waits
+ * for it to exit. Called from the thread itself it can not wait: the thread
+ * is detached instead, and must not go back to its loop afterwards. */
+
 evthr_t      * evthr_new(evthr_init_cb init_cb, void * arg);
 evbase_t     * evthr_get_base(evthr_t * thr);
 void           evthr_set_aux(evthr_t * thr, void * aux);
+void           evthr_set_exit_cb(evthr_t * thr, evthr_exit_cb exit_cb);
 void         * evthr_get_aux(evthr_t * thr);
 int            evthr_start(evthr_t * evthr);
 evthr_res      evthr_stop(evthr_t * evthr);
@@ -55,6 +63,7 @@ evthr_res      evthr_pool_stop(evthr_pool_t * pool);
 evthr_res      evthr_pool_defer(evthr_pool_t * pool, evthr_cb cb, void * arg);
 void           evthr_pool_free(evthr_pool_t * pool);
 void           evthr_pool_set_max_backlog(evthr_pool_t * evthr, int max);
+void           evthr_pool_set_exit_cb(evthr_pool_t * pool, evthr_exit_cb exit_cb);
 int            evthr_pool_set_backlog(evthr_pool_t *, int);
 
 #ifdef __cplusplus
@@ -194,6 +194,45 @@ test_max_body(evhtp_request_t * req, void * arg) {
     evhtp_send_reply(req, EVHTP_RES_OK);
 }
 
+static int
+multipart_hdr_val(mpparser * p, const char * data, size_t len) {
+    evhtp_request_t * req = mpparser_get_userdata(p);
+
+    evbuffer_add_printf(req->buffer_out, "header: %.*s\n", (int)len, data);
+
+    return 0;
+}
+
+static int
+multipart_data(mpparser * p, const char * data, size_t len) {
+    evhtp_request_t * req = mpparser_get_userdata(p);
+
+    /* the data is only valid here, and is never buffered in buffer_in */
+    evbuffer_add(req->buffer_out, data, len);
+
+    return 0;
+}
+
+static int
+multipart_part_complete(mpparser * p) {
+    evhtp_request_t * req = mpparser_get_userdata(p);
+
+    evbuffer_add(req->buffer_out, "\n", 1);
+
+    return 0;
+}
+
+static mpparse_hooks multipart_hooks = {
+    .hdr_val          = multipart_hdr_val,
+    .body             = multipart_data,
+    .on_part_complete = multipart_part_complete
+};
+
+static void
+test_multipart(evhtp_request_t * req, void * arg) {
+    evhtp_send_reply(req, EVHTP_RES_OK);
+}
+
 const char * chunk_strings[] = {
     "I give you the light of Eärendil,\n",
     "our most beloved star.\n",
@@ -336,6 +375,15 @@ set_max_body(evhtp_request_t * req, evhtp_headers_t * hdrs, void * arg) {
     return EVHTP_RES_OK;
 }
 
+static evhtp_res
+set_multipart(evhtp_request_t * req, evhtp_headers_t * hdrs, void * arg) {
+    if (evhtp_request_set_multipart(req, &multipart_hooks, req) == -1) {
+        return EVHTP_RES_UNSUPPORTED;
+    }
+
+    return EVHTP_RES_OK;
+}
+
 static evhtp_res
 test_pre_accept(evhtp_connection_t * c, void * arg) {
     uint16_t port = *(uint16_t *)arg;
@@ -515,6 +563,7 @@ main(int argc, char ** argv) {
     evhtp_callback_t * cb_10  = NULL;
     evhtp_callback_t * cb_11  = NULL;
     evhtp_callback_t * cb_12  = NULL;
+    evhtp_callback_t * cb_13  = NULL;
 
     if (parse_args(argc, argv) < 0) {
         exit(1);
@@ -550,6 +599,11 @@ main(int argc, char ** argv) {
      */
     cb_12  = evhtp_set_cb(htp, "/ownme", test_ownership, NULL);
 
+    /* set a callback which echoes back the headers and data of each part of
+     * a multipart body, parsed as it is read
+     */
+    cb_13  = evhtp_set_cb(htp, "/multipart", test_multipart, NULL);
+
     /* set a callback to pause on each header for cb_7 */
     evhtp_set_hook(&cb_7->hooks, evhtp_hook_on_path, pause_init_cb, NULL);
 
@@ -559,6 +613,7 @@ main(int argc, char ** argv) {
 #endif
 
     evhtp_set_hook(&cb_10->hooks, evhtp_hook_on_headers, set_max_body, NULL);
+    evhtp_set_hook(&cb_13->hooks, evhtp_hook_on_headers, set_multipart, NULL);
 
     /* set a default request handler */
     evhtp_set_gencb(htp, test_default_cb, "foobarbaz");
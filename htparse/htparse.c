@@ -33,6 +33,8 @@
 #endif
 
 #define PARSER_STACK_MAX 8192
+#define PARSER_INLINE_MAX 256 /* tokens up to this size do not need a block */
+#define PARSER_POOL_MAX  64   /* number of free blocks cached per thread */
 #define LF               (unsigned char)10
 #define CR               (unsigned char)13
 #define CRLF             "\x0d\x0a"
@@ -131,11 +133,25 @@ struct htparser {
     char * path_offset;
     char * args_offset;
 
+    /* while a header token still lies within the data passed to
+     * htparser_run() it is referenced here rather than copied into buf;
+     * tok_len is only valid once the token has been terminated.
+     */
+    const char * tok_view;
+    size_t       tok_len;
+
     void * userdata;
 
     unsigned int buf_idx;
-    /* Must be last since htparser_init memsets up to the offset of this buffer */
-    char buf[PARSER_STACK_MAX];
+    unsigned int buf_size;
+
+    /* Must be last since htparser_init memsets up to the offset of these.
+     * buf points to buf_inline until a token outgrows it, at which point a
+     * PARSER_STACK_MAX block is taken from the thread's pool; the block is
+     * given back once the parser is back at s_start.
+     */
+    char * buf;
+    char   buf_inline[PARSER_INLINE_MAX];
 };
 
 static uint32_t     usual[] = {
@@ -197,36 +213,170 @@ static const char * method_strmap[] = {
 
 #define _MIN_READ(a, b) ((a) < (b) ? (a) : (b))
 
+/**
+ * @brief loads 4 bytes from anywhere: with headers and the method referenced
+ *        in place, m is at an arbitrary offset into the input, and a plain
+ *        (uint32_t *) dereference would be a misaligned load.
+ */
+static inline uint32_t
+_htparse_load32(const void * m) {
+    uint32_t v;
+
+    memcpy(&v, m, sizeof(v));
+
+    return v;
+}
+
 #define _str3_cmp(m, c0, c1, c2, c3) \
-    *(uint32_t *)m == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0)
+    _htparse_load32(m) == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0)
 
 #define _str3Ocmp(m, c0, c1, c2, c3) \
-    *(uint32_t *)m == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0)
+    _htparse_load32(m) == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0)
 
 #define _str4cmp(m, c0, c1, c2, c3) \
-    *(uint32_t *)m == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0)
+    _htparse_load32(m) == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0)
 
-#define _str5cmp(m, c0, c1, c2, c3, c4)                          \
-    *(uint32_t *)m == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0) \
+#define _str5cmp(m, c0, c1, c2, c3, c4)                              \
+    _htparse_load32(m) == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0) \
     && m[4] == c4
 
-#define _str6cmp(m, c0, c1, c2, c3, c4, c5)                      \
-    *(uint32_t *)m == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0) \
-    && (((uint32_t *)m)[1] & 0xffff) == ((c5 << 8) | c4)
+#define _str6cmp(m, c0, c1, c2, c3, c4, c5)                          \
+    _htparse_load32(m) == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0) \
+    && (_htparse_load32(m + 4) & 0xffff) == ((c5 << 8) | c4)
 
-#define _str7_cmp(m, c0, c1, c2, c3, c4, c5, c6, c7)             \
-    *(uint32_t *)m == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0) \
-    && ((uint32_t *)m)[1] == ((c7 << 24) | (c6 << 16) | (c5 << 8) | c4)
+#define _str7_cmp(m, c0, c1, c2, c3, c4, c5, c6, c7)                 \
+    _htparse_load32(m) == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0) \
+    && _htparse_load32(m + 4) == ((c7 << 24) | (c6 << 16) | (c5 << 8) | c4)
 
-#define _str8cmp(m, c0, c1, c2, c3, c4, c5, c6, c7)              \
-    *(uint32_t *)m == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0) \
-    && ((uint32_t *)m)[1] == ((c7 << 24) | (c6 << 16) | (c5 << 8) | c4)
+#define _str8cmp(m, c0, c1, c2, c3, c4, c5, c6, c7)                  \
+    _htparse_load32(m) == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0) \
+    && _htparse_load32(m + 4) == ((c7 << 24) | (c6 << 16) | (c5 << 8) | c4)
 
-#define _str9cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8)                 \
-    *(uint32_t *)m == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0)        \
-    && ((uint32_t *)m)[1] == ((c7 << 24) | (c6 << 16) | (c5 << 8) | c4) \
+#define _str9cmp(m, c0, c1, c2, c3, c4, c5, c6, c7, c8)                     \
+    _htparse_load32(m) == ((c3 << 24) | (c2 << 16) | (c1 << 8) | c0)        \
+    && _htparse_load32(m + 4) == ((c7 << 24) | (c6 << 16) | (c5 << 8) | c4) \
     && m[8] == c8
 
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HTPARSE_HAVE_METHOD_WORD 1
+
+#define _str8word(c0, c1, c2, c3, c4, c5, c6, c7)                   \
+    ((uint64_t)(c0) | (uint64_t)(c1) << 8 | (uint64_t)(c2) << 16 |  \
+     (uint64_t)(c3) << 24 | (uint64_t)(c4) << 32 | (uint64_t)(c5) << 40 | \
+     (uint64_t)(c6) << 48 | (uint64_t)(c7) << 56)
+
+/**
+ * @brief recognizes a known method straight from the input with a single
+ *        8 byte load: the first space is located with a zero byte test
+ *        on the word, everything from it onwards masked off, and what is
+ *        left compared against a constant per method of that length.
+ *
+ * @param data the first byte of the method
+ * @param len the number of bytes available at data
+ * @param method set to the method recognized
+ *
+ * @return the length of the method, which is followed by a space, or 0 if
+ *         the input does not start with a complete known method. The
+ *         caller then falls back to reading the method byte by byte.
+ */
+static inline size_t
+_htparse_method_word(const char * data, size_t len, htp_method * method) {
+    uint64_t w;
+    uint64_t sp;
+    size_t   mlen;
+
+    if (len < 8) {
+        return 0;
+    }
+
+    memcpy(&w, data, 8);
+
+    sp = w ^ 0x2020202020202020ULL;
+    sp = (sp - 0x0101010101010101ULL) & ~sp & 0x8080808080808080ULL;
+
+    if (sp == 0) {
+        /* the only known methods which do not fit in the word */
+        if (w == _str8word('P', 'R', 'O', 'P', 'F', 'I', 'N', 'D')) {
+            if (len > 8 && data[8] == ' ') {
+                *method = htp_method_PROPFIND;
+                return 8;
+            }
+        } else if (w == _str8word('P', 'R', 'O', 'P', 'P', 'A', 'T', 'C')) {
+            if (len > 9 && data[8] == 'H' && data[9] == ' ') {
+                *method = htp_method_PROPPATCH;
+                return 9;
+            }
+        }
+
+        return 0;
+    }
+
+    mlen = __builtin_ctzll(sp) / 8;
+    w   &= (1ULL << (mlen * 8)) - 1;
+
+    switch (mlen) {
+        case 3:
+            if (w == _str8word('G', 'E', 'T', 0, 0, 0, 0, 0)) {
+                *method = htp_method_GET;
+            } else if (w == _str8word('P', 'U', 'T', 0, 0, 0, 0, 0)) {
+                *method = htp_method_PUT;
+            } else {
+                return 0;
+            }
+            break;
+        case 4:
+            if (w == _str8word('P', 'O', 'S', 'T', 0, 0, 0, 0)) {
+                *method = htp_method_POST;
+            } else if (w == _str8word('H', 'E', 'A', 'D', 0, 0, 0, 0)) {
+                *method = htp_method_HEAD;
+            } else if (w == _str8word('C', 'O', 'P', 'Y', 0, 0, 0, 0)) {
+                *method = htp_method_COPY;
+            } else if (w == _str8word('M', 'O', 'V', 'E', 0, 0, 0, 0)) {
+                *method = htp_method_MOVE;
+            } else if (w == _str8word('L', 'O', 'C', 'K', 0, 0, 0, 0)) {
+                *method = htp_method_LOCK;
+            } else {
+                return 0;
+            }
+            break;
+        case 5:
+            if (w == _str8word('P', 'A', 'T', 'C', 'H', 0, 0, 0)) {
+                *method = htp_method_PATCH;
+            } else if (w == _str8word('T', 'R', 'A', 'C', 'E', 0, 0, 0)) {
+                *method = htp_method_TRACE;
+            } else if (w == _str8word('M', 'K', 'C', 'O', 'L', 0, 0, 0)) {
+                *method = htp_method_MKCOL;
+            } else {
+                return 0;
+            }
+            break;
+        case 6:
+            if (w == _str8word('D', 'E', 'L', 'E', 'T', 'E', 0, 0)) {
+                *method = htp_method_DELETE;
+            } else if (w == _str8word('U', 'N', 'L', 'O', 'C', 'K', 0, 0)) {
+                *method = htp_method_UNLOCK;
+            } else {
+                return 0;
+            }
+            break;
+        case 7:
+            if (w == _str8word('O', 'P', 'T', 'I', 'O', 'N', 'S', 0)) {
+                *method = htp_method_OPTIONS;
+            } else if (w == _str8word('C', 'O', 'N', 'N', 'E', 'C', 'T', 0)) {
+                *method = htp_method_CONNECT;
+            } else {
+                return 0;
+            }
+            break;
+        default:
+            return 0;
+    } /* switch */
+
+    return mlen;
+}     /* _htparse_method_word */
+
+#endif
+
 #define __HTPARSE_GENHOOK(__n)                                                    \
     static inline int hook_ ## __n ## _run(htparser * p, htparse_hooks * hooks) { \
         htparse_log_debug("enter");                                               \
@@ -267,6 +417,484 @@ __HTPARSE_GENDHOOK(hdr_val)
 __HTPARSE_GENDHOOK(body)
 __HTPARSE_GENDHOOK(hostname)
 
+/*
+ * Fast scanning of long token runs.
+ *
+ * Inside the uri and header states nearly every byte is simply appended to
+ * the scratch buffer. Instead of walking each of those bytes through the
+ * state machine, the scanners below find the next byte which the current
+ * state actually has to look at (its "stop set"), so the run before it can
+ * be consumed in a single step.
+ *
+ * A scalar table driven scanner is always available, SSE4.2 (pcmpestri) and
+ * AVX2 versions are selected at runtime if the CPU supports them.
+ */
+struct htparse_scan_set {
+    char    chars[16];                 /* the stop set for the vector scanners */
+    int     nchars;
+    uint8_t table[256];                /* the stop set for the scalar scanner */
+};
+
+typedef struct htparse_scan_set htparse_scan_set;
+typedef size_t (*htparse_scan_fn)(const char *, size_t, const htparse_scan_set *);
+
+/* s_check_uri: everything which is not in the usual[] table */
+static const htparse_scan_set scan_check_uri = {
+    .chars  = { '\0', LF, CR, ' ', '#', '%', '+', '.', '/', '?' },
+    .nchars = 10,
+    .table  = {
+        ['\0'] = 1, [LF] = 1, [CR] = 1, [' '] = 1, ['#'] = 1,
+        ['%']  = 1, ['+'] = 1, ['.'] = 1, ['/'] = 1, ['?'] = 1
+    }
+};
+
+/* s_uri: only the end of the uri or the start of the query is interesting */
+static const htparse_scan_set scan_uri = {
+    .chars  = { ' ', CR, LF, '?' },
+    .nchars = 4,
+    .table  = { [' '] = 1, [CR] = 1, [LF] = 1, ['?'] = 1 }
+};
+
+static const htparse_scan_set scan_hdr_key = {
+    .chars  = { ':', CR, LF },
+    .nchars = 3,
+    .table  = { [':'] = 1, [CR] = 1, [LF] = 1 }
+};
+
+static const htparse_scan_set scan_hdr_val = {
+    .chars  = { CR, LF },
+    .nchars = 2,
+    .table  = { [CR] = 1, [LF] = 1 }
+};
+
+static size_t
+_htparse_scan_scalar(const char * data, size_t len, const htparse_scan_set * set) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (set->table[(unsigned char)data[i]]) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/*
+ * The end of a request's headers, an empty line. Finding it up front tells
+ * whether the request line and all of the headers are in the input.
+ */
+typedef size_t (*htparse_find_fn)(const char *, size_t);
+
+static size_t
+_htparse_find_eoh_scalar(const char * data, size_t len) {
+    const char * s   = data;
+    const char * end = data + len;
+
+    while (end - s >= 4 && (s = memchr(s, CR, (size_t)(end - s) - 3))) {
+        if (s[1] == LF && s[2] == CR && s[3] == LF) {
+            return (size_t)(s - data);
+        }
+
+        s++;
+    }
+
+    return len;
+}
+
+#if !defined(EVHTP_DISABLE_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HTPARSE_HAVE_SIMD 1
+#include <immintrin.h>
+
+__attribute__((target("sse4.2")))
+static size_t
+_htparse_scan_sse42(const char * data, size_t len, const htparse_scan_set * set) {
+    __m128i chars = _mm_loadu_si128((const __m128i *)set->chars);
+    size_t  i     = 0;
+
+    while (len - i >= 16) {
+        int idx;
+
+        idx = _mm_cmpestri(chars, set->nchars,
+                           _mm_loadu_si128((const __m128i *)(data + i)), 16,
+                           _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+
+        if (idx != 16) {
+            return i + idx;
+        }
+
+        i += 16;
+    }
+
+    return i + _htparse_scan_scalar(data + i, len - i, set);
+}
+
+__attribute__((target("avx2")))
+static size_t
+_htparse_scan_avx2(const char * data, size_t len, const htparse_scan_set * set) {
+    __m256i chars[16];
+    size_t  i = 0;
+    int     n;
+
+    for (n = 0; n < set->nchars; n++) {
+        chars[n] = _mm256_set1_epi8(set->chars[n]);
+    }
+
+    while (len - i >= 32) {
+        __m256i  blk  = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i  hits = _mm256_cmpeq_epi8(blk, chars[0]);
+        uint32_t mask;
+
+        for (n = 1; n < set->nchars; n++) {
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(blk, chars[n]));
+        }
+
+        if ((mask = (uint32_t)_mm256_movemask_epi8(hits))) {
+            return i + __builtin_ctz(mask);
+        }
+
+        i += 32;
+    }
+
+    return i + _htparse_scan_scalar(data + i, len - i, set);
+}
+
+/* candidates are a CR with a LF three bytes on, the two in between are
+ * checked one by one */
+__attribute__((target("sse2")))
+static size_t
+_htparse_find_eoh_sse2(const char * data, size_t len) {
+    __m128i cr = _mm_set1_epi8(CR);
+    __m128i lf = _mm_set1_epi8(LF);
+    size_t  i  = 0;
+
+    while (len - i >= 16 + 3) {
+        __m128i  a    = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i  b    = _mm_loadu_si128((const __m128i *)(data + i + 3));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, cr), _mm_cmpeq_epi8(b, lf)));
+
+        while (mask) {
+            size_t n = i + __builtin_ctz(mask);
+
+            if (data[n + 1] == LF && data[n + 2] == CR) {
+                return n;
+            }
+
+            mask &= mask - 1;
+        }
+
+        i += 16;
+    }
+
+    return i + _htparse_find_eoh_scalar(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t
+_htparse_find_eoh_avx2(const char * data, size_t len) {
+    __m256i cr = _mm256_set1_epi8(CR);
+    __m256i lf = _mm256_set1_epi8(LF);
+    size_t  i  = 0;
+
+    while (len - i >= 32 + 3) {
+        __m256i  a    = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i  b    = _mm256_loadu_si256((const __m256i *)(data + i + 3));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, cr), _mm256_cmpeq_epi8(b, lf)));
+
+        while (mask) {
+            size_t n = i + __builtin_ctz(mask);
+
+            if (data[n + 1] == LF && data[n + 2] == CR) {
+                return n;
+            }
+
+            mask &= mask - 1;
+        }
+
+        i += 32;
+    }
+
+    return i + _htparse_find_eoh_scalar(data + i, len - i);
+}
+
+#endif
+
+static htparse_scan_fn _htparse_scan     = NULL;
+static htparse_find_fn _htparse_find_eoh = NULL;
+
+static void
+_htparse_scan_init(void) {
+    _htparse_find_eoh = _htparse_find_eoh_scalar;
+
+#ifdef HTPARSE_HAVE_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2")) {
+        _htparse_find_eoh = _htparse_find_eoh_sse2;
+    }
+
+    if (__builtin_cpu_supports("avx2")) {
+        _htparse_scan     = _htparse_scan_avx2;
+        _htparse_find_eoh = _htparse_find_eoh_avx2;
+        return;
+    }
+
+    if (__builtin_cpu_supports("sse4.2")) {
+        _htparse_scan = _htparse_scan_sse42;
+        return;
+    }
+#endif
+
+    _htparse_scan = _htparse_scan_scalar;
+}
+
+#if defined(__GNUC__)
+#define HTPARSE_TLS __thread
+#endif
+
+#ifdef HTPARSE_TLS
+static HTPARSE_TLS void       * _htparse_pool     = NULL;
+static HTPARSE_TLS unsigned int _htparse_pool_len = 0;
+#endif
+
+static char *
+_htparse_block_get(void) {
+#ifdef HTPARSE_TLS
+    void * block;
+
+    if ((block = _htparse_pool) != NULL) {
+        _htparse_pool = *(void **)block;
+        _htparse_pool_len--;
+
+        return block;
+    }
+#endif
+
+    return malloc(PARSER_STACK_MAX);
+}
+
+static void
+_htparse_block_put(char * block) {
+#ifdef HTPARSE_TLS
+    if (_htparse_pool_len < PARSER_POOL_MAX) {
+        *(void **)block = _htparse_pool;
+        _htparse_pool   = block;
+        _htparse_pool_len++;
+
+        return;
+    }
+#endif
+
+    free(block);
+}
+
+/**
+ * @brief releases the scratch blocks cached by the calling thread; blocks
+ *        still held by parsers are put back into the (now empty) pool when
+ *        those are freed.
+ */
+void
+htparser_pool_drain(void) {
+#ifdef HTPARSE_TLS
+    void * block;
+
+    while ((block = _htparse_pool) != NULL) {
+        _htparse_pool = *(void **)block;
+        free(block);
+    }
+
+    _htparse_pool_len = 0;
+#endif
+}
+
+#define _htparse_rebase(p, field, from, to) \
+    if ((p)->field != NULL) {               \
+        (p)->field = to + ((p)->field - from); \
+    }
+
+/**
+ * @brief moves the scratch buffer from the inline area to a PARSER_STACK_MAX
+ *        block.
+ *
+ * @return -1 if the buffer is already a block, or no block is available
+ */
+static int
+_htparse_buf_grow(htparser * p) {
+    char * block;
+
+    if (p->buf != p->buf_inline) {
+        return -1;
+    }
+
+    if (!(block = _htparse_block_get())) {
+        return -1;
+    }
+
+    memcpy(block, p->buf_inline, sizeof(p->buf_inline));
+
+    _htparse_rebase(p, scheme_offset, p->buf_inline, block);
+    _htparse_rebase(p, host_offset, p->buf_inline, block);
+    _htparse_rebase(p, port_offset, p->buf_inline, block);
+    _htparse_rebase(p, path_offset, p->buf_inline, block);
+    _htparse_rebase(p, args_offset, p->buf_inline, block);
+
+    p->buf      = block;
+    p->buf_size = PARSER_STACK_MAX;
+
+    return 0;
+}
+
+static void
+_htparse_buf_release(htparser * p) {
+    if (p->buf == p->buf_inline) {
+        return;
+    }
+
+    _htparse_block_put(p->buf);
+
+    p->buf           = p->buf_inline;
+    p->buf_size      = sizeof(p->buf_inline);
+    p->buf[0]        = '\0';
+    p->scheme_offset = NULL;
+    p->host_offset   = NULL;
+    p->port_offset   = NULL;
+    p->path_offset   = NULL;
+    p->args_offset   = NULL;
+}
+
+/**
+ * @brief consumes the run of bytes following data[i] which are not in the
+ *        stop set, appending them to the scratch buffer.
+ *
+ * @return the number of bytes consumed (the caller advances i by this much)
+ */
+static inline size_t
+_htparse_buf_run(htparser * p, const char * data, size_t i, size_t len,
+                 const htparse_scan_set * set) {
+    size_t avail = len - i - 1;
+    size_t room;
+    size_t n;
+
+    if (avail == 0 || p->buf_idx + 1 >= p->buf_size) {
+        return 0;
+    }
+
+    if (set->table[(unsigned char)data[i + 1]]) {
+        /* single byte token, not worth a call into the scanner */
+        return 0;
+    }
+
+    room = p->buf_size - p->buf_idx - 1;
+
+    n = _htparse_scan(&data[i + 1], _MIN_READ(avail, room), set);
+
+    if (n == 0) {
+        return 0;
+    }
+
+    memcpy(&p->buf[p->buf_idx], &data[i + 1], n);
+
+    p->buf_idx          += n;
+    p->buf[p->buf_idx]   = '\0';
+    p->bytes_read       += n;
+    p->total_bytes_read += n;
+
+    return n;
+}
+
+/**
+ * @brief same as _htparse_buf_run() but for header tokens, which are only
+ *        staged in the scratch buffer when they do not fit in the current
+ *        run of data.
+ */
+static inline size_t
+_htparse_tok_run(htparser * p, const char * data, size_t i, size_t len,
+                 const htparse_scan_set * set) {
+    size_t avail = len - i - 1;
+    size_t room;
+    size_t n;
+
+    if (p->tok_view == NULL) {
+        return _htparse_buf_run(p, data, i, len, set);
+    }
+
+    if (avail == 0 || set->table[(unsigned char)data[i + 1]]) {
+        return 0;
+    }
+
+    /* no need to look further than what could be staged */
+    if ((size_t)(&data[i + 1] - p->tok_view) >= PARSER_STACK_MAX) {
+        return 0;
+    }
+
+    room = PARSER_STACK_MAX - (size_t)(&data[i + 1] - p->tok_view);
+    n    = _htparse_scan(&data[i + 1], _MIN_READ(avail, room), set);
+
+    p->bytes_read       += n;
+    p->total_bytes_read += n;
+
+    return n;
+}
+
+#define _tok_data(p) ((p)->tok_view ? (p)->tok_view : (p)->buf)
+#define _tok_len(p)  ((p)->tok_view ? (p)->tok_len : (size_t)(p)->buf_idx)
+
+/**
+ * @brief marks the end of the header token being referenced in place.
+ *
+ * @return -1 if the token would not have fit in the scratch buffer
+ */
+static inline int
+_htparse_tok_end(htparser * p, const char * end) {
+    if (p->tok_view == NULL) {
+        return 0;
+    }
+
+    p->tok_len = (size_t)(end - p->tok_view);
+
+    if (p->tok_len >= PARSER_STACK_MAX - 1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief copies a header token which is referenced in place into the scratch
+ *        buffer, either because the data it points to is about to go away
+ *        (end of htparser_run()), or because it is going to be appended to.
+ *
+ * @param end the end of the consumed data, used if the token is unterminated
+ *
+ * @return -1 if the token does not fit in the scratch buffer
+ */
+static int
+_htparse_tok_stage(htparser * p, const char * end) {
+    size_t n;
+
+    if (p->tok_view == NULL) {
+        return 0;
+    }
+
+    n = p->tok_len ? p->tok_len : (size_t)(end - p->tok_view);
+
+    if (n >= p->buf_size && (n >= PARSER_STACK_MAX || _htparse_buf_grow(p) == -1)) {
+        p->tok_view = NULL;
+        return -1;
+    }
+
+    memcpy(p->buf, p->tok_view, n);
+
+    p->buf_idx    = n;
+    p->buf[n]     = '\0';
+    p->tok_view   = NULL;
+    p->tok_len    = 0;
+
+    return 0;
+}
+
 
 static inline uint64_t
 str_to_uint64(char * str, size_t n, int * err) {
@@ -299,6 +927,114 @@ str_to_uint64(char * str, size_t n, int * err) {
     return value;
 }
 
+/**
+ * @brief figures out if the value of the header named tok is valueable to
+ *        the parser itself, see _htparse_hdr_val_eval()
+ */
+static inline void
+_htparse_hdr_key_eval(htparser * p, const char * tok, size_t tok_len) {
+    /* trailers never change how the message is read */
+    p->heval = eval_hdr_val_none;
+
+    switch (p->flags & parser_flag_trailing ? 0 : tok_len + 1) {
+        case 5:
+            if (!strncasecmp(tok, "host", 4)) {
+                p->heval = eval_hdr_val_hostname;
+            }
+            break;
+        case 11:
+            if (!strncasecmp(tok, "connection", 10)) {
+                p->heval = eval_hdr_val_connection;
+            }
+            break;
+        case 13:
+            if (!strncasecmp(tok, "content-type", 12)) {
+                p->heval = eval_hdr_val_content_type;
+            }
+            break;
+        case 15:
+            if (!strncasecmp(tok, "content-length", 14)) {
+                p->heval = eval_hdr_val_content_length;
+            }
+            break;
+        case 17:
+            if (!strncasecmp(tok, "proxy-connection", 16)) {
+                p->heval = eval_hdr_val_proxy_connection;
+            }
+            break;
+        case 18:
+            if (!strncasecmp(tok, "transfer-encoding", 17)) {
+                p->heval = eval_hdr_val_transfer_encoding;
+            }
+            break;
+    } /* switch */
+}
+
+/**
+ * @brief acts upon the value of a header found by _htparse_hdr_key_eval()
+ *
+ * @return 0 on success, -1 if the content-length is invalid, 1 if the
+ *         hostname hook failed
+ */
+static inline int
+_htparse_hdr_val_eval(htparser * p, htparse_hooks * hooks, const char * tok, size_t tok_len) {
+    int err = 0;
+
+    switch (p->heval) {
+        case eval_hdr_val_none:
+            break;
+        case eval_hdr_val_hostname:
+            if (hook_hostname_run(p, hooks, tok, tok_len)) {
+                return 1;
+            }
+            break;
+        case eval_hdr_val_content_length:
+            p->content_len      = str_to_uint64((char *)tok, tok_len, &err);
+            p->orig_content_len = p->content_len;
+
+            htparse_log_debug("[%p] s_hdrline_hdr_val content-lenth = %zu", p, p->content_len);
+
+            if (err == 1) {
+                return -1;
+            }
+
+            break;
+        case eval_hdr_val_connection:
+            switch (tok[0]) {
+                case 'K':
+                case 'k':
+                    if (tok_len >= 10 && _str9cmp((tok + 1),
+                                                  'e', 'e', 'p', '-', 'A', 'l', 'i', 'v', 'e')) {
+                        p->flags |= parser_flag_connection_keep_alive;
+                    }
+                    break;
+                case 'c':
+                    if (tok_len >= 5 && _str5cmp(tok, 'c', 'l', 'o', 's', 'e')) {
+                        p->flags |= parser_flag_connection_close;
+                    }
+                    break;
+            }
+            break;
+        case eval_hdr_val_transfer_encoding:
+            if (tok_len == 7 && _str6cmp(tok, 'c', 'h', 'u', 'n', 'k', 'e') && tok[6] == 'd') {
+                p->flags |= parser_flag_chunked;
+            }
+
+            break;
+        case eval_hdr_val_content_type:
+            if (tok[0] == 'm' || tok[0] == 'M') {
+                if (tok_len >= 9 && _str8cmp((tok + 1), 'u', 'l', 't', 'i', 'p', 'a', 'r', 't')) {
+                    p->multipart = 1;
+                }
+            }
+            break;
+        default:
+            break;
+    } /* switch */
+
+    return 0;
+}     /* _htparse_hdr_val_eval */
+
 static inline ssize_t
 _str_to_ssize_t(char * str, size_t n) {
     ssize_t value;
@@ -445,25 +1181,366 @@ htparser_get_total_bytes_read(htparser * p) {
 
 void
 htparser_init(htparser * p, htp_type type) {
+    _htparse_buf_release(p);
+
     /* Do not memset entire string buffer. */
     memset(p, 0, offsetof(htparser, buf));
-    p->buf[0] = '\0';
-    p->state  = s_start;
-    p->error  = htparse_error_none;
-    p->method = htp_method_UNKNOWN;
-    p->type   = type;
+    p->buf_size = sizeof(p->buf_inline);
+    p->buf[0]   = '\0';
+    p->state    = s_start;
+    p->error    = htparse_error_none;
+    p->method   = htp_method_UNKNOWN;
+    p->type     = type;
+
+    if (_htparse_scan == NULL) {
+        _htparse_scan_init();
+    }
 }
 
 htparser *
 htparser_new(void) {
-    return malloc(sizeof(htparser));
+    htparser * p;
+
+    if (!(p = malloc(sizeof(htparser)))) {
+        return NULL;
+    }
+
+    p->buf = p->buf_inline;
+
+    return p;
 }
 
-size_t
-htparser_run(htparser * p, htparse_hooks * hooks, const char * data, size_t len) {
+void
+htparser_free(htparser * p) {
+    if (p == NULL) {
+        return;
+    }
+
+    _htparse_buf_release(p);
+    free(p);
+}
+
+#ifdef HTPARSE_HAVE_METHOD_WORD
+#define HTPARSE_FAST_HDRS_MAX 64
+#define HTPARSE_FAST_LEN_MAX  (PARSER_STACK_MAX * 2)
+
+struct htparse_fast_hdr {
+    const char * key;
+    const char * val;
+    const char * cr;                   /* the end of the header line */
+    size_t       key_len;
+    size_t       val_len;
+};
+
+/**
+ * @brief reads a request whose request line and headers are all within the
+ *        input in one go, handing the hooks offsets into the input instead
+ *        of walking every byte through the state machine.
+ *
+ *        The hooks see exactly what the state machine would have shown
+ *        them. To that end the whole request head is checked before the
+ *        first hook is run, and anything out of the ordinary (an absolute
+ *        uri, HTTP/0.9, folded or malformed headers, huge tokens...) is
+ *        left to the state machine. If a hook fails, the parser is left in
+ *        the state the state machine would have left it in, so that the
+ *        caller may resume from the offset returned.
+ *
+ * @param data the first byte of the method, on_msg_begin has been run
+ * @param len the number of bytes available at data
+ *
+ * @return 0 if nothing was done, otherwise the number of bytes consumed; if
+ *         a hook failed p->error is set
+ */
+static size_t
+_htparse_request_fast(htparser * p, htparse_hooks * hooks, const char * data, size_t len) {
+    struct htparse_fast_hdr hdrs[HTPARSE_FAST_HDRS_MAX];
+    struct htparse_fast_hdr * h;
+    parser_state state;
+    htp_method   method;
+    const char * end;                  /* the CR of the empty line ending the headers */
+    const char * uri;
+    const char * args = NULL;          /* the '?' starting the query */
+    const char * sp;                   /* the space after the uri */
+    const char * ver;
+    const char * line;
+    size_t       mlen;
+    size_t       n;
+    size_t       nhdrs = 0;
+    int          res;
+
+    n = _htparse_find_eoh(data, _MIN_READ(len, HTPARSE_FAST_LEN_MAX));
+
+    if (n == _MIN_READ(len, HTPARSE_FAST_LEN_MAX)) {
+        return 0;
+    }
+
+    end = data + n + 2;
+
+    if (!(mlen = _htparse_method_word(data, len, &method))) {
+        return 0;
+    }
+
+    for (uri = data + mlen + 1; *uri == ' '; uri++) {
+        ;
+    }
+
+    if (*uri != '/') {
+        return 0;
+    }
+
+    /* walk the uri states just far enough to know which hooks they run */
+    state = s_after_slash_in_uri;
+
+    for (sp = uri + 1; ; sp++) {
+        unsigned char ch;
+
+        if (state == s_check_uri) {
+            sp += _htparse_scan(sp, (size_t)(end - sp), &scan_check_uri);
+        } else if (state == s_uri) {
+            sp += _htparse_scan(sp, (size_t)(end - sp), &scan_uri);
+        }
+
+        ch = (unsigned char)*sp;
+
+        if (ch == ' ') {
+            break;
+        }
+
+        if (ch == CR || ch == LF) {
+            /* HTTP/0.9 */
+            return 0;
+        }
+
+        if (state == s_uri) {
+            /* only the first '?' starts the query */
+            if (args == NULL) {
+                args = sp;
+            }
+            continue;
+        }
+
+        if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
+            state = s_check_uri;
+            continue;
+        }
+
+        switch (ch) {
+            case '?':
+                args  = sp;
+                state = s_uri;
+                break;
+            case '/':
+                state = state == s_check_uri ? s_after_slash_in_uri : s_uri;
+                break;
+            case '.':
+            case '%':
+            case '#':
+                state = s_uri;
+                break;
+            default:
+                state = state == s_check_uri ? s_uri : s_check_uri;
+                break;
+        }
+    }
+
+    if (sp - uri >= PARSER_STACK_MAX / 2) {
+        return 0;
+    }
+
+    for (ver = sp; *ver == ' '; ver++) {
+        ;
+    }
+
+    if (end + 2 - ver < 10
+        || !(_str5cmp(ver, 'H', 'T', 'T', 'P', '/'))
+        || ver[5] < '1' || ver[5] > '9' || ver[6] != '.'
+        || ver[7] < '0' || ver[7] > '9' || ver[8] != CR || ver[9] != LF) {
+        return 0;
+    }
+
+    for (line = ver + 10; line < end; line = h->cr + 2) {
+        const char * colon;
+
+        switch (*line) {
+            case ' ':
+            case '\t':
+            case ':':
+            case CR:
+            case LF:
+                return 0;
+        }
+
+        if (nhdrs == HTPARSE_FAST_HDRS_MAX) {
+            return 0;
+        }
+
+        h     = &hdrs[nhdrs++];
+        colon = line + 1 + _htparse_scan(line + 1, (size_t)(end - line - 1), &scan_hdr_key);
+
+        if (*colon != ':') {
+            return 0;
+        }
+
+        for (h->val = colon + 1; *h->val == ' '; h->val++) {
+            ;
+        }
+
+        h->cr = h->val + _htparse_scan(h->val, (size_t)(end - h->val), &scan_hdr_val);
+
+        /* a bare LF, or a continuation line */
+        if (*h->cr != CR || h->cr[1] != LF || h->cr[2] == '\t') {
+            return 0;
+        }
+
+        h->key     = line;
+        h->key_len = (size_t)(colon - line);
+        h->val_len = (size_t)(h->cr - h->val);
+
+        if (h->key_len >= PARSER_STACK_MAX / 2 || h->val_len >= PARSER_STACK_MAX / 2) {
+            return 0;
+        }
+    }
+
+    /* from here on, the request is ours */
+    p->method = method;
+
+    if (hook_method_run(p, hooks, data, mlen)) {
+        p->state = s_spaces_before_uri;
+        p->error = htparse_error_user;
+        return mlen + 1;
+    }
+
+    if (args != NULL && hook_path_run(p, hooks, uri, (size_t)(args - uri))) {
+        /* the state machine has the uri up to and including the '?' */
+        n = (size_t)(args - uri) + 1;
+
+        if (n >= p->buf_size && _htparse_buf_grow(p) == -1) {
+            p->error = htparse_error_too_big;
+            return (size_t)(args - data) + 1;
+        }
+
+        memcpy(p->buf, uri, n);
+
+        p->buf[n]      = '\0';
+        p->buf_idx     = n;
+        p->path_offset = p->buf;
+        p->args_offset = &p->buf[n];
+        p->state       = s_uri;
+        p->error       = htparse_error_user;
+        return (size_t)(args - data) + 1;
+    }
+
+    if (args != NULL) {
+        res = hook_args_run(p, hooks, args + 1, (size_t)(sp - args - 1));
+    } else {
+        res = hook_path_run(p, hooks, uri, (size_t)(sp - uri));
+
+        if (state != s_uri) {
+            res |= hook_uri_run(p, hooks, uri, (size_t)(sp - uri));
+        }
+    }
+
+    p->buf_idx = 0;
+
+    if (res) {
+        p->state = s_http_09;
+        p->error = htparse_error_user;
+        return (size_t)(sp - data) + 1;
+    }
+
+    p->major = ver[5] - '0';
+    p->minor = ver[7] - '0';
+    p->state = s_done;
+
+    if (hook_on_hdrs_begin_run(p, hooks)) {
+        p->error = htparse_error_user;
+        return (size_t)(ver - data) + 10;
+    }
+
+    for (h = hdrs; h < &hdrs[nhdrs]; h++) {
+        /* an empty value is passed on as a single space */
+        const char * val     = h->val_len ? h->val : " ";
+        size_t       val_len = h->val_len ? h->val_len : 1;
+
+        res = hook_hdr_key_run(p, hooks, h->key, h->key_len);
+
+        _htparse_hdr_key_eval(p, h->key, h->key_len);
+
+        if (res) {
+            p->state = s_hdrline_hdr_space_before_val;
+            p->error = htparse_error_user;
+            return (size_t)(h->key + h->key_len - data) + 1;
+        }
+
+        switch (_htparse_hdr_val_eval(p, hooks, val, val_len)) {
+            case -1:
+                p->state = s_hdrline_hdr_val;
+                p->error = htparse_error_too_big;
+                return (size_t)(h->cr - data) + 1;
+            case 1:
+                /* the value is needed again for the hdr_val hook */
+                if (h->val_len) {
+                    p->tok_view = h->val;
+                    p->tok_len  = h->val_len;
+                } else {
+                    p->buf[0]  = ' ';
+                    p->buf[1]  = '\0';
+                    p->buf_idx = 1;
+                }
+
+                p->state = s_hdrline_hdr_almost_done;
+                p->error = htparse_error_user;
+                return (size_t)(h->cr - data) + 1;
+        }
+
+        if (hook_hdr_val_run(p, hooks, val, val_len)) {
+            /* the state machine runs hdr_val at the first byte of the next
+             * line, which it has consumed as the start of the next key */
+            if (h->cr + 2 < end) {
+                p->tok_view = h->cr + 2;
+                p->tok_len  = 0;
+                p->state    = s_hdrline_hdr_key;
+            } else {
+                p->state    = s_hdrline_almost_done;
+            }
+
+            p->error = htparse_error_user;
+            return (size_t)(h->cr - data) + 3;
+        }
+    }
+
+    p->state = s_hdrline_almost_done;
+
+    if (nhdrs && hook_on_hdrs_complete_run(p, hooks)) {
+        p->error = htparse_error_user;
+        return (size_t)(end - data) + 1;
+    }
+
+    if (p->flags & parser_flag_chunked) {
+        p->state = s_chunk_size_start;
+    } else if (p->content_len > 0) {
+        p->state = s_body_read;
+    } else {
+        res      = hook_on_msg_complete_run(p, hooks);
+        p->state = s_start;
+
+        if (res) {
+            p->error = htparse_error_user;
+        }
+    }
+
+    return (size_t)(end - data) + 2;
+}     /* _htparse_request_fast */
+
+#endif
+
+static size_t
+_htparser_run(htparser * p, htparse_hooks * hooks, const char * data, size_t len) {
     unsigned char ch;
     char          c;
     size_t        i;
+    const char  * tok;
+    size_t        tok_len;
 
     htparse_log_debug("enter");
     htparse_log_debug("p == %p", p);
@@ -473,13 +1550,12 @@ htparser_run(htparser * p, htparse_hooks * hooks, const char * data, size_t len)
 
     for (i = 0; i < len; i++) {
         int res;
-        int err;
 
         ch = data[i];
 
         htparse_log_debug("[%p] data[%d] = %c (%x)", p, i, isprint(ch) ? ch : ' ', ch);
 
-        if (p->buf_idx >= sizeof(p->buf)) {
+        if (p->buf_idx + 1 >= p->buf_size && _htparse_buf_grow(p) == -1) {
             p->error = htparse_error_too_big;
             return i + 1;
         }
@@ -506,6 +1582,8 @@ htparser_run(htparser * p, htparse_hooks * hooks, const char * data, size_t len)
                 p->port_offset      = NULL;
                 p->path_offset      = NULL;
                 p->args_offset      = NULL;
+                p->tok_view         = NULL;
+                p->tok_len          = 0;
 
 
                 if (ch == CR || ch == LF) {
@@ -519,6 +1597,45 @@ htparser_run(htparser * p, htparse_hooks * hooks, const char * data, size_t len)
 
                 res = hook_on_msg_begin_run(p, hooks);
 
+#ifdef HTPARSE_HAVE_METHOD_WORD
+                if (res == 0 && p->type == htp_type_request) {
+                    size_t n;
+                    size_t mlen;
+
+                    /* the request line and headers are all here */
+                    if ((n = _htparse_request_fast(p, hooks, &data[i], len - i))) {
+                        p->total_bytes_read += n - 1;
+                        p->bytes_read       += n - 1;
+
+                        if (p->error != htparse_error_none) {
+                            return i + n;
+                        }
+
+                        i += n - 1;
+                        break;
+                    }
+
+                    /* only a method straddling two reads, or one which is
+                     * not known, goes through p->buf in s_method */
+                    if ((mlen = _htparse_method_word(&data[i], len - i, &p->method))) {
+                        res = hook_method_run(p, hooks, &data[i], mlen);
+
+                        /* skip over the method, the space is consumed below */
+                        p->total_bytes_read += mlen;
+                        p->bytes_read       += mlen;
+                        p->state             = s_spaces_before_uri;
+                        i += mlen;
+
+                        if (res) {
+                            p->error = htparse_error_user;
+                            return i + 1;
+                        }
+
+                        break;
+                    }
+                }
+#endif
+
                 p->buf[p->buf_idx++] = ch;
                 p->buf[p->buf_idx]   = '\0';
 
@@ -1008,6 +2125,8 @@ htparser_run(htparser * p, htparse_hooks * hooks, const char * data, size_t len)
                 if (usual[ch >> 5] & (1 << (ch & 0x1f))) {
                     p->buf[p->buf_idx++] = ch;
                     p->buf[p->buf_idx]   = '\0';
+
+                    i += _htparse_buf_run(p, data, i, len, &scan_check_uri);
                     break;
                 }
 
@@ -1082,6 +2201,8 @@ htparser_run(htparser * p, htparse_hooks * hooks, const char * data, size_t len)
                 if (usual[ch >> 5] & (1 << (ch & 0x1f))) {
                     p->buf[p->buf_idx++] = ch;
                     p->buf[p->buf_idx]   = '\0';
+
+                    i += _htparse_buf_run(p, data, i, len, &scan_uri);
                     break;
                 }
 
@@ -1385,16 +2506,29 @@ hdrline_start:
 
                 switch (ch) {
                     case CR:
+                        if (p->flags & parser_flag_trailing) {
+                            /* empty line ending the trailer section */
+                            p->state         = s_hdrline_almost_done;
+                            break;
+                        }
+
                         p->state             = s_hdrline_hdr_almost_done;
                         break;
                     case LF:
                         p->state             = s_hdrline_hdr_done;
                         break;
                     default:
-                        p->buf[p->buf_idx++] = ch;
-                        p->buf[p->buf_idx]   = '\0';
+                        p->tok_view          = &data[i];
+                        p->tok_len           = 0;
+
+                        i += _htparse_tok_run(p, data, i, len, &scan_hdr_key);
 
                         p->state             = s_hdrline_hdr_key;
+
+                        if (&data[i] - p->tok_view >= PARSER_STACK_MAX - 2) {
+                            p->error = htparse_error_too_big;
+                            return i + 1;
+                        }
                         break;
                 }
 
@@ -1405,57 +2539,52 @@ hdrline_start:
                 res = 0;
                 switch (ch) {
                     case ':':
-                        res      = hook_hdr_key_run(p, hooks, p->buf, p->buf_idx);
+                        if (_htparse_tok_end(p, &data[i]) == -1) {
+                            p->error = htparse_error_too_big;
+                            return i + 1;
+                        }
 
-                        /* figure out if the value of this header is valueable */
-                        p->heval = eval_hdr_val_none;
+                        tok      = _tok_data(p);
+                        tok_len  = _tok_len(p);
 
-                        switch (p->buf_idx + 1) {
-                            case 5:
-                                if (!strcasecmp(p->buf, "host")) {
-                                    p->heval = eval_hdr_val_hostname;
-                                }
-                                break;
-                            case 11:
-                                if (!strcasecmp(p->buf, "connection")) {
-                                    p->heval = eval_hdr_val_connection;
-                                }
-                                break;
-                            case 13:
-                                if (!strcasecmp(p->buf, "content-type")) {
-                                    p->heval = eval_hdr_val_content_type;
-                                }
-                                break;
-                            case 15:
-                                if (!strcasecmp(p->buf, "content-length")) {
-                                    p->heval = eval_hdr_val_content_length;
-                                }
-                                break;
-                            case 17:
-                                if (!strcasecmp(p->buf, "proxy-connection")) {
-                                    p->heval = eval_hdr_val_proxy_connection;
-                                }
-                                break;
-                            case 18:
-                                if (!strcasecmp(p->buf, "transfer-encoding")) {
-                                    p->heval = eval_hdr_val_transfer_encoding;
-                                }
-                                break;
-                        } /* switch */
+                        res      = hook_hdr_key_run(p, hooks, tok, tok_len);
+
+                        _htparse_hdr_key_eval(p, tok, tok_len);
 
                         p->buf_idx           = 0;
+                        p->tok_view          = NULL;
+                        p->tok_len           = 0;
                         p->state             = s_hdrline_hdr_space_before_val;
 
                         break;
                     case CR:
+                        if (_htparse_tok_end(p, &data[i]) == -1) {
+                            p->error = htparse_error_too_big;
+                            return i + 1;
+                        }
+
                         p->state             = s_hdrline_hdr_almost_done;
                         break;
                     case LF:
+                        if (_htparse_tok_end(p, &data[i]) == -1) {
+                            p->error = htparse_error_too_big;
+                            return i + 1;
+                        }
+
                         p->state             = s_hdrline_hdr_done;
                         break;
                     default:
-                        p->buf[p->buf_idx++] = ch;
-                        p->buf[p->buf_idx]   = '\0';
+                        if (p->tok_view == NULL) {
+                            p->buf[p->buf_idx++] = ch;
+                            p->buf[p->buf_idx]   = '\0';
+                        }
+
+                        i += _htparse_tok_run(p, data, i, len, &scan_hdr_key);
+
+                        if (p->tok_view && &data[i] - p->tok_view >= PARSER_STACK_MAX - 2) {
+                            p->error = htparse_error_too_big;
+                            return i + 1;
+                        }
                         break;
                 } /* switch */
 
@@ -1494,69 +2623,41 @@ hdrline_start:
                         p->error             = htparse_error_inval_hdr;
                         return i + 1;
                     default:
-                        p->buf[p->buf_idx++] = ch;
-                        p->buf[p->buf_idx]   = '\0';
+                        p->tok_view          = &data[i];
+                        p->tok_len           = 0;
                         p->state             = s_hdrline_hdr_val;
+
+                        i += _htparse_tok_run(p, data, i, len, &scan_hdr_val);
+
+                        if (&data[i] - p->tok_view >= PARSER_STACK_MAX - 2) {
+                            p->error = htparse_error_too_big;
+                            return i + 1;
+                        }
                         break;
                 } /* switch */
                 break;
             case s_hdrline_hdr_val:
                 htparse_log_debug("[%p] s_hdrline_hdr_val", p);
-                err = 0;
                 res = 0;
 
                 switch (ch) {
                     case CR:
-                        switch (p->heval) {
-                            case eval_hdr_val_none:
-                                break;
-                            case eval_hdr_val_hostname:
-                                res = hook_hostname_run(p, hooks, p->buf, p->buf_idx);
-                                break;
-                            case eval_hdr_val_content_length:
-                                p->content_len      = str_to_uint64(p->buf, p->buf_idx, &err);
-                                p->orig_content_len = p->content_len;
-
-                                htparse_log_debug("[%p] s_hdrline_hdr_val content-lenth = %zu", p, p->content_len);
+                        if (_htparse_tok_end(p, &data[i]) == -1) {
+                            p->error = htparse_error_too_big;
+                            return i + 1;
+                        }
 
-                                if (err == 1) {
-                                    p->error = htparse_error_too_big;
-                                    return i + 1;
-                                }
+                        tok     = _tok_data(p);
+                        tok_len = _tok_len(p);
 
+                        switch (_htparse_hdr_val_eval(p, hooks, tok, tok_len)) {
+                            case -1:
+                                p->error = htparse_error_too_big;
+                                return i + 1;
+                            case 1:
+                                res = 1;
                                 break;
-                            case eval_hdr_val_connection:
-                                switch (p->buf[0]) {
-                                    case 'K':
-                                    case 'k':
-                                        if (_str9cmp((p->buf + 1),
-                                                     'e', 'e', 'p', '-', 'A', 'l', 'i', 'v', 'e')) {
-                                            p->flags |= parser_flag_connection_keep_alive;
-                                        }
-                                        break;
-                                    case 'c':
-                                        if (_str5cmp(p->buf, 'c', 'l', 'o', 's', 'e')) {
-                                            p->flags |= parser_flag_connection_close;
-                                        }
-                                        break;
-                                }
-                                break;
-                            case eval_hdr_val_transfer_encoding:
-                                if (_str7_cmp(p->buf, 'c', 'h', 'u', 'n', 'k', 'e', 'd', '\0')) {
-                                    p->flags |= parser_flag_chunked;
-                                }
-
-                                break;
-                            case eval_hdr_val_content_type:
-                                if (p->buf[0] == 'm' || p->buf[0] == 'M') {
-                                    if (_str8cmp((p->buf + 1), 'u', 'l', 't', 'i', 'p', 'a', 'r', 't')) {
-                                        p->multipart = 1;
-                                    }
-                                }
-                                break;
-                            default:
-                                break;
-                        } /* switch */
+                        }
 
                         p->state             = s_hdrline_hdr_almost_done;
                         break;
@@ -1565,8 +2666,17 @@ hdrline_start:
                         p->error             = htparse_error_inval_hdr;
                         return i + 1;
                     default:
-                        p->buf[p->buf_idx++] = ch;
-                        p->buf[p->buf_idx]   = '\0';
+                        if (p->tok_view == NULL) {
+                            p->buf[p->buf_idx++] = ch;
+                            p->buf[p->buf_idx]   = '\0';
+                        }
+
+                        i += _htparse_tok_run(p, data, i, len, &scan_hdr_val);
+
+                        if (p->tok_view && &data[i] - p->tok_view >= PARSER_STACK_MAX - 2) {
+                            p->error = htparse_error_too_big;
+                            return i + 1;
+                        }
                         break;
                 } /* switch */
 
@@ -1579,15 +2689,8 @@ hdrline_start:
             case s_hdrline_hdr_almost_done:
                 htparse_log_debug("[%p] s_hdrline_hdr_almost_done", p);
 
-                res = 0;
                 switch (ch) {
                     case LF:
-                        if (p->flags & parser_flag_trailing) {
-                            res      = hook_on_msg_complete_run(p, hooks);
-                            p->state = s_start;
-                            break;
-                        }
-
                         p->state = s_hdrline_hdr_done;
                         break;
                     default:
@@ -1595,25 +2698,26 @@ hdrline_start:
                         return i + 1;
                 }
 
-                if (res) {
-                    p->error = htparse_error_user;
-                    return i + 1;
-                }
-
                 break;
             case s_hdrline_hdr_done:
                 htparse_log_debug("[%p] s_hdrline_hdr_done", p);
 
                 switch (ch) {
                     case CR:
-                        res      = hook_hdr_val_run(p, hooks, p->buf, p->buf_idx);
-                        p->state = s_hdrline_almost_done;
+                        res         = hook_hdr_val_run(p, hooks, _tok_data(p), _tok_len(p));
+                        p->tok_view = NULL;
+                        p->tok_len  = 0;
+                        p->state    = s_hdrline_almost_done;
 
                         if (res) {
                             p->error = htparse_error_user;
                             return i + 1;
                         }
 
+                        if (p->flags & parser_flag_trailing) {
+                            break;
+                        }
+
                         res = hook_on_hdrs_complete_run(p, hooks);
 
                         if (res) {
@@ -1629,15 +2733,21 @@ hdrline_start:
                         return i + 1;
                     case '\t':
                         /* this is a multiline header value, we must go back to
-                         * reading as a header value */
+                         * reading as a header value, which is appended to the
+                         * scratch buffer from here on */
+                        if (_htparse_tok_stage(p, &data[i]) == -1) {
+                            p->error = htparse_error_too_big;
+                            return i + 1;
+                        }
+
                         p->state             = s_hdrline_hdr_val;
                         break;
                     default:
-                        res                  = hook_hdr_val_run(p, hooks, p->buf, p->buf_idx);
+                        res                  = hook_hdr_val_run(p, hooks, _tok_data(p), _tok_len(p));
 
                         p->buf_idx           = 0;
-                        p->buf[p->buf_idx++] = ch;
-                        p->buf[p->buf_idx]   = '\0';
+                        p->tok_view          = &data[i];
+                        p->tok_len           = 0;
 
                         p->state             = s_hdrline_hdr_key;
 
@@ -1697,7 +2807,6 @@ hdrline_start:
                 if (p->flags & parser_flag_trailing) {
                     res      = hook_on_msg_complete_run(p, hooks);
                     p->state = s_start;
-                    break;
                 } else if (p->flags & parser_flag_chunked) {
                     p->state = s_chunk_size_start;
                     i--;
@@ -1866,5 +2975,70 @@ hdrline_start:
     }
 
     return i;
-}         /* htparser_run */
+}         /* _htparser_run */
 
+size_t
+htparser_run(htparser * p, htparse_hooks * hooks, const char * data, size_t len) {
+    size_t nread;
+
+    nread = _htparser_run(p, hooks, data, len);
+
+    /* header tokens referencing data can not outlive this call */
+    if (_htparse_tok_stage(p, data + nread) == -1) {
+        p->error = htparse_error_too_big;
+    }
+
+    /* an idle parser only needs the inline buffer */
+    if (p->state == s_start) {
+        _htparse_buf_release(p);
+    }
+
+    return nread;
+}
+
+
+uint64_t
+htparser_get_body_pending(htparser * p) {
+    switch (p->state) {
+        case s_body_read:
+        case s_chunk_data:
+            return p->content_len;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * accounts for body bytes the caller handed off itself instead of passing
+ * them through htparser_run(); len must not be more than
+ * htparser_get_body_pending(). Completing a content-length body runs
+ * on_msg_complete just as the parser would have.
+ */
+int
+htparser_body_consumed(htparser * p, htparse_hooks * hooks, size_t len) {
+    int res;
+
+    p->error             = htparse_error_none;
+    p->bytes_read        = len;
+    p->total_bytes_read += len;
+    p->content_len      -= len;
+
+    if (p->content_len > 0) {
+        return 0;
+    }
+
+    if (p->state == s_chunk_data) {
+        p->state = s_chunk_data_almost_done;
+        return 0;
+    }
+
+    res      = hook_on_msg_complete_run(p, hooks);
+    p->state = s_start;
+
+    if (res) {
+        p->error = htparse_error_user;
+        return -1;
+    }
+
+    return 0;
+}
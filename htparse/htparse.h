@@ -102,6 +102,8 @@ unsigned char  htparser_get_multipart(htparser *);
 unsigned int   htparser_get_status(htparser *);
 uint64_t       htparser_get_content_length(htparser *);
 uint64_t       htparser_get_content_pending(htparser *);
+uint64_t       htparser_get_body_pending(htparser *);
+int            htparser_body_consumed(htparser *, htparse_hooks *, size_t);
 uint64_t       htparser_get_total_bytes_read(htparser *);
 htpparse_error htparser_get_error(htparser *);
 const char   * htparser_get_strerror(htparser *);
@@ -109,6 +111,8 @@ void         * htparser_get_userdata(htparser *);
 void           htparser_set_userdata(htparser *, void *);
 void           htparser_init(htparser *, htp_type);
 htparser     * htparser_new(void);
+void           htparser_free(htparser *);
+void           htparser_pool_drain(void);
 
 #endif
 
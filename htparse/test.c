@@ -439,6 +439,18 @@ struct testobj t22 = {
             "Accept\r\n\r\n"
 };
 
+struct testobj t23 = {
+    .name = "POST request with chunked data and trailers, followed by another request",
+    .type = htp_type_request,
+    .data = "POST /test/ HTTP/1.1\r\n"
+            "Transfer-Encoding: chunked\r\n\r\n"
+            "1e\r\nall your base are belong to us\r\n"
+            "0\r\n"
+            "Content-MD5: 8c0fd6fe2f1a0f0e6c9cbd5a7bdfbc0d\r\n"
+            "X-Content-Length: 30\r\n\r\n"
+            "GET /test2 HTTP/1.1\r\n\r\n"
+};
+
 
 static int
 _run_test(htparser * p, struct testobj * obj) {
@@ -493,6 +505,7 @@ main(int argc, char **argv) {
     _run_test(parser, &t20);
     _run_test(parser, &t21);
     _run_test(parser, &t22);
+    _run_test(parser, &t23);
 
     return 0;
 }
@@ -0,0 +1,573 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#include "mpparse.h"
+
+#define MPPARSE_DELIM_MAX (MPPARSE_BOUNDARY_MAX + 4) /* CRLF "--" boundary */
+#define MPPARSE_HDR_MAX   8192                       /* longest part header line */
+#define LF                (unsigned char)10
+#define CR                (unsigned char)13
+
+enum mpparse_state {
+    s_preamble = 0,
+    s_delim_done,
+    s_delim_dash,
+    s_delim_almost_done,
+    s_hdrline,
+    s_data,
+    s_epilogue
+};
+
+typedef enum mpparse_state mpparse_state;
+
+struct mpparser {
+    mpparse_error error;
+    mpparse_state state;
+
+    size_t match;     /* bytes of the delimiter seen at the end of the last input */
+    size_t delim_len;
+    char   delim[MPPARSE_DELIM_MAX];
+
+    char * buf;       /* a header line which straddles two inputs, allocated on demand */
+    size_t buf_idx;
+
+    void * userdata;
+};
+
+static const char * errstr_map[] = {
+    "mpparse_error_none",
+    "mpparse_error_too_big",
+    "mpparse_error_invalid_delimiter",
+    "mpparse_error_invalid_header",
+    "mpparse_error_invalid_state",
+    "mpparse_error_user",
+    "mpparse_error_unknown"
+};
+
+#define __MPPARSE_GENHOOK(__n)                                                    \
+    static inline int hook_ ## __n ## _run(mpparser * p, mpparse_hooks * hooks) { \
+        if (hooks && (hooks)->__n) {                                              \
+            return (hooks)->__n(p);                                               \
+        }                                                                         \
+                                                                                  \
+        return 0;                                                                 \
+    }
+
+#define __MPPARSE_GENDHOOK(__n)                                                                           \
+    static inline int hook_ ## __n ## _run(mpparser * p, mpparse_hooks * hooks, const char * s, size_t l) { \
+        if (hooks && (hooks)->__n) {                                                                      \
+            return (hooks)->__n(p, s, l);                                                                 \
+        }                                                                                                 \
+                                                                                                          \
+        return 0;                                                                                         \
+    }
+
+__MPPARSE_GENHOOK(on_part_begin)
+__MPPARSE_GENHOOK(on_hdrs_complete)
+__MPPARSE_GENHOOK(on_part_complete)
+__MPPARSE_GENHOOK(on_body_complete)
+
+__MPPARSE_GENDHOOK(hdr_key)
+__MPPARSE_GENDHOOK(hdr_val)
+__MPPARSE_GENDHOOK(body)
+
+/**
+ * @brief finds the first delimiter in data, or the start of one which runs
+ *        into the end of data.
+ *
+ * @return the offset of the delimiter; it is complete if there are at least
+ *         dlen bytes from there on. len if data holds no delimiter.
+ */
+typedef size_t (*mpparse_find_fn)(const char * data, size_t len, const char * delim, size_t dlen);
+
+static size_t
+_mpparse_find_scalar(const char * data, size_t len, const char * delim, size_t dlen) {
+    const char * end = data + len;
+    const char * s   = data;
+
+    /* a delimiter always starts with CR, and a boundary never holds one */
+    while ((s = memchr(s, CR, end - s)) != NULL) {
+        size_t left = end - s;
+
+        if (memcmp(s, delim, left < dlen ? left : dlen) == 0) {
+            return s - data;
+        }
+
+        s++;
+    }
+
+    return len;
+}
+
+#if !defined(EVHTP_DISABLE_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MPPARSE_HAVE_SIMD 1
+#include <immintrin.h>
+
+/*
+ * Both compare a block of candidate positions against the first and the
+ * last byte of the delimiter at once, so that only the positions where
+ * both match are checked in full. Body data rarely gets that far.
+ */
+
+__attribute__((target("sse2")))
+static size_t
+_mpparse_find_sse2(const char * data, size_t len, const char * delim, size_t dlen) {
+    __m128i first = _mm_set1_epi8(delim[0]);
+    __m128i last  = _mm_set1_epi8(delim[dlen - 1]);
+    size_t  i     = 0;
+
+    while (len - i >= dlen - 1 + 16) {
+        __m128i  a    = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i  b    = _mm_loadu_si128((const __m128i *)(data + i + dlen - 1));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+
+            if (memcmp(data + i + bit + 1, delim + 1, dlen - 2) == 0) {
+                return i + bit;
+            }
+
+            mask &= mask - 1;
+        }
+
+        i += 16;
+    }
+
+    return i + _mpparse_find_scalar(data + i, len - i, delim, dlen);
+}
+
+__attribute__((target("avx2")))
+static size_t
+_mpparse_find_avx2(const char * data, size_t len, const char * delim, size_t dlen) {
+    __m256i first = _mm256_set1_epi8(delim[0]);
+    __m256i last  = _mm256_set1_epi8(delim[dlen - 1]);
+    size_t  i     = 0;
+
+    while (len - i >= dlen - 1 + 32) {
+        __m256i  a    = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i  b    = _mm256_loadu_si256((const __m256i *)(data + i + dlen - 1));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+
+            if (memcmp(data + i + bit + 1, delim + 1, dlen - 2) == 0) {
+                return i + bit;
+            }
+
+            mask &= mask - 1;
+        }
+
+        i += 32;
+    }
+
+    return i + _mpparse_find_scalar(data + i, len - i, delim, dlen);
+}
+
+#endif
+
+static mpparse_find_fn _mpparse_find = NULL;
+
+static void
+_mpparse_find_init(void) {
+#ifdef MPPARSE_HAVE_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        _mpparse_find = _mpparse_find_avx2;
+        return;
+    }
+
+    if (__builtin_cpu_supports("sse2")) {
+        _mpparse_find = _mpparse_find_sse2;
+        return;
+    }
+#endif
+
+    _mpparse_find = _mpparse_find_scalar;
+}
+
+/**
+ * @brief passes on part data up to the next delimiter. Data which may be the
+ *        start of a delimiter is held back until the next input tells.
+ *
+ * @return the number of bytes consumed; the state is s_delim_done if that
+ *         includes a whole delimiter.
+ */
+static size_t
+_mpparse_data(mpparser * p, mpparse_hooks * hooks, const char * data, size_t len) {
+    size_t i = 0;
+    size_t j;
+
+    if (p->match > 0) {
+        while (i < len && p->match < p->delim_len && data[i] == p->delim[p->match]) {
+            p->match++;
+            i++;
+        }
+
+        if (p->match == p->delim_len) {
+            p->match = 0;
+            p->state = s_delim_done;
+
+            return i;
+        }
+
+        if (i == len) {
+            return i;
+        }
+
+        /* it was data after all, which is the same as what was matched */
+        if (p->state == s_data && hook_body_run(p, hooks, p->delim, p->match)) {
+            p->error = mpparse_error_user;
+            return i;
+        }
+
+        p->match = 0;
+    }
+
+    j = i + _mpparse_find(data + i, len - i, p->delim, p->delim_len);
+
+    if (j > i && p->state == s_data && hook_body_run(p, hooks, data + i, j - i)) {
+        p->error = mpparse_error_user;
+        return j;
+    }
+
+    if (j == len) {
+        return len;
+    }
+
+    if (len - j >= p->delim_len) {
+        p->state = s_delim_done;
+
+        return j + p->delim_len;
+    }
+
+    p->match = len - j;
+
+    return len;
+}
+
+static int
+_mpparse_buf_append(mpparser * p, const char * data, size_t len) {
+    if (p->buf_idx + len > MPPARSE_HDR_MAX) {
+        return -1;
+    }
+
+    if (p->buf == NULL && !(p->buf = malloc(MPPARSE_HDR_MAX))) {
+        return -1;
+    }
+
+    memcpy(p->buf + p->buf_idx, data, len);
+    p->buf_idx += len;
+
+    return 0;
+}
+
+static int
+_mpparse_hdrline(mpparser * p, mpparse_hooks * hooks, const char * line, size_t len) {
+    const char * colon;
+    const char * val;
+    const char * end = line + len;
+
+    if (!(colon = memchr(line, ':', len)) || colon == line) {
+        p->error = mpparse_error_inval_hdr;
+        return -1;
+    }
+
+    for (val = colon + 1; val < end && (*val == ' ' || *val == '\t'); val++) {
+        ;
+    }
+
+    while (end > val && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+
+    if (hook_hdr_key_run(p, hooks, line, colon - line)) {
+        p->error = mpparse_error_user;
+        return -1;
+    }
+
+    if (hook_hdr_val_run(p, hooks, val, end - val)) {
+        p->error = mpparse_error_user;
+        return -1;
+    }
+
+    return 0;
+}
+
+size_t
+mpparser_run(mpparser * p, mpparse_hooks * hooks, const char * data, size_t len) {
+    size_t i = 0;
+
+    p->error = mpparse_error_none;
+
+    while (i < len) {
+        mpparse_state state = p->state;
+        const char  * lf;
+        const char  * line;
+        size_t        llen;
+        unsigned char ch;
+
+        switch (state) {
+            case s_preamble:
+            case s_data:
+                i += _mpparse_data(p, hooks, data + i, len - i);
+
+                if (p->error != mpparse_error_none) {
+                    return i;
+                }
+
+                if (state == s_data && p->state == s_delim_done) {
+                    if (hook_on_part_complete_run(p, hooks)) {
+                        p->error = mpparse_error_user;
+                        return i;
+                    }
+                }
+
+                break;
+            case s_delim_done:
+                ch = data[i++];
+
+                if (ch == '-') {
+                    p->state = s_delim_dash;
+                } else if (ch == CR) {
+                    p->state = s_delim_almost_done;
+                } else if (ch != ' ' && ch != '\t') {
+                    /* anything but linear white space up to the CRLF */
+                    p->error = mpparse_error_inval_delim;
+                    return i;
+                }
+
+                break;
+            case s_delim_dash:
+                if (data[i++] != '-') {
+                    p->error = mpparse_error_inval_delim;
+                    return i;
+                }
+
+                p->state = s_epilogue;
+
+                if (hook_on_body_complete_run(p, hooks)) {
+                    p->error = mpparse_error_user;
+                    return i;
+                }
+
+                break;
+            case s_delim_almost_done:
+                if (data[i++] != LF) {
+                    p->error = mpparse_error_inval_delim;
+                    return i;
+                }
+
+                p->state = s_hdrline;
+
+                if (hook_on_part_begin_run(p, hooks)) {
+                    p->error = mpparse_error_user;
+                    return i;
+                }
+
+                break;
+            case s_hdrline:
+                if (!(lf = memchr(data + i, LF, len - i))) {
+                    if (_mpparse_buf_append(p, data + i, len - i) == -1) {
+                        p->error = mpparse_error_too_big;
+                        return i;
+                    }
+
+                    return len;
+                }
+
+                llen = lf - (data + i);
+
+                if (p->buf_idx > 0) {
+                    if (_mpparse_buf_append(p, data + i, llen) == -1) {
+                        p->error = mpparse_error_too_big;
+                        return i;
+                    }
+
+                    line       = p->buf;
+                    llen       = p->buf_idx;
+                    p->buf_idx = 0;
+                } else {
+                    line       = data + i;
+                }
+
+                i += (lf - (data + i)) + 1;
+
+                if (llen > 0 && line[llen - 1] == CR) {
+                    llen--;
+                }
+
+                if (llen == 0) {
+                    p->state = s_data;
+
+                    if (hook_on_hdrs_complete_run(p, hooks)) {
+                        p->error = mpparse_error_user;
+                        return i;
+                    }
+
+                    break;
+                }
+
+                if (_mpparse_hdrline(p, hooks, line, llen) == -1) {
+                    return i;
+                }
+
+                break;
+            case s_epilogue:
+                /* ignored, like the preamble */
+                return len;
+            default:
+                p->error = mpparse_error_inval_state;
+                return i;
+        } /* switch */
+    }
+
+    return i;
+}         /* mpparser_run */
+
+int
+mpparser_get_complete(mpparser * p) {
+    return p->state == s_epilogue;
+}
+
+mpparse_error
+mpparser_get_error(mpparser * p) {
+    return p->error;
+}
+
+const char *
+mpparser_get_strerror(mpparser * p) {
+    mpparse_error e = mpparser_get_error(p);
+
+    if (e > mpparse_error_generic) {
+        return "mpparse_no_such_error";
+    }
+
+    return errstr_map[e];
+}
+
+void *
+mpparser_get_userdata(mpparser * p) {
+    return p->userdata;
+}
+
+void
+mpparser_set_userdata(mpparser * p, void * ud) {
+    p->userdata = ud;
+}
+
+/**
+ * @brief resets the parser for a body with the given boundary
+ *
+ * @return -1 if boundary is not a valid one
+ */
+int
+mpparser_init(mpparser * p, const char * boundary, size_t len) {
+    size_t i;
+
+    if (len == 0 || len > MPPARSE_BOUNDARY_MAX || boundary[len - 1] == ' ') {
+        return -1;
+    }
+
+    for (i = 0; i < len; i++) {
+        if ((unsigned char)boundary[i] < 0x20 || (unsigned char)boundary[i] > 0x7e) {
+            return -1;
+        }
+    }
+
+    p->error     = mpparse_error_none;
+    p->state     = s_preamble;
+    p->buf_idx   = 0;
+    p->delim_len = len + 4;
+
+    memcpy(p->delim, "\r\n--", 4);
+    memcpy(p->delim + 4, boundary, len);
+
+    /* the first delimiter may be at the very start of the body, without the
+     * CRLF in front of it, so treat the body as if it started with one */
+    p->match = 2;
+
+    if (_mpparse_find == NULL) {
+        _mpparse_find_init();
+    }
+
+    return 0;
+}
+
+mpparser *
+mpparser_new(void) {
+    return calloc(sizeof(mpparser), 1);
+}
+
+void
+mpparser_free(mpparser * p) {
+    if (p == NULL) {
+        return;
+    }
+
+    free(p->buf);
+    free(p);
+}
+
+/**
+ * @brief finds the boundary parameter of a multipart Content-Type value
+ *
+ * @param content_type the header value
+ * @param len the length of content_type
+ * @param boundary_len set to the length of the boundary
+ *
+ * @return the boundary, pointing into content_type, or NULL if there is none
+ */
+const char *
+mpparse_get_boundary(const char * content_type, size_t len, size_t * boundary_len) {
+    const char * end = content_type + len;
+    const char * s   = content_type;
+    const char * e;
+
+    if (len < 10 || strncasecmp(content_type, "multipart/", 10)) {
+        return NULL;
+    }
+
+    while ((s = memchr(s, ';', end - s)) != NULL) {
+        for (s++; s < end && (*s == ' ' || *s == '\t'); s++) {
+            ;
+        }
+
+        if (end - s <= 9 || strncasecmp(s, "boundary=", 9)) {
+            continue;
+        }
+
+        s += 9;
+
+        if (s < end && *s == '"') {
+            s++;
+
+            if (!(e = memchr(s, '"', end - s))) {
+                return NULL;
+            }
+        } else {
+            for (e = s; e < end && *e != ';' && *e != ' ' && *e != '\t'; e++) {
+                ;
+            }
+        }
+
+        if (e == s || e - s > MPPARSE_BOUNDARY_MAX) {
+            return NULL;
+        }
+
+        *boundary_len = e - s;
+
+        return s;
+    }
+
+    return NULL;
+} /* mpparse_get_boundary */
+
@@ -0,0 +1,59 @@
+#ifndef __MPPARSE_H__
+#define __MPPARSE_H__
+
+#include <stddef.h>
+
+/* RFC 2046: a boundary is between 1 and 70 characters */
+#define MPPARSE_BOUNDARY_MAX 70
+
+struct mpparser;
+
+enum mpparse_error {
+    mpparse_error_none = 0,
+    mpparse_error_too_big,
+    mpparse_error_inval_delim,
+    mpparse_error_inval_hdr,
+    mpparse_error_inval_state,
+    mpparse_error_user,
+    mpparse_error_generic
+};
+
+typedef struct mpparser      mpparser;
+typedef struct mpparse_hooks mpparse_hooks;
+
+typedef enum mpparse_error   mpparse_error;
+
+typedef int (*mpparse_hook)(mpparser *);
+typedef int (*mpparse_data_hook)(mpparser *, const char *, size_t);
+
+/*
+ * The data passed to a data hook points into the input given to
+ * mpparser_run(), and is only valid for the duration of the hook. A part
+ * header split over two inputs is passed from a copy kept by the parser,
+ * and body data split over two inputs is passed in more than one call.
+ */
+struct mpparse_hooks {
+    mpparse_hook      on_part_begin;       /* called after the delimiter of a part */
+    mpparse_data_hook hdr_key;
+    mpparse_data_hook hdr_val;
+    mpparse_hook      on_hdrs_complete;    /* called after the empty line ending the part headers */
+    mpparse_data_hook body;                /* called zero or more times per part */
+    mpparse_hook      on_part_complete;
+    mpparse_hook      on_body_complete;    /* called after the close delimiter */
+};
+
+
+size_t         mpparser_run(mpparser *, mpparse_hooks *, const char *, size_t);
+int            mpparser_get_complete(mpparser *);
+mpparse_error  mpparser_get_error(mpparser *);
+const char   * mpparser_get_strerror(mpparser *);
+void         * mpparser_get_userdata(mpparser *);
+void           mpparser_set_userdata(mpparser *, void *);
+int            mpparser_init(mpparser *, const char * boundary, size_t len);
+mpparser     * mpparser_new(void);
+void           mpparser_free(mpparser *);
+
+const char   * mpparse_get_boundary(const char * content_type, size_t len, size_t * boundary_len);
+
+#endif
+
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "mpparse.h"
+
+struct testobj {
+    char * name;
+    char * boundary;
+    char * data;
+};
+
+struct result {
+    char   buf[5000];
+    size_t buf_len;
+    char   body[2000]; /* part data is collected, as it may arrive in pieces */
+    size_t body_len;
+};
+
+/* appends len bytes of data to buf, which holds *off of them already */
+static void
+_add(char * buf, size_t size, size_t * off, const char * data, size_t len) {
+    if (len >= size - *off) {
+        printf("test output does not fit\n");
+        exit(1);
+    }
+
+    memcpy(buf + *off, data, len);
+    *off     += len;
+    buf[*off] = '\0';
+}
+
+#define ADD_BUF(r, data, len) _add((r)->buf, sizeof((r)->buf), &(r)->buf_len, data, len)
+#define ADD_STR(r, str)       ADD_BUF(r, str, strlen(str))
+
+#define ADD_DATA_BUF(r, name, data, len) do { \
+        ADD_STR(r, name ": '");               \
+        ADD_BUF(r, data, len);                \
+        ADD_STR(r, "'\n");                    \
+} while (0)
+
+static int
+_part_begin(mpparser * p) {
+    struct result * r = mpparser_get_userdata(p);
+
+    ADD_STR(r, "PART_BEGIN\n");
+
+    return 0;
+}
+
+static int
+_hdr_key(mpparser * p, const char * b, size_t s) {
+    struct result * r = mpparser_get_userdata(p);
+
+    ADD_DATA_BUF(r, "HDR_KEY", b, s);
+
+    return 0;
+}
+
+static int
+_hdr_val(mpparser * p, const char * b, size_t s) {
+    struct result * r = mpparser_get_userdata(p);
+
+    ADD_DATA_BUF(r, "HDR_VAL", b, s);
+
+    return 0;
+}
+
+static int
+_hdrs_complete(mpparser * p) {
+    struct result * r = mpparser_get_userdata(p);
+
+    ADD_STR(r, "HDRS_COMPLETE\n");
+
+    return 0;
+}
+
+static int
+_body(mpparser * p, const char * b, size_t s) {
+    struct result * r = mpparser_get_userdata(p);
+
+    _add(r->body, sizeof(r->body), &r->body_len, b, s);
+
+    return 0;
+}
+
+static int
+_part_complete(mpparser * p) {
+    struct result * r = mpparser_get_userdata(p);
+
+    ADD_DATA_BUF(r, "BODY", r->body, r->body_len);
+    ADD_STR(r, "PART_COMPLETE\n");
+
+    r->body[0]  = '\0';
+    r->body_len = 0;
+
+    return 0;
+}
+
+static int
+_body_complete(mpparser * p) {
+    struct result * r = mpparser_get_userdata(p);
+
+    ADD_STR(r, "BODY_COMPLETE\n");
+
+    return 0;
+}
+
+static mpparse_hooks hooks = {
+    .on_part_begin    = _part_begin,
+    .hdr_key          = _hdr_key,
+    .hdr_val          = _hdr_val,
+    .on_hdrs_complete = _hdrs_complete,
+    .body             = _body,
+    .on_part_complete = _part_complete,
+    .on_body_complete = _body_complete
+};
+
+struct testobj t1 = {
+    .name     = "form with two fields",
+    .boundary = "AaB03x",
+    .data     = "--AaB03x\r\n"
+                "Content-Disposition: form-data; name=\"submit-name\"\r\n\r\n"
+                "Larry\r\n"
+                "--AaB03x\r\n"
+                "Content-Disposition: form-data; name=\"files\"; filename=\"file1.txt\"\r\n"
+                "Content-Type: text/plain\r\n\r\n"
+                "... contents of file1.txt ...\r\n"
+                "--AaB03x--\r\n"
+};
+
+struct testobj t2 = {
+    .name     = "preamble, epilogue and padding after the delimiter",
+    .boundary = "simple boundary",
+    .data     = "This is the preamble.\r\n"
+                "--simple boundary \t\r\n"
+                "\r\n"
+                "implicitly typed plain text\r\n"
+                "--simple boundary\r\n"
+                "Content-type: text/plain; charset=us-ascii\r\n\r\n"
+                "explicitly typed plain text\r\n\r\n"
+                "--simple boundary--\r\n"
+                "This is the epilogue.\r\n"
+};
+
+struct testobj t3 = {
+    .name     = "part data which almost holds the delimiter",
+    .boundary = "xyz",
+    .data     = "--xyz\r\n"
+                "X: 1\r\n\r\n"
+                "\r\r\n\r\n-\r\n--\r\n--x\r\n--xy--xyz\r\n"
+                "--xyz\r\n"
+                "Y:2\r\n\r\n"
+                "\r\n"
+                "--xyz--"
+};
+
+struct testobj t4 = {
+    .name     = "[FAILURE TEST] part header without a colon",
+    .boundary = "xyz",
+    .data     = "--xyz\r\n"
+                "Content-Disposition form-data\r\n\r\n"
+                "data\r\n"
+                "--xyz--\r\n"
+};
+
+struct testobj t5 = {
+    .name     = "[FAILURE TEST] garbage after a delimiter",
+    .boundary = "xyz",
+    .data     = "--xyz\r\n"
+                "X: 1\r\n\r\n"
+                "data\r\n"
+                "--xyzzy\r\n"
+};
+
+static void
+_run(mpparser * p, struct testobj * obj, const char * data, size_t len, size_t split, struct result * r) {
+    int res;
+
+    memset(r, 0, sizeof(*r));
+
+    res = mpparser_init(p, obj->boundary, strlen(obj->boundary));
+    assert(res == 0);
+    (void)res;
+
+    mpparser_set_userdata(p, r);
+
+    if (mpparser_run(p, &hooks, data, split) == split && mpparser_get_error(p) == mpparse_error_none) {
+        mpparser_run(p, &hooks, data + split, len - split);
+    }
+
+    ADD_STR(r, "ERROR_STR: ");
+    ADD_STR(r, mpparser_get_strerror(p));
+    ADD_STR(r, "\n");
+}
+
+static int
+_run_test(mpparser * p, struct testobj * obj) {
+    size_t        len = strlen(obj->data);
+    size_t        split;
+    struct result whole;
+    struct result parts;
+
+    _run(p, obj, obj->data, len, len, &whole);
+
+    /* fed in two parts, at every possible point, the result is the same */
+    for (split = 0; split < len; split++) {
+        _run(p, obj, obj->data, len, split, &parts);
+
+        if (strcmp(whole.buf, parts.buf)) {
+            printf("%s: differs when split at %zu\n%s", obj->name, split, parts.buf);
+            exit(1);
+        }
+    }
+
+    printf("%s\n", obj->name);
+    printf("-----------------\n");
+    printf("%s", whole.buf);
+    printf("\n");
+
+    return 0;
+}
+
+static void
+_test_boundary(const char * content_type, const char * expected) {
+    const char * boundary;
+    size_t       len;
+
+    boundary = mpparse_get_boundary(content_type, strlen(content_type), &len);
+
+    if (expected == NULL ? boundary != NULL
+        : (boundary == NULL || len != strlen(expected) || memcmp(boundary, expected, len))) {
+        printf("wrong boundary for \"%s\"\n", content_type);
+        exit(1);
+    }
+}
+
+int
+main(int argc, char ** argv) {
+    mpparser * parser;
+    int        res;
+
+    parser = mpparser_new();
+    assert(parser != NULL);
+
+    _run_test(parser, &t1);
+    _run_test(parser, &t2);
+    _run_test(parser, &t3);
+    _run_test(parser, &t4);
+    _run_test(parser, &t5);
+
+    _test_boundary("multipart/form-data; boundary=AaB03x", "AaB03x");
+    _test_boundary("Multipart/Mixed; charset=utf-8;Boundary=\"simple boundary\"", "simple boundary");
+    _test_boundary("multipart/form-data; boundary=abc; charset=utf-8", "abc");
+    _test_boundary("multipart/form-data; boundary=", NULL);
+    _test_boundary("multipart/form-data", NULL);
+    _test_boundary("text/plain; boundary=abc", NULL);
+
+    res = mpparser_init(parser, "", 0);
+    assert(res == -1);
+
+    res = mpparser_init(parser, "bad\r\n", 5);
+    assert(res == -1);
+
+    (void)res;
+
+    mpparser_free(parser);
+
+    return 0;
+}
+
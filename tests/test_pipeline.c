@@ -0,0 +1,372 @@
+/*
+ * Checks that pipelined requests are replied to in the order they were
+ * sent, whichever order the replies are made in: a paused request and
+ * requests replied to later from a timer come before the requests sent
+ * after them. The requests are written all at once, then one byte at a
+ * time.
+ *
+ * Along the way, checks the headers of the replies: those of a header set
+ * attached to a callback are overridden by headers_out, and a
+ * Content-Length appended straight to headers_out is not written twice.
+ *
+ * usage: test_pipeline
+ *
+ * exits with 1 if a reply is missing, out of order or has wrong headers.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#ifndef EVHTP_DISABLE_REGEX
+#include <onigposix.h>
+#endif
+
+#include <evhtp.h>
+
+#define TIMEOUT 5 /* seconds to wait for the replies */
+
+/* each reply has the path of its request as body */
+static const char * paths[] = {
+    "/pause/100",
+    "/delay/50",
+    "/fast",
+    "/chunk/30",
+    "/set",
+    "/clen",
+    "/delay/10",
+    "/last",
+};
+
+#define NUM_PATHS (sizeof(paths) / sizeof(*paths))
+
+static void
+_reply(evhtp_request_t * req) {
+    evbuffer_add_printf(req->buffer_out, "%s", req->uri->path->full);
+    evhtp_send_reply(req, EVHTP_RES_OK);
+}
+
+static void
+_delay_fire(evutil_socket_t fd, short what, void * arg) {
+    _reply(arg);
+}
+
+static void
+_pause_fire(evutil_socket_t fd, short what, void * arg) {
+    evhtp_request_t * req = arg;
+
+    _reply(req);
+    evhtp_request_resume(req);
+}
+
+static void
+_chunk_fire(evutil_socket_t fd, short what, void * arg) {
+    evhtp_request_t * req  = arg;
+    const char      * path = req->uri->path->full;
+    evbuf_t         * buf  = evbuffer_new();
+
+    evhtp_send_reply_chunk_start(req, EVHTP_RES_OK);
+
+    evbuffer_add(buf, path, 3);
+    evhtp_send_reply_chunk(req, buf);
+
+    evbuffer_add(buf, path + 3, strlen(path + 3));
+    evhtp_send_reply_chunk(req, buf);
+
+    evhtp_send_reply_chunk_end(req);
+    evbuffer_free(buf);
+}
+
+/**
+ * @brief calls cb after the number of milliseconds at the end of the path
+ */
+static void
+_later(evhtp_request_t * req, event_callback_fn cb) {
+    const char   * msec = strrchr(req->uri->path->full, '/') + 1;
+    struct timeval tv   = { 0, atoi(msec) * 1000 };
+
+    event_base_once(req->conn->evbase, -1, EV_TIMEOUT, cb, req, &tv);
+}
+
+static void
+_pause_cb(evhtp_request_t * req, void * arg) {
+    evhtp_request_pause(req);
+    _later(req, _pause_fire);
+}
+
+static void
+_delay_cb(evhtp_request_t * req, void * arg) {
+    _later(req, _delay_fire);
+}
+
+static void
+_chunk_cb(evhtp_request_t * req, void * arg) {
+    _later(req, _chunk_fire);
+}
+
+static void
+_set_cb(evhtp_request_t * req, void * arg) {
+    evhtp_headers_add_header(req->headers_out, evhtp_header_new("X-A", "2", 0, 0));
+    _reply(req);
+}
+
+static void
+_clen_cb(evhtp_request_t * req, void * arg) {
+    evhtp_header_t * header = evhtp_header_new("Content-Length", "5", 0, 0);
+
+    /* not through evhtp_headers_add_header(), which keeps the lookups of
+     * the list up to date */
+    TAILQ_INSERT_TAIL(req->headers_out, header, next);
+    _reply(req);
+}
+
+static void
+_default_cb(evhtp_request_t * req, void * arg) {
+    _reply(req);
+}
+
+static int
+_count(const char * str, size_t len, const char * needle) {
+    size_t nlen = strlen(needle);
+    int    n    = 0;
+    size_t i;
+
+    for (i = 0; i + nlen <= len; i++) {
+        n += memcmp(str + i, needle, nlen) == 0;
+    }
+
+    return n;
+}
+
+/**
+ * @brief parses the reply at the start of buf
+ *
+ * @return the length of the reply, 0 if it is not all there yet, or -1 if
+ *         it could not be parsed
+ */
+static int
+_parse_reply(const char * buf, size_t len, char * body, size_t size,
+             const char ** headers, size_t * headers_len) {
+    const char * end;
+    const char * p;
+    size_t       blen = 0;
+    size_t       n;
+
+    if (!(end = strstr(buf, "\r\n\r\n"))) {
+        return 0;
+    }
+
+    *headers     = buf;
+    *headers_len = end + 2 - buf;
+    end         += 4;
+
+    if ((p = strstr(buf, "\r\nContent-Length: ")) && p < end) {
+        n = strtoul(p + 18, NULL, 10);
+
+        if (buf + len < end + n) {
+            return 0;
+        }
+
+        snprintf(body, size, "%.*s", (int)n, end);
+
+        return end + n - buf;
+    }
+
+    if (!(p = strstr(buf, "\r\nTransfer-Encoding: chunked\r\n")) || p > end) {
+        return -1;
+    }
+
+    /* chunks, up to the one of length 0 */
+    for (p = end; ; ) {
+        char * crlf;
+
+        if (!(crlf = strstr(p, "\r\n"))) {
+            return 0;
+        }
+
+        n = strtoul(p, NULL, 16);
+        p = crlf + 2;
+
+        if (buf + len < p + n + 2) {
+            return 0;
+        }
+
+        if (n == 0) {
+            return p + 2 - buf;
+        }
+
+        if (blen + n < size) {
+            memcpy(body + blen, p, n);
+            blen      += n;
+            body[blen] = '\0';
+        }
+
+        p += n + 2;
+    }
+} /* _parse_reply */
+
+static int
+_check_headers(const char * path, const char * headers, size_t len) {
+    if (_count(headers, len, "\r\nContent-Length:") > 1) {
+        fprintf(stderr, "%s: more than one Content-Length\n", path);
+        return -1;
+    }
+
+    if (strcmp(path, "/set") == 0 &&
+        (_count(headers, len, "\r\nX-A: 2\r\n") != 1 ||
+         _count(headers, len, "\r\nX-A:") != 1 ||
+         _count(headers, len, "\r\nServer: test_pipeline\r\n") != 1)) {
+        fprintf(stderr, "%s: wrong headers\n%.*s\n", path, (int)len, headers);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief writes the requests for all paths, step bytes at a time, and reads
+ *        the replies
+ *
+ * @return 0 if they all came back in order, -1 if not
+ */
+static int
+_run(evbase_t * evbase, int sock, size_t step) {
+    char         req[4096];
+    char         buf[16384];
+    char         body[256];
+    const char * headers;
+    size_t       headers_len;
+    size_t       req_len  = 0;
+    size_t       sent     = 0;
+    size_t       have     = 0;
+    size_t       replies  = 0;
+    time_t       deadline = time(NULL) + TIMEOUT;
+    size_t       i;
+    ssize_t      n;
+    int          len;
+
+    for (i = 0; i < NUM_PATHS; i++) {
+        req_len += snprintf(req + req_len, sizeof(req) - req_len,
+                            "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", paths[i]);
+    }
+
+    while (replies < NUM_PATHS) {
+        if (time(NULL) >= deadline) {
+            fprintf(stderr, "timed out with %zu replies\n", replies);
+            return -1;
+        }
+
+        if (sent < req_len) {
+            n = req_len - sent < step ? req_len - sent : step;
+
+            if (write(sock, req + sent, n) != n) {
+                fprintf(stderr, "write failed\n");
+                return -1;
+            }
+
+            sent += n;
+        }
+
+        event_base_loop(evbase, EVLOOP_NONBLOCK);
+
+        if ((n = read(sock, buf + have, sizeof(buf) - 1 - have)) > 0) {
+            have      += n;
+            buf[have]  = '\0';
+        } else if (n == 0) {
+            fprintf(stderr, "connection closed with %zu replies\n", replies);
+            return -1;
+        }
+
+        while (have > 0 && (len = _parse_reply(buf, have, body, sizeof(body),
+                                               &headers, &headers_len)) != 0) {
+            if (len == -1) {
+                fprintf(stderr, "could not parse reply:\n%s\n", buf);
+                return -1;
+            }
+
+            if (strcmp(body, paths[replies]) != 0) {
+                fprintf(stderr, "reply %zu is for %s, expected %s\n", replies, body, paths[replies]);
+                return -1;
+            }
+
+            if (_check_headers(paths[replies], headers, headers_len) == -1) {
+                return -1;
+            }
+
+            replies++;
+            have -= len;
+            memmove(buf, buf + len, have + 1);
+        }
+    }
+
+    return 0;
+} /* _run */
+
+int
+main(int argc, char ** argv) {
+    struct timeval       wait = { 0, 10000 };
+    evbase_t           * evbase;
+    evhtp_t            * htp;
+    evhtp_headers_t    * headers;
+    evhtp_header_set_t * set;
+    struct sockaddr_in   sin;
+    socklen_t            sin_len = sizeof(sin);
+    int                  sock;
+    int                  res     = 0;
+
+    evbase  = event_base_new();
+    htp     = evhtp_new(evbase, NULL);
+    headers = evhtp_headers_new();
+
+    evhtp_headers_add_header(headers, evhtp_header_new("Server", "test_pipeline", 0, 0));
+    evhtp_headers_add_header(headers, evhtp_header_new("X-A", "1", 0, 0));
+
+    set = evhtp_header_set_new(headers);
+    evhtp_headers_free(headers);
+
+    evhtp_set_cb(htp, "/pause/", _pause_cb, NULL);
+    evhtp_set_cb(htp, "/delay/", _delay_cb, NULL);
+    evhtp_set_cb(htp, "/chunk/", _chunk_cb, NULL);
+    evhtp_set_cb(htp, "/clen", _clen_cb, NULL);
+    evhtp_callback_set_header_set(evhtp_set_cb(htp, "/set", _set_cb, NULL), set);
+    evhtp_set_gencb(htp, _default_cb, NULL);
+
+    if (evhtp_bind_socket(htp, "127.0.0.1", 0, 128) < 0) {
+        fprintf(stderr, "could not bind\n");
+        return 1;
+    }
+
+    getsockname(evconnlistener_get_fd(htp->server), (struct sockaddr *)&sin, &sin_len);
+
+    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+        connect(sock, (struct sockaddr *)&sin, sin_len) < 0) {
+        fprintf(stderr, "could not connect\n");
+        return 1;
+    }
+
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+
+    if (_run(evbase, sock, 4096) == -1 || _run(evbase, sock, 1) == -1) {
+        res = 1;
+    }
+
+    close(sock);
+
+    /* let the server see the connection go away */
+    event_base_loopexit(evbase, &wait);
+    event_base_dispatch(evbase);
+
+    evhtp_unbind_socket(htp);
+    evhtp_free(htp);
+    event_base_free(evbase);
+    evhtp_header_set_free(set);
+
+    if (res == 0) {
+        printf("%zu pipelined requests in order\n", NUM_PATHS);
+    }
+
+    return res;
+} /* main */
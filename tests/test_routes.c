@@ -0,0 +1,617 @@
+/*
+ * Checks which callback answers a request. Each round sets a random mix of
+ * exact path, glob, regex and route callbacks on a server, then requests
+ * random paths from it and compares the callback which replied (along with
+ * its match offsets and route parameters) with what trying the callbacks
+ * one by one, in the order they were set, says it should have been.
+ *
+ * Also checks that invalid routes are refused.
+ *
+ * usage: test_routes [rounds [seed]]
+ *
+ * exits with 1 on the first mismatch, which is printed along with the
+ * callbacks of the round.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#ifndef EVHTP_DISABLE_REGEX
+#include <onigposix.h>
+#endif
+
+#include <evhtp.h>
+
+#define MAX_CALLBACKS 60
+#define NUM_PATHS     150
+#define TIMEOUT       5 /* seconds to wait for a reply */
+
+struct entry {
+    evhtp_callback_type type;
+    int                 index;
+    char                pattern[256];
+#ifndef EVHTP_DISABLE_REGEX
+    regex_t re;
+#endif
+};
+
+struct param {
+    const char * name;
+    size_t       name_len;
+    const char * val;
+    size_t       val_len;
+};
+
+static const char * segments[] = {
+    "a", "b", "ab", "abc", "x", "users", "u", "1", "42", "files", ""
+};
+
+static unsigned long long rnd_state;
+
+static unsigned int
+_rnd(void) {
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+
+    return (unsigned int)rnd_state;
+}
+
+static void
+_append(char * buf, size_t size, const char * str) {
+    size_t len = strlen(buf);
+
+    snprintf(buf + len, size - len, "%s", str);
+}
+
+/**
+ * @brief generates a path of up to 4 segments, with route parameters in
+ *        place of some segments if route is set
+ */
+static void
+_gen_path(char * buf, size_t size, int route) {
+    int n = _rnd() % 5;
+    int i;
+
+    buf[0] = '\0';
+
+    for (i = 0; i < n; i++) {
+        _append(buf, size, "/");
+
+        if (route && _rnd() % 4 == 0) {
+            _append(buf, size, _rnd() % 2 ? ":p" : ":q");
+        } else {
+            _append(buf, size, segments[_rnd() % (sizeof(segments) / sizeof(*segments))]);
+        }
+
+        if (_rnd() % 6 == 0) {
+            _append(buf, size, segments[_rnd() % 5]);
+        }
+    }
+
+    if (_rnd() % 3 == 0) {
+        _append(buf, size, "/");
+    }
+}
+
+/**
+ * @brief the reference glob matcher: '*' matches any run of characters,
+ *        anything else itself
+ */
+static int
+_ref_glob(const char * pattern, const char * str) {
+    if (*pattern == '\0') {
+        return *str == '\0';
+    }
+
+    if (*pattern == '*') {
+        do {
+            if (_ref_glob(pattern + 1, str)) {
+                return 1;
+            }
+        } while (*str++ != '\0');
+
+        return 0;
+    }
+
+    return *pattern == *str && _ref_glob(pattern + 1, str + 1);
+}
+
+/**
+ * @brief the reference route matcher, as documented by evhtp_set_route_cb()
+ */
+static int
+_ref_route(const char * route, const char * str, struct param * params, unsigned int * nparams) {
+    while (*route != '\0') {
+        if (*route == ':') {
+            size_t name_len = strcspn(route + 1, "/");
+            size_t val_len  = strcspn(str, "/");
+
+            if (val_len == 0) {
+                return 0;
+            }
+
+            params[*nparams].name     = route + 1;
+            params[*nparams].name_len = name_len;
+            params[*nparams].val      = str;
+            params[*nparams].val_len  = val_len;
+            (*nparams)++;
+
+            route += 1 + name_len;
+            str   += val_len;
+        } else if (*route == '*') {
+            params[*nparams].name     = route + 1;
+            params[*nparams].name_len = strlen(route + 1);
+            params[*nparams].val      = str;
+            params[*nparams].val_len  = strlen(str);
+            (*nparams)++;
+
+            return 1;
+        } else {
+            if (*route != *str) {
+                return 0;
+            }
+
+            route++;
+            str++;
+        }
+    }
+
+    return *str == '\0';
+}
+
+/**
+ * @brief gets the name of the next parameter of a route
+ *
+ * @return a pointer past the name, or NULL if there are no more parameters
+ */
+static const char *
+_next_param(const char * route, char * name, size_t size) {
+    size_t len;
+
+    if (!(route = strpbrk(route, ":*"))) {
+        return NULL;
+    }
+
+    len = strcspn(route + 1, *route == ':' ? "/" : "");
+
+    snprintf(name, size, "%.*s", (int)len, route + 1);
+
+    return route + 1 + len;
+}
+
+static int
+_describe_start(char * buf, size_t size, struct entry * entry,
+                unsigned int soff, unsigned int eoff) {
+    if (entry == NULL) {
+        return snprintf(buf, size, "none");
+    }
+
+    return snprintf(buf, size, "%d %u-%u", entry->index, soff, eoff);
+}
+
+static void
+_entry_cb(evhtp_request_t * req, void * arg) {
+    struct entry * entry = arg;
+    evhtp_path_t * path  = req->uri->path;
+    const char   * route = entry->pattern;
+    const char   * val;
+    char           name[256];
+    char           buf[1024];
+    size_t         len;
+
+    _describe_start(buf, sizeof(buf), entry, path->matched_soff, path->matched_eoff);
+    evbuffer_add(req->buffer_out, buf, strlen(buf));
+
+    while (entry->type == evhtp_callback_type_route &&
+           (route = _next_param(route, name, sizeof(name)))) {
+        if ((val = evhtp_path_get_param(path, name, &len))) {
+            evbuffer_add_printf(req->buffer_out, " %s=%.*s", name, (int)len, val);
+        }
+    }
+
+    evhtp_send_reply(req, EVHTP_RES_OK);
+}
+
+static void
+_default_cb(evhtp_request_t * req, void * arg) {
+    evbuffer_add(req->buffer_out, "none", 4);
+    evhtp_send_reply(req, EVHTP_RES_OK);
+}
+
+/**
+ * @brief tries each callback in turn against str, and describes the first
+ *        one which matches
+ *
+ * @return 1 if one matched, 0 if not
+ */
+static int
+_ref_find(struct entry * entries, int num_entries, const char * str, char * buf, size_t size) {
+    struct param params[EVHTP_PATH_MAX_PARAMS + 1];
+    unsigned int nparams;
+    unsigned int soff;
+    unsigned int eoff;
+    int          i;
+
+    for (i = 0; i < num_entries; i++) {
+        struct entry * entry = &entries[i];
+        const char   * route = entry->pattern;
+        char           name[256];
+        size_t         len;
+        unsigned int   k;
+#ifndef EVHTP_DISABLE_REGEX
+        regmatch_t pmatch[28];
+#endif
+
+        soff    = 0;
+        eoff    = (unsigned int)strlen(str);
+        nparams = 0;
+
+        switch (entry->type) {
+            case evhtp_callback_type_hash:
+                if (strcmp(entry->pattern, str) != 0) {
+                    continue;
+                }
+                break;
+            case evhtp_callback_type_glob:
+                if (!_ref_glob(entry->pattern, str)) {
+                    continue;
+                }
+                break;
+#ifndef EVHTP_DISABLE_REGEX
+            case evhtp_callback_type_regex:
+                if (regexec(&entry->re, str, entry->re.re_nsub + 1, pmatch, 0) != 0) {
+                    continue;
+                }
+
+                soff = pmatch[entry->re.re_nsub].rm_so;
+                eoff = pmatch[entry->re.re_nsub].rm_eo;
+                break;
+#endif
+            case evhtp_callback_type_route:
+                if (!_ref_route(entry->pattern, str, params, &nparams)) {
+                    continue;
+                }
+                break;
+            default:
+                continue;
+        } /* switch */
+
+        len = _describe_start(buf, size, entry, soff, eoff);
+
+        /* evhtp_path_get_param() returns the first parameter of a name */
+        while (entry->type == evhtp_callback_type_route &&
+               (route = _next_param(route, name, sizeof(name)))) {
+            for (k = 0; k < nparams; k++) {
+                if (params[k].name_len == strlen(name) &&
+                    memcmp(params[k].name, name, params[k].name_len) == 0) {
+                    len += snprintf(buf + len, size - len, " %s=%.*s",
+                                    name, (int)params[k].val_len, params[k].val);
+                    break;
+                }
+            }
+        }
+
+        return 1;
+    }
+
+    return 0;
+} /* _ref_find */
+
+/**
+ * @brief works out the expected reply to a request: the callbacks are tried
+ *        against the full path, then against the path without the file.
+ */
+static void
+_ref_reply(struct entry * entries, int num_entries, const char * path, char * buf, size_t size) {
+    char dir[256];
+
+    if (_ref_find(entries, num_entries, path, buf, size)) {
+        return;
+    }
+
+    snprintf(dir, sizeof(dir), "%.*s", (int)(strrchr(path, '/') - path + 1), path);
+
+    if (_ref_find(entries, num_entries, dir, buf, size)) {
+        return;
+    }
+
+    _describe_start(buf, size, NULL, 0, 0);
+}
+
+/**
+ * @brief sends a GET for path and runs the server until the whole reply has
+ *        been read back
+ *
+ * @return 0 with the body of the reply in body, -1 on error
+ */
+static int
+_request(evbase_t * evbase, int sock, const char * path, char * body, size_t size) {
+    char         buf[4096];
+    size_t       have = 0;
+    const char * end;
+    const char * clen;
+    time_t       deadline = time(NULL) + TIMEOUT;
+    ssize_t      n;
+    int          len;
+
+    len = snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", path);
+
+    if (write(sock, buf, len) != len) {
+        return -1;
+    }
+
+    while (time(NULL) < deadline) {
+        event_base_loop(evbase, EVLOOP_NONBLOCK);
+
+        if ((n = read(sock, buf + have, sizeof(buf) - 1 - have)) > 0) {
+            have      += n;
+            buf[have]  = '\0';
+        } else if (n == 0) {
+            return -1;
+        }
+
+        if (!(end = strstr(buf, "\r\n\r\n")) ||
+            !(clen = strstr(buf, "\r\nContent-Length: ")) || clen > end) {
+            continue;
+        }
+
+        end += 4;
+        len  = atoi(clen + 18);
+
+        if (buf + have >= end + len) {
+            snprintf(body, size, "%.*s", len, end);
+            return 0;
+        }
+    }
+
+    return -1;
+} /* _request */
+
+static void
+_print_entries(struct entry * entries, int num_entries) {
+    static const char * types[] = {
+        [evhtp_callback_type_hash]  = "exact",
+        [evhtp_callback_type_glob]  = "glob",
+#ifndef EVHTP_DISABLE_REGEX
+        [evhtp_callback_type_regex] = "regex",
+#endif
+        [evhtp_callback_type_route] = "route",
+    };
+    int i;
+
+    for (i = 0; i < num_entries; i++) {
+        fprintf(stderr, "  %d %s %s\n", entries[i].index, types[entries[i].type], entries[i].pattern);
+    }
+}
+
+/**
+ * @brief sets a random list of callbacks on a server and checks the replies
+ *        to NUM_PATHS random paths
+ *
+ * @return 0 if they all came from the expected callbacks, -1 if not
+ */
+static int
+_run_round(void) {
+    struct entry       entries[MAX_CALLBACKS];
+    int                num_entries = 0;
+    int                num_cbs     = 1 + _rnd() % MAX_CALLBACKS;
+    struct timeval     wait        = { 0, 10000 };
+    evbase_t         * evbase;
+    evhtp_t          * htp;
+    struct sockaddr_in sin;
+    socklen_t          sin_len     = sizeof(sin);
+    char               path[256];
+    char               want[1024];
+    char               got[1024];
+    int                sock;
+    int                res = 0;
+    int                i;
+
+    evbase = event_base_new();
+    htp    = evhtp_new(evbase, NULL);
+
+    evhtp_set_gencb(htp, _default_cb, NULL);
+
+    for (i = 0; i < num_cbs; i++) {
+        struct entry     * entry = &entries[num_entries];
+        evhtp_callback_t * cb    = NULL;
+        char             * pat   = entry->pattern;
+        size_t             size  = sizeof(entry->pattern);
+        size_t             len;
+
+        entry->index = i;
+        entry->type  = evhtp_callback_type_hash;
+
+        switch (_rnd() % 5) {
+            case 0:
+            case 1:
+                _gen_path(pat, size, 0);
+                cb = evhtp_set_cb(htp, pat, _entry_cb, entry);
+                break;
+            case 2:
+                _gen_path(pat, size, 0);
+
+                if (_rnd() % 2 == 0 || (len = strlen(pat)) < 3) {
+                    _append(pat, size, _rnd() % 2 ? "*" : "**");
+                } else {
+                    /* one to three '*' in place of other characters */
+                    pat[_rnd() % len] = '*';
+
+                    if (_rnd() % 2) {
+                        pat[_rnd() % len] = '*';
+                    }
+
+                    if (_rnd() % 3 == 0) {
+                        pat[_rnd() % len] = '*';
+                    }
+                }
+
+                entry->type = evhtp_callback_type_glob;
+                cb = evhtp_set_glob_cb(htp, pat, _entry_cb, entry);
+                break;
+            case 3:
+#ifndef EVHTP_DISABLE_REGEX
+            {
+                char lit[128];
+
+                _gen_path(lit, sizeof(lit), 0);
+
+                /* the offsets are those of the last group, which always
+                 * takes part in the match here */
+                switch (_rnd() % 4) {
+                    case 0:
+                        snprintf(pat, size, "^%s(.*)$", lit);
+                        break;
+                    case 1:
+                        snprintf(pat, size, "^(/(a|b))?%s(.*)$", lit);
+                        break;
+                    case 2:
+                        snprintf(pat, size, "%s(.*)$", lit);
+                        break;
+                    default:
+                        snprintf(pat, size, "%s%s%s", _rnd() % 2 ? "^" : "", lit,
+                                 _rnd() % 3 ? "" : "|/x");
+                        break;
+                }
+
+                entry->type = evhtp_callback_type_regex;
+
+                if ((cb = evhtp_set_regex_cb(htp, pat, _entry_cb, entry)) &&
+                    regcomp(&entry->re, pat, REG_EXTENDED) != 0) {
+                    fprintf(stderr, "could not compile %s\n", pat);
+                    return -1;
+                }
+            }
+#endif
+                break;
+            default:
+                _gen_path(pat, size, 1);
+
+                if (_rnd() % 3 == 0) {
+                    _append(pat, size, _rnd() % 2 ? "*rest" : "/*");
+                }
+
+                entry->type = evhtp_callback_type_route;
+                cb = evhtp_set_route_cb(htp, pat, _entry_cb, entry);
+                break;
+        } /* switch */
+
+        if (cb != NULL) {
+            num_entries++;
+        }
+    }
+
+    if (evhtp_bind_socket(htp, "127.0.0.1", 0, 128) < 0) {
+        fprintf(stderr, "could not bind\n");
+        return -1;
+    }
+
+    getsockname(evconnlistener_get_fd(htp->server), (struct sockaddr *)&sin, &sin_len);
+
+    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+        connect(sock, (struct sockaddr *)&sin, sin_len) < 0) {
+        fprintf(stderr, "could not connect\n");
+        return -1;
+    }
+
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+
+    for (i = 0; i < NUM_PATHS && res == 0; i++) {
+        _gen_path(path, sizeof(path) - 1, 0);
+
+        if (path[0] == '\0' || _rnd() % 3 == 0) {
+            _append(path, sizeof(path), path[0] ? "x" : "/");
+        }
+
+        _ref_reply(entries, num_entries, path, want, sizeof(want));
+
+        if (_request(evbase, sock, path, got, sizeof(got)) == -1) {
+            fprintf(stderr, "no reply to %s\n", path);
+            res = -1;
+        } else if (strcmp(got, want) != 0) {
+            fprintf(stderr, "%s: got \"%s\", expected \"%s\"\n", path, got, want);
+            _print_entries(entries, num_entries);
+            res = -1;
+        }
+    }
+
+    close(sock);
+
+    /* let the server see the connection go away */
+    event_base_loopexit(evbase, &wait);
+    event_base_dispatch(evbase);
+
+    evhtp_unbind_socket(htp);
+    evhtp_free(htp);
+    event_base_free(evbase);
+
+#ifndef EVHTP_DISABLE_REGEX
+    for (i = 0; i < num_entries; i++) {
+        if (entries[i].type == evhtp_callback_type_regex) {
+            regfree(&entries[i].re);
+        }
+    }
+#endif
+
+    return res;
+} /* _run_round */
+
+static int
+_check_invalid_routes(void) {
+    static const char * routes[] = {
+        "/users/:",
+        "/users/:/files",
+        "/mid/*x/y",
+        "/*x/",
+        "/a/*b*c/d",
+    };
+    evbase_t * evbase = event_base_new();
+    evhtp_t  * htp    = evhtp_new(evbase, NULL);
+    int        res    = 0;
+    size_t     i;
+
+    for (i = 0; i < sizeof(routes) / sizeof(*routes); i++) {
+        if (evhtp_set_route_cb(htp, routes[i], _default_cb, NULL) != NULL) {
+            fprintf(stderr, "invalid route %s was accepted\n", routes[i]);
+            res = -1;
+        }
+    }
+
+    if (evhtp_set_route_cb(htp, "/mid/:x/*y", _default_cb, NULL) == NULL) {
+        fprintf(stderr, "valid route /mid/:x/*y was refused\n");
+        res = -1;
+    }
+
+    evhtp_free(htp);
+    event_base_free(evbase);
+
+    return res;
+}
+
+int
+main(int argc, char ** argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 100;
+    int i;
+
+    rnd_state = argc > 2 ? strtoull(argv[2], NULL, 10) : 88172645463325252ULL;
+
+    if (_check_invalid_routes() == -1) {
+        return 1;
+    }
+
+    for (i = 0; i < rounds; i++) {
+        if (_run_round() == -1) {
+            fprintf(stderr, "round %d failed\n", i);
+            return 1;
+        }
+    }
+
+    printf("%d rounds of %d requests\n", rounds, NUM_PATHS);
+
+    return 0;
+}